@@ -26,12 +26,14 @@
 // POSSIBILITY OF SUCH DAMAGE.
 //
 
+#include <yocto/yocto_common.h>
 #include <yocto/yocto_commonio.h>
 #include <yocto/yocto_image.h>
 #include <yocto/yocto_math.h>
 #include <yocto_grade/yocto_grade.h>
 using namespace yocto::math;
 namespace cli = yocto::commonio;
+namespace cmn = yocto::common;
 namespace img = yocto::image;
 namespace grd = yocto::grade;
 using namespace std::string_literals;
@@ -39,11 +41,191 @@ using namespace std::string_literals;
 #include "ext/filesystem.hpp"
 namespace sfs = ghc::filesystem;
 
+#include <condition_variable>
+
+// Blocking queue with a fixed capacity used to pass images between the batch
+// pipeline stages. Producers wait while the queue is full, so that the number
+// of images in flight is bounded.
+template <typename T>
+struct bounded_queue {
+  explicit bounded_queue(int capacity) : capacity{(size_t)max(capacity, 1)} {}
+
+  void push(T&& value) {
+    auto lock = std::unique_lock<std::mutex>(mutex);
+    not_full.wait(lock, [this] { return queue.size() < capacity; });
+    queue.push_back(std::move(value));
+    not_empty.notify_one();
+  }
+  // returns false once the queue is closed and drained
+  bool pop(T& value) {
+    auto lock = std::unique_lock<std::mutex>(mutex);
+    not_empty.wait(lock, [this] { return !queue.empty() || closed; });
+    if (queue.empty()) return false;
+    value = std::move(queue.front());
+    queue.pop_front();
+    not_full.notify_one();
+    return true;
+  }
+  void close() {
+    auto lock = std::unique_lock<std::mutex>(mutex);
+    closed    = true;
+    not_empty.notify_all();
+  }
+
+ private:
+  size_t                  capacity = 1;
+  bool                    closed   = false;
+  std::deque<T>           queue    = {};
+  std::mutex              mutex;
+  std::condition_variable not_full;
+  std::condition_variable not_empty;
+};
+
+// Image travelling through the batch pipeline
+struct batch_item {
+  std::string       filename = "";
+  std::string       outname  = "";
+  img::image<vec4f> image    = {};
+  img::image<vec4b> graded   = {};
+};
+
+// Per-stage statistics of the batch pipeline
+struct batch_stage {
+  std::string name   = "";
+  int64_t     time   = 0;  // nanoseconds spent in the stage
+  double      pixels = 0;  // pixels processed by the stage
+};
+
+// Expand directories into the image files they contain, sorted by name.
+std::vector<std::string> expand_filenames(
+    const std::vector<std::string>& filenames) {
+  static const auto extensions = std::vector<std::string>{".png", ".jpg",
+      ".jpeg", ".tga", ".bmp", ".hdr", ".exr", ".pfm"};
+  auto expanded = std::vector<std::string>{};
+  for (auto& filename : filenames) {
+    if (!sfs::is_directory(filename)) {
+      expanded.push_back(filename);
+      continue;
+    }
+    auto entries = std::vector<std::string>{};
+    for (auto& entry : sfs::directory_iterator(filename)) {
+      if (!entry.is_regular_file()) continue;
+      auto ext = entry.path().extension().string();
+      for (auto& c : ext) c = (char)tolower(c);
+      if (std::find(extensions.begin(), extensions.end(), ext) ==
+          extensions.end())
+        continue;
+      entries.push_back(entry.path().generic_string());
+    }
+    std::sort(entries.begin(), entries.end());
+    expanded.insert(expanded.end(), entries.begin(), entries.end());
+  }
+  return expanded;
+}
+
+// Output filename from a pattern where `{name}` is replaced by the input
+// filename without directory and extension.
+std::string make_outname(
+    const std::string& pattern, const std::string& filename) {
+  auto name = sfs::path(filename).stem().string();
+  auto pos  = pattern.find("{name}");
+  if (pos == std::string::npos) return pattern;
+  return pattern.substr(0, pos) + name + pattern.substr(pos + 6);
+}
+
+// Grade a list of images with the same parameters. Decoding, grading and
+// encoding run concurrently on different images, while at most `inflight`
+// images wait between stages. Returns the number of failed images.
+int grade_batch(const std::vector<std::string>& filenames,
+    const std::string& pattern, const grd::grade_params& params, bool fast,
+    int inflight) {
+  auto decoded = bounded_queue<batch_item>{inflight};
+  auto graded  = bounded_queue<batch_item>{inflight};
+  auto stages  = std::vector<batch_stage>{
+      {"decode", 0, 0}, {"grade", 0, 0}, {"encode", 0, 0}};
+  auto errors  = std::atomic<int>{0};
+
+  // decode stage
+  auto decoder = cmn::run_async([&]() {
+    for (auto& filename : filenames) {
+      auto item     = batch_item{};
+      item.filename = filename;
+      item.outname  = make_outname(pattern, filename);
+      auto ioerror  = ""s;
+      auto start    = cmn::get_time();
+      if (!load_image(filename, item.image, ioerror)) {
+        cli::print_info("error: " + ioerror);
+        errors++;
+        continue;
+      }
+      stages[0].time += cmn::get_time() - start;
+      stages[0].pixels += (double)item.image.count();
+      decoded.push(std::move(item));
+    }
+    decoded.close();
+  });
+
+  // encode stage
+  auto encoder = cmn::run_async([&]() {
+    auto item = batch_item{};
+    while (graded.pop(item)) {
+      auto ioerror = ""s;
+      auto start   = cmn::get_time();
+      if (!save_image(item.outname, item.graded, ioerror)) {
+        cli::print_info("error: " + ioerror);
+        errors++;
+        continue;
+      }
+      stages[2].time += cmn::get_time() - start;
+      stages[2].pixels += (double)item.graded.count();
+      cli::print_info("graded " + item.filename + " -> " + item.outname);
+    }
+  });
+
+  // grade stage runs on this thread since grading is already parallel
+  auto start_batch = cmn::get_time();
+  auto item        = batch_item{};
+  while (decoded.pop(item)) {
+    auto start = cmn::get_time();
+    item.graded = fast ? grd::grade_image_byte(item.image, params)
+                       : float_to_byte(grd::grade_image(item.image, params));
+    item.image  = {};
+    stages[1].time += cmn::get_time() - start;
+    stages[1].pixels += (double)item.graded.count();
+    graded.push(std::move(item));
+  }
+  graded.close();
+  decoder.get();
+  encoder.get();
+  auto total_time = cmn::get_time() - start_batch;
+
+  // report throughput
+  auto format_mps = [](double pixels, int64_t time) {
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%.2f MP in %s (%.2f MP/s)",
+        pixels / 1e6, cli::format_duration(time).c_str(),
+        time > 0 ? (pixels / 1e6) / (time / 1e9) : 0.0);
+    return std::string{buffer};
+  };
+  for (auto& stage : stages) {
+    cli::print_info(stage.name + ": " + format_mps(stage.pixels, stage.time));
+  }
+  cli::print_info("total: " + std::to_string(filenames.size() - errors) +
+                  " images, " + format_mps(stages[2].pixels, total_time));
+
+  return errors;
+}
+
 int main(int argc, const char* argv[]) {
   // command line parameters
-  auto params   = grd::grade_params{};
-  auto output   = "out.png"s;
-  auto filename = "img.hdr"s;
+  auto params    = grd::grade_params{};
+  auto output    = "out.png"s;
+  auto filenames = std::vector<std::string>{"img.hdr"};
+  auto inflight  = 4;
+  auto fast      = false;
+  auto validate  = false;
+  auto cubename  = ""s;
+  auto lut_size  = 33;
 
   // parse command line
   auto cli = cli::make_cli("yimgproc", "Transform images");
@@ -59,8 +241,19 @@ int main(int argc, const char* argv[]) {
   add_option(cli, "--grain,-g", params.grain, "Grain strength");
   add_option(cli, "--mosaic,-m", params.mosaic, "Mosaic size (pixels)");
   add_option(cli, "--grid,-G", params.grid, "Grid size (pixels)");
-  add_option(cli, "--outimage,-o", output, "Output image filename", true);
-  add_option(cli, "image", filename, "Input image filename", true);
+  add_option(cli, "--outimage,-o", output,
+      "Output image filename, or pattern with {name} for many images", true);
+  add_option(cli, "--fast/--no-fast,-F", fast,
+      "Grade 8-bit pixels after tonemapping");
+  add_option(cli, "--validate/--no-validate", validate,
+      "Report the error of the fast path against the float path");
+  add_option(cli, "--outcube,-l", cubename,
+      "Output .cube file with the per-color grading");
+  add_option(cli, "--lut-size", lut_size, "Size of the .cube lattice");
+  add_option(cli, "--inflight,-j", inflight,
+      "Maximum images waiting between batch stages");
+  add_option(cli, "images", filenames,
+      "Input image filenames or directories", true);
 
   /* Custom filter parameters */
   add_option(cli, "--custom-filter,-cf", params.custom_filter_switch, "Turn on custom filter");
@@ -72,20 +265,81 @@ int main(int argc, const char* argv[]) {
   add_option(cli, "--sobel-threshold,-st", params.sobel_threshold, "Sobel threshold");
 
   parse_cli(cli, argc, argv);
+  if (lut_size < 2) cli::print_fatal("lut size must be at least 2");
+
+  // batch mode
+  filenames = expand_filenames(filenames);
+  if (filenames.size() != 1 || output.find("{name}") != std::string::npos) {
+    if (filenames.size() > 1 && output.find("{name}") == std::string::npos)
+      cli::print_fatal("output must be a pattern with {name} for many images");
+    auto errors = grade_batch(filenames, output, params, fast, inflight);
+    return errors ? 1 : 0;
+  }
 
   // error buffer
   auto ioerror = ""s;
 
   // load
   auto img = img::image<vec4f>{};
-  if (!load_image(filename, img, ioerror)) cli::print_fatal(ioerror);
+  if (!load_image(filenames.front(), img, ioerror)) cli::print_fatal(ioerror);
+
+  // range of the input colors for luts
+  auto max_value = 1.0f;
+  for (auto& pixel : img) max_value = max(max_value, max(xyz(pixel)));
+
+  // compare fast and lut paths with the float path without grain, since grain
+  // is random, also forcing saturation and tint outside the [0, 1] range
+  if (validate) {
+    auto report = [](const std::string& name,
+                      const img::image<vec4b>& reference,
+                      const img::image<vec4b>& graded) {
+      auto max_error = 0;
+      auto sum_error = (int64_t)0;
+      for (auto idx = 0; idx < (int)reference.count(); idx++) {
+        for (auto c = 0; c < 4; c++) {
+          auto error = yocto::math::abs(
+              (int)reference[idx][c] - (int)graded[idx][c]);
+          max_error = max(max_error, error);
+          sum_error += error;
+        }
+      }
+      cli::print_info(name + " max error: " + std::to_string(max_error) +
+                      " levels, mean error: " +
+                      std::to_string(sum_error / (4.0 * reference.count())) +
+                      " levels");
+    };
+    auto check_sets = std::vector<std::pair<std::string, grd::grade_params>>{
+        {"", params}, {" saturated", params}, {" tinted", params}};
+    check_sets[1].second.saturation = 0.9f;
+    check_sets[1].second.vignette   = max(params.vignette, 0.5f);
+    check_sets[2].second.tint       = {1.6f, 1.0f, 0.6f};
+    check_sets[2].second.vignette   = max(params.vignette, 0.5f);
+    for (auto& [suffix, check_params] : check_sets) {
+      check_params.grain = 0;
+      auto reference = float_to_byte(grd::grade_image(img, check_params));
+      report("fast path" + suffix, reference,
+          grd::grade_image_byte(img, check_params));
+      auto lut = grd::make_grade_lut(check_params, lut_size, max_value);
+      report("lut path" + suffix, reference,
+          float_to_byte(grd::grade_image(img, lut, check_params)));
+    }
+  }
 
-  // corrections
-  img = grd::grade_image(img, params);
+  // save lut
+  if (!cubename.empty()) {
+    auto lut = grd::make_grade_lut(params, lut_size, max_value);
+    if (!grd::save_cube(cubename, lut, ioerror)) cli::print_fatal(ioerror);
+  }
 
-  // save
-  if (!save_image(output, float_to_byte(img), ioerror))
-    cli::print_fatal(ioerror);
+  // corrections and save
+  if (fast) {
+    if (!save_image(output, grd::grade_image_byte(img, params), ioerror))
+      cli::print_fatal(ioerror);
+  } else {
+    img = grd::grade_image(img, params);
+    if (!save_image(output, float_to_byte(img), ioerror))
+      cli::print_fatal(ioerror);
+  }
 
   // done
   return 0;
@@ -36,6 +36,7 @@ namespace img = yocto::image;
 namespace grd = yocto::grade;
 namespace gui = yocto::gui;
 
+#include <chrono>
 #include <future>
 using namespace std::string_literals;
 
@@ -51,18 +52,127 @@ struct app_state {
   img::image<vec4f> display = {};
   grd::grade_params params  = {};
 
+  // per-color grading baked in a lut for previews
+  bool           use_lut   = true;
+  int            lut_size  = 33;
+  float          max_value = 1;
+  grd::grade_lut lut       = {};
+
   // viewing properties
   gui::image*       glimage  = new gui::image{};
   gui::image_params glparams = {};
 
+  // grading computation: a proxy is graded from the mip pyramid right away,
+  // while the full resolution image is graded in the background
+  int                            pratio       = 8;
+  std::vector<img::image<vec4f>> mips         = {};
+  img::image<vec4f>              graded       = {};
+  std::atomic<bool>              graded_ready = {};
+  std::future<void>              grade_worker = {};
+  std::atomic<bool>              grade_stop   = {};
+  bool                           grade_queued = false;
+
+  // stages cached at full resolution, with statistics copied for the ui
+  grd::grade_cache               cache         = {};
+  std::vector<grd::grade_stage>  stages        = {};
+  std::vector<grd::grade_stage>  graded_stages = {};
+
   ~app_state() {
+    if (grade_worker.valid()) {
+      grade_stop = true;
+      grade_worker.get();
+    }
     if (glimage) delete glimage;
   }
 };
 
+// halve the image size until the smallest side reaches 64 pixels
+void init_mips(app_state* app) {
+  app->mips.clear();
+  auto size = app->source.size() / 2;
+  while (min(size) >= 64) {
+    app->mips.push_back(img::resize_image(
+        app->mips.empty() ? app->source : app->mips.back(), size));
+    size /= 2;
+  }
+}
+
+img::image<vec4f> grade(const img::image<vec4f>& img, bool use_lut,
+    const grd::grade_lut& lut, const grd::grade_params& params,
+    grd::grade_cache* cache, std::atomic<bool>* stop) {
+  if (cache) {
+    return grd::grade_image(*cache, img, params, use_lut ? &lut : nullptr, stop);
+  } else if (use_lut) {
+    return grd::grade_image(img, lut, params, stop);
+  } else {
+    return grd::grade_image(img, params, stop);
+  }
+}
+
+// start grading at full resolution, with a copy of the parameters since
+// the widgets may change them while grading; the lut is only used for
+// previews, so the final image is always graded exactly
+void start_grading(app_state* app) {
+  app->grade_queued = false;
+  app->graded_ready = false;
+  app->grade_stop   = false;
+  app->grade_worker = std::async(
+      std::launch::async, [app, params = app->params]() {
+        auto graded = grade(app->source, false, {}, params, &app->cache,
+            &app->grade_stop);
+        if (app->grade_stop) return;
+        app->graded        = std::move(graded);
+        app->graded_stages = app->cache.stages;
+        app->graded_ready  = true;
+      });
+}
+
+// start the queued grading once the stopped worker returns, without
+// blocking the ui
+void poll_grading(app_state* app) {
+  if (!app->grade_queued) return;
+  if (app->grade_worker.valid()) {
+    if (app->grade_worker.wait_for(std::chrono::seconds(0)) !=
+        std::future_status::ready)
+      return;
+    app->grade_worker.get();
+  }
+  start_grading(app);
+}
+
 void update_display(app_state* app) {
+  // stop grading and queue it again; the worker is restarted by
+  // poll_grading() once it returns, so only the worker touches the cache
+  app->grade_stop   = true;
+  app->graded_ready = false;
+  app->grade_queued = true;
   if (app->display.size() != app->source.size()) app->display = app->source;
-  app->display = grd::grade_image(app->source, app->params);
+
+  // grade preview from the mip level closest to pratio, with pixel sizes
+  // scaled to the level; without mips the full resolution grade is the only
+  // one and the previous image is kept until it is ready
+  auto level = 0;
+  while ((2 << level) <= app->pratio && level < (int)app->mips.size()) level++;
+  if (level) {
+    if (app->use_lut)
+      app->lut = grd::make_grade_lut(
+          app->params, app->lut_size, app->max_value);
+    auto pparams = app->params;
+    if (pparams.mosaic) pparams.mosaic = max(pparams.mosaic >> level, 1);
+    if (pparams.grid) pparams.grid = max(pparams.grid >> level, 1);
+    auto preview = grade(app->mips[level - 1], app->use_lut, app->lut,
+        pparams, nullptr, nullptr);
+    for (auto j = 0; j < app->display.size().y; j++) {
+      for (auto i = 0; i < app->display.size().x; i++) {
+        auto pi = clamp(i >> level, 0, preview.size().x - 1),
+             pj = clamp(j >> level, 0, preview.size().y - 1);
+        app->display[{i, j}] = preview[{pi, pj}];
+      }
+    }
+  }
+
+  // grade at full resolution
+  poll_grading(app);
 }
 
 int main(int argc, const char* argv[]) {
@@ -74,6 +184,8 @@ int main(int argc, const char* argv[]) {
   // command line options
   auto cli = cli::make_cli("yimgigrades", "view images");
   add_option(cli, "--output,-o", app->outname, "image output");
+  add_option(cli, "--lut-size", app->lut_size, "preview lut size");
+  add_option(cli, "--pratio", app->pratio, "proxy preview ratio");
   add_option(cli, "image", app->filename, "image filename", true);
   parse_cli(cli, argc, argv);
 
@@ -84,6 +196,13 @@ int main(int argc, const char* argv[]) {
         return 1;
   }
 
+  // range of the input colors for the lut
+  for (auto& pixel : app->source)
+    app->max_value = max(app->max_value, max(xyz(pixel)));
+
+  // mip pyramid for proxy previews
+  init_mips(app);
+
   // update display
   update_display(app);
 
@@ -96,6 +215,13 @@ int main(int argc, const char* argv[]) {
           init_image(app->glimage);
           set_image(app->glimage, app->display, false, false);
         }
+        poll_grading(app);
+        if (app->graded_ready && !app->grade_queued) {
+          app->display      = std::move(app->graded);
+          app->stages       = app->graded_stages;
+          app->graded_ready = false;
+          set_image(app->glimage, app->display, false, false);
+        }
         update_imview(app->glparams.center, app->glparams.scale,
             app->display.size(), app->glparams.window, app->glparams.fit);
         draw_image(app->glimage, app->glparams);
@@ -127,8 +253,29 @@ int main(int argc, const char* argv[]) {
             edited += draw_slider(win, "Bilateral loops", params.bilateral_loops, 1, 5);
             edited += draw_slider(win, "Median radius", params.median_kernel_size, 1, 4);
             edited += draw_slider(win, "Sobel threshold", params.sobel_threshold, 0.f, 1.f);
+            for (auto& stage : app->stages) {
+                draw_label(win, stage.name.c_str(),
+                    std::to_string(stage.hits) + " hits, " +
+                    std::to_string(stage.misses) + " misses, " +
+                    cli::format_duration(stage.time));
+            }
             gui::end_header(win);
         }
+        if (begin_header(win, "preview")) {
+            edited += draw_slider(win, "pratio", app->pratio, 1, 64);
+            end_header(win);
+        }
+        if (begin_header(win, "lut")) {
+            edited += draw_checkbox(win, "preview with lut", app->use_lut);
+            edited += draw_slider(win, "lut size", app->lut_size, 2, 65);
+            if (draw_button(win, "save cube", app->use_lut)) {
+                auto ioerror = ""s;
+                if (!grd::save_cube(cli::replace_extension(app->outname, ".cube"),
+                        app->lut, ioerror))
+                    cli::print_info(ioerror);
+            }
+            end_header(win);
+        }
         if (begin_header(win, "inspect")) {
             draw_slider(win, "zoom", app->glparams.scale, 0.1, 10);
             draw_checkbox(win, "fit", app->glparams.fit);
@@ -449,7 +449,6 @@ inline bool save_text(
     error = filename + ": write error";
     return false;
   }
-  fclose(fs);
   return true;
 }
 
@@ -471,7 +470,6 @@ inline bool load_binary(
     error = filename + ": read error";
     return false;
   }
-  fclose(fs);
   return true;
 }
 
@@ -488,7 +486,6 @@ inline bool save_binary(const std::string& filename,
     error = filename + ": rewritead error";
     return false;
   }
-  fclose(fs);
   return true;
 }
 
@@ -38,16 +38,17 @@
 namespace yocto::grade {
 
 template <typename Func>
-inline void parallel_for(const vec2i& size, Func&& func){
+inline void parallel_for(const vec2i& size, Func&& func, std::atomic<bool>* stop){
     auto             futures  = std::vector<std::future<void>>{};
     auto             nthreads = std::thread::hardware_concurrency();
     std::atomic<int> next_idx(0);
     for (auto thread_id = 0; thread_id < nthreads; thread_id++) {
         futures.emplace_back(
-                std::async(std::launch::async, [&func, &next_idx, size]() {
+                std::async(std::launch::async, [&func, &next_idx, size, stop]() {
                     while (true) {
                         auto j = next_idx.fetch_add(1);
                         if (j >= size.y) break;
+                        if (stop && *stop) break;
                         for (auto i = 0; i < size.x; i++) func({i, j});
                     }
                 }));
@@ -82,7 +83,7 @@ inline void quantize_byte_image_mt(img::image<vec4b> & in, img::image<vec4b> & o
         out[ij].z = floor(in[ij].z / f) * f;
     });
 }
-inline void median_byte_image_mt(img::image<vec4b> & in, img::image<vec4b> & out, int kernel_size, int num_threads) {
+inline void median_byte_image_mt(img::image<vec4b> & in, img::image<vec4b> & out, int kernel_size, int num_threads, std::atomic<bool>* stop) {
     vec2i img_size = in.size();
     std::vector<vec2i> offset, temp;
     auto buffer = img::image<vec4b>{img_size};
@@ -96,6 +97,7 @@ inline void median_byte_image_mt(img::image<vec4b> & in, img::image<vec4b> & out
         vec3i hist[256];
         int n;
         for(int y = chunk * ij.y; y < min(chunk * ij.y + chunk, img_size.y); y++) {
+            if(stop && *stop) return;
             memset(hist, 0, 256 * sizeof(vec3i));
             n = 0;
             for (int x = 0; x < img_size.x; x++) {
@@ -137,9 +139,10 @@ inline void median_byte_image_mt(img::image<vec4b> & in, img::image<vec4b> & out
             }
         }
     });
+    if(stop && *stop) return;
     for(int i = 0; i < img_size.x*img_size.y; i++) out[i] = buffer[i];
 }
-inline void bilateral_filter_mt(img::image<vec4f> & in, img::image<vec4f> & out, int kernel_size, float threshold, int loops, vec2i num_threads) {
+inline void bilateral_filter_mt(img::image<vec4f> & in, img::image<vec4f> & out, int kernel_size, float threshold, int loops, vec2i num_threads, std::atomic<bool>* stop) {
     vec2i img_size = in.size();
     std::vector<vec2f> offset;
 
@@ -153,6 +156,7 @@ inline void bilateral_filter_mt(img::image<vec4f> & in, img::image<vec4f> & out,
     auto temp = img::image<vec4f>{img_size};
 
     for(int k = 0; k < loops; k++){
+        if(stop && *stop) return;
         parallel_for(num_threads, [&](const vec2i& ij){
             int index = ij.x + ij.y * img_size.x;
             float weight = 0;
@@ -169,11 +173,11 @@ inline void bilateral_filter_mt(img::image<vec4f> & in, img::image<vec4f> & out,
                 }
             }
             temp[index] = vec4f(mean * (1.f / weight), in[index].w);
-        });
+        }, stop);
         for(int i = 0; i < img_size.x*img_size.y; i++) out[i] = temp[i];
     }
 }
-inline void sobel_edge_detection(img::image<vec4f> & in, img::image<vec4f> & out, float threshold){
+inline void sobel_edge_detection(img::image<vec4f> & in, img::image<vec4f> & out, float threshold, std::atomic<bool>* stop){
     static int sobel_dx[9] { -1, 0, 1, -2, 0, 2, -1, 0, 1 };
     static int sobel_dy[9] { 1, 2, 1, 0, 0, 0, -1, -2, -1 };
     vec2i img_size = in.size();
@@ -182,7 +186,8 @@ inline void sobel_edge_detection(img::image<vec4f> & in, img::image<vec4f> & out
     auto ldr_grayscale = img::image<float>{img_size};
     parallel_for(img_size, [&](const vec2i& ij) {
         ldr_grayscale[ij] = in[ij].x * 0.299f + in[ij].y * 0.587f + in[ij].z * 0.114;
-    });
+    }, stop);
+    if(stop && *stop) return;
 
     // apply sobel edge algorithm
     parallel_for(img_size-4, [&](const vec2i& ij) {
@@ -195,61 +200,48 @@ inline void sobel_edge_detection(img::image<vec4f> & in, img::image<vec4f> & out
             }
         }
         if((abs(gx)+abs(gy)) > threshold) out[ij+2] = vec4f(img::zero3f, in[ij+2].w);
-    });
+    }, stop);
 }
 
-img::image<vec4f> grade_image(
-    const img::image<vec4f>& img, const grade_params& params) {
-    static auto rng = make_rng(1998);
-
-    // image size and output image
-    vec2i img_size = vec2i(img.size());
-    auto ldr = img::image<vec4f>{img_size};
-
+vec3f grade_color(const vec3f& rgb, const grade_params& params) {
     // apply tone mapping
-    parallel_for(img_size, [&](const vec2i& ij) {
-        vec3f p = xyz(img[ij]);
-        p *= pow(2, params.exposure);
-
-        if(params.filmic){
-            p *= 0.6;
-            vec3f pw = pow(p, 2);
-            p = (pw * 2.51 + p * 0.03) / (pw * 2.43 + p * 0.59 + 0.14);
-        }
+    vec3f p = rgb * pow(2, params.exposure);
 
-        if(params.srgb) p = rgb_to_srgb(p);
-        ldr[ij] = vec4f(p, img[ij].w);
-    });
+    if(params.filmic){
+        p *= 0.6;
+        vec3f pw = pow(p, 2);
+        p = (pw * 2.51 + p * 0.03) / (pw * 2.43 + p * 0.59 + 0.14);
+    }
 
-    // adapt tint for vec4f operations
-    vec4f tint = vec4f(params.tint, 1);
-    vec2f img_size_half = vec2f(img.size()) / 2.f;
+    if(params.srgb) p = rgb_to_srgb(p);
 
-    parallel_for(img_size, [&](const vec2i& ij) {
-        // temporary save w
-        float w = ldr[ij].w;
+    // calculate tint
+    p = clamp(p, 0.f, 1.f) * params.tint;
 
-        // calculate tint
-        ldr[ij] = clamp(ldr[ij], 0.f, 1.f) * tint;
+    // calculate saturation
+    float g = (p.x + p.y + p.z) / 3.f;
+    p = g + (p - g) * (params.saturation * 2);
 
-        // calculate saturation
-        float g = (ldr[ij].x + ldr[ij].y + ldr[ij].z) / 3.f;
-        ldr[ij] = g + (ldr[ij] - g) * (params.saturation * 2);
+    // calculate contrast
+    return gain(p, 1 - params.contrast);
+}
 
-        // calculate contrast
-        ldr[ij] = gain(ldr[ij], 1 - params.contrast);
+// vignette and film grain applied after the per-color grading
+inline vec3f apply_vignette_grain(vec3f p, const vec2i& ij, const vec2f& img_size_half, const grade_params& params, rng_state& rng) {
+    // if vignette differ from 0 then calculate it
+    if(params.vignette != 0.f){
+        float vr = 1.f - params.vignette;
+        float r = length(img_size_half - vec2f(ij)) / length(img_size_half);
+        p *= (1.f - smoothstep(vr, 2 * vr, r));
+    }
 
-        // if vignette differ from 0 then calculate it
-        if(params.vignette != 0.f){
-            float vr = 1.f - params.vignette;
-            float r = length(img_size_half - vec2f(ij)) / length(img_size_half);
-            ldr[ij] *= (1.f - smoothstep(vr, 2 * vr, r));
-        }
+    // calculate film grain
+    return p + (rand1f(rng) - 0.5f) * params.grain;
+}
 
-        // calculate film grain
-        ldr[ij] += (rand1f(rng) - 0.5f) * params.grain;
-        ldr[ij].w = w;
-    });
+// mosaic and grid, the last steps of the grading before the custom filter
+inline void apply_mosaic_grid(img::image<vec4f> & ldr, const grade_params& params) {
+    vec2i img_size = ldr.size();
 
     // if mosaic differ from 0 then calculate it
     if(params.mosaic != 0) {
@@ -266,9 +258,10 @@ img::image<vec4f> grade_image(
             if(ij.x % params.grid == 0 || ij.y % params.grid == 0) ldr[ij] *= 0.5f;
         });
     }
+}
 
-
-    if(!params.custom_filter_switch) return ldr;
+inline void apply_watercolor(img::image<vec4f> & ldr, const grade_params& params, std::atomic<bool>* stop) {
+    vec2i img_size = ldr.size();
 
     // Watercolor filter - turn an image into a painting
     // This filter is composed by two sections, the first one turns colors so that mimic the ones from a handmade painting while the second part is aimed to find edges
@@ -279,10 +272,12 @@ img::image<vec4f> grade_image(
     auto ldr_downscale = img::resize_image(ldr, img_size_d);
 
     // Apply a bilateral filter to smooth the colors
-    bilateral_filter_mt(ldr_downscale, ldr_downscale, params.bilateral_kernel_size, params.bilateral_threshold, params.bilateral_loops, img_size_d);
+    bilateral_filter_mt(ldr_downscale, ldr_downscale, params.bilateral_kernel_size, params.bilateral_threshold, params.bilateral_loops, img_size_d, stop);
+    if(stop && *stop) return;
 
     // Upscale back the image
     ldr = img::resize_image(ldr_downscale, img_size);
+    if(stop && *stop) return;
 
     // the upscaling filter may have generated negative color values so to be sure that every color channel is equal to or greater than 0 i apply max function to every pixel
     for(int i = 0; i < img_size.y*img_size.x; i++) ldr[i] = clamp(ldr[i], 0, 1);
@@ -291,7 +286,8 @@ img::image<vec4f> grade_image(
     auto ldr_byte = img::float_to_byte(ldr);
 
     // to smooth the image and remove any artifacts produced by the upscaling procedure i apply a median filter
-    median_byte_image_mt(ldr_byte, ldr_byte, params.median_kernel_size, 15);
+    median_byte_image_mt(ldr_byte, ldr_byte, params.median_kernel_size, 15, stop);
+    if(stop && *stop) return;
 
     // apply a color quantization factor c to every channel
     quantize_byte_image_mt(ldr_byte, ldr_byte, 10.f, img_size);
@@ -299,9 +295,301 @@ img::image<vec4f> grade_image(
     ldr = img::byte_to_float(ldr_byte);
 
     // apply Sobel operator to approximate edges
-    sobel_edge_detection(ldr, ldr, params.sobel_threshold);
+    sobel_edge_detection(ldr, ldr, params.sobel_threshold, stop);
+}
+
+img::image<vec4f> grade_image(
+    const img::image<vec4f>& img, const grade_params& params, std::atomic<bool>* stop) {
+    static auto rng = make_rng(1998);
+
+    // image size and output image
+    vec2i img_size = vec2i(img.size());
+    auto ldr = img::image<vec4f>{img_size};
+
+    // apply tone mapping and color grading
+    vec2f img_size_half = vec2f(img.size()) / 2.f;
+    parallel_for(img_size, [&](const vec2i& ij) {
+        vec3f p = grade_color(xyz(img[ij]), params);
+        ldr[ij] = vec4f(apply_vignette_grain(p, ij, img_size_half, params, rng), img[ij].w);
+    }, stop);
+    if(stop && *stop) return ldr;
+
+    apply_mosaic_grid(ldr, params);
+
+    if(params.custom_filter_switch) apply_watercolor(ldr, params, stop);
+
+    return ldr;
+}
+
+// Lookup table of a scalar curve sampled uniformly over [0, 1]
+template <typename Func>
+inline std::vector<float> make_curve_lut(int size, Func&& func) {
+    auto lut = std::vector<float>(size);
+    for (int i = 0; i < size; i++) lut[i] = func(i / (float)(size - 1));
+    return lut;
+}
+// evaluate the curve with linear interpolation, clamping the input to [0, 1]
+inline float eval_curve_lut(const std::vector<float>& lut, float x) {
+    int   last = (int)lut.size() - 1;
+    float u    = clamp(x, 0.f, 1.f) * last;
+    int   i    = min((int)u, last - 1);
+    float t    = u - i;
+    return lut[i] * (1 - t) + lut[i + 1] * t;
+}
+
+img::image<vec4b> grade_image_byte(
+    const img::image<vec4f>& img, const grade_params& params) {
+    static auto rng = make_rng(1998);
+
+    // the custom filter works on float images
+    if (params.custom_filter_switch) return img::float_to_byte(grade_image(img, params));
+
+    // image size and output image
+    vec2i img_size = vec2i(img.size());
+    auto ldr = img::image<vec4b>{img_size};
+
+    // curves evaluated with lookup tables
+    auto srgb_lut = make_curve_lut(4096, [](float x) { return rgb_to_srgb(x); });
+    auto gain_lut = make_curve_lut(1024, [&](float x) { return gain(x, 1 - params.contrast); });
+    auto eval_gain = [&](float x) {
+        return (x < 0 || x > 1) ? gain(x, 1 - params.contrast) : eval_curve_lut(gain_lut, x);
+    };
+
+    // tone mapping and grading are fused in a single pass that reads the float
+    // image once and writes 8-bit pixels
+    float exposure = pow(2, params.exposure);
+    vec3f tint = params.tint;
+    vec2f img_size_half = vec2f(img.size()) / 2.f;
+    parallel_for(img_size, [&](const vec2i& ij) {
+        vec3f p = xyz(img[ij]) * exposure;
+
+        if(params.filmic){
+            p *= 0.6;
+            vec3f pw = pow(p, 2);
+            p = (pw * 2.51 + p * 0.03) / (pw * 2.43 + p * 0.59 + 0.14);
+        }
+
+        // clamping before the sRGB curve is equivalent since the curve is monotonic
+        p = clamp(p, 0.f, 1.f);
+        if(params.srgb) p = {eval_curve_lut(srgb_lut, p.x), eval_curve_lut(srgb_lut, p.y), eval_curve_lut(srgb_lut, p.z)};
+
+        // calculate tint
+        p *= tint;
+
+        // calculate saturation
+        float g = (p.x + p.y + p.z) / 3.f;
+        p = g + (p - g) * (params.saturation * 2);
+
+        // calculate contrast, saturation and tint can leave [0, 1] where the
+        // curve is evaluated directly to match the float path
+        p = {eval_gain(p.x), eval_gain(p.y), eval_gain(p.z)};
+
+        // if vignette differ from 0 then calculate it
+        if(params.vignette != 0.f){
+            float vr = 1.f - params.vignette;
+            float r = length(img_size_half - vec2f(ij)) / length(img_size_half);
+            p *= (1.f - smoothstep(vr, 2 * vr, r));
+        }
+
+        // calculate film grain
+        p += (rand1f(rng) - 0.5f) * params.grain;
+        ldr[ij] = float_to_byte(vec4f(p, img[ij].w));
+    });
+
+    // if mosaic differ from 0 then calculate it
+    if(params.mosaic != 0) {
+        parallel_for(img_size, [&](const vec2i& ij){
+            int index = ij.x + ij.y * img_size.x;
+            int source_index = ij.x - ij.x % params.mosaic + (ij.y - ij.y % params.mosaic) * img_size.x ;
+            if(index != source_index) ldr[index] = ldr[source_index];
+        });
+    }
+
+    // if grid differ from 0 then calculate it, halving bytes matches the float path exactly
+    if(params.grid != 0) {
+        parallel_for(img_size, [&](const vec2i& ij){
+            if(ij.x % params.grid == 0 || ij.y % params.grid == 0) {
+                auto& c = ldr[ij];
+                c = vec4b(c.x / 2, c.y / 2, c.z / 2, c.w / 2);
+            }
+        });
+    }
+
+    return ldr;
+}
+
+grade_lut make_grade_lut(const grade_params& params, int size, float max_value) {
+    auto lut = grade_lut{};
+    lut.size = size;
+    lut.max_value = max_value;
+    lut.values.resize(size * size * size);
+
+    // the shaper encodes [0, max_value] with the sRGB curve so that the lattice
+    // is denser in the darks
+    lut.shaper = make_curve_lut(4096, [](float x) { return rgb_to_srgb(x); });
+
+    parallel_for(vec2i(size, size * size), [&](const vec2i& ij) {
+        auto s = vec3f(ij.x, ij.y % size, ij.y / size) / (float)(size - 1);
+        auto rgb = srgb_to_rgb(s) * max_value;
+        lut.values[ij.x + ij.y * size] = grade_color(rgb, params);
+    });
+    return lut;
+}
+
+vec3f eval_grade_lut(const grade_lut& lut, const vec3f& rgb) {
+    // apply the shaper
+    auto n = lut.size;
+    auto s = rgb / lut.max_value;
+    auto u = vec3f{eval_curve_lut(lut.shaper, s.x), eval_curve_lut(lut.shaper, s.y),
+        eval_curve_lut(lut.shaper, s.z)} * (float)(n - 1);
+
+    // lattice cell and position inside the cell
+    auto i = vec3i{min((int)u.x, n - 2), min((int)u.y, n - 2), min((int)u.z, n - 2)};
+    auto f = u - vec3f(i);
+    auto c = [&lut, &i, n](int r, int g, int b) -> const vec3f& {
+        return lut.values[(i.x + r) + ((i.y + g) + (i.z + b) * n) * n];
+    };
+
+    // tetrahedral interpolation
+    if (f.x > f.y) {
+        if (f.y > f.z) return c(0, 0, 0) * (1 - f.x) + c(1, 0, 0) * (f.x - f.y) + c(1, 1, 0) * (f.y - f.z) + c(1, 1, 1) * f.z;
+        if (f.x > f.z) return c(0, 0, 0) * (1 - f.x) + c(1, 0, 0) * (f.x - f.z) + c(1, 0, 1) * (f.z - f.y) + c(1, 1, 1) * f.y;
+        return c(0, 0, 0) * (1 - f.z) + c(0, 0, 1) * (f.z - f.x) + c(1, 0, 1) * (f.x - f.y) + c(1, 1, 1) * f.y;
+    } else {
+        if (f.z > f.y) return c(0, 0, 0) * (1 - f.z) + c(0, 0, 1) * (f.z - f.y) + c(0, 1, 1) * (f.y - f.x) + c(1, 1, 1) * f.x;
+        if (f.z > f.x) return c(0, 0, 0) * (1 - f.y) + c(0, 1, 0) * (f.y - f.z) + c(0, 1, 1) * (f.z - f.x) + c(1, 1, 1) * f.x;
+        return c(0, 0, 0) * (1 - f.y) + c(0, 1, 0) * (f.y - f.x) + c(1, 1, 0) * (f.x - f.z) + c(1, 1, 1) * f.z;
+    }
+}
+
+img::image<vec4f> grade_image(
+    const img::image<vec4f>& img, const grade_lut& lut, const grade_params& params, std::atomic<bool>* stop) {
+    static auto rng = make_rng(1998);
+
+    // image size and output image
+    vec2i img_size = vec2i(img.size());
+    auto ldr = img::image<vec4f>{img_size};
+
+    // per-color grading from the lut, spatial effects are computed analytically
+    vec2f img_size_half = vec2f(img.size()) / 2.f;
+    parallel_for(img_size, [&](const vec2i& ij) {
+        vec3f p = eval_grade_lut(lut, xyz(img[ij]));
+        ldr[ij] = vec4f(apply_vignette_grain(p, ij, img_size_half, params, rng), img[ij].w);
+    }, stop);
+    if(stop && *stop) return ldr;
+
+    apply_mosaic_grid(ldr, params);
+
+    if(params.custom_filter_switch) apply_watercolor(ldr, params, stop);
 
     return ldr;
 }
 
-}  // namespace yocto::grade
\ No newline at end of file
+bool save_cube(const std::string& filename, const grade_lut& lut, std::string& error) {
+    // shaper and lattice in the two-stage cube format, the shaper maps
+    // [0, max_value] to the lattice coordinates
+    auto n = lut.size;
+    auto str = std::string{};
+    auto buffer = std::array<char, 256>{};
+    auto print = [&](const char* fmt, auto... args) {
+        snprintf(buffer.data(), buffer.size(), fmt, args...);
+        str += buffer.data();
+    };
+    print("TITLE \"yocto_grade\"\n");
+    print("LUT_1D_SIZE %d\n", (int)lut.shaper.size());
+    print("LUT_1D_INPUT_RANGE 0.0 %f\n", lut.max_value);
+    print("LUT_3D_SIZE %d\n", n);
+    for (auto value : lut.shaper) print("%f %f %f\n", value, value, value);
+    for (auto& value : lut.values) print("%f %f %f\n", value.x, value.y, value.z);
+    return cli::save_text(filename, str, error);
+}
+
+// Runs a stage of the cached pipeline if its key changed. Returns false if
+// grading was stopped, leaving the stage invalid.
+template <typename Func>
+inline bool run_stage(grade_stage& stage, const std::vector<float>& key, Func&& func, std::atomic<bool>* stop) {
+    if(stop && *stop) return false;
+    if(stage.valid && stage.key == key) {
+        stage.hits++;
+        return true;
+    }
+    stage.misses++;
+    stage.valid = false;
+    auto start = std::chrono::high_resolution_clock::now();
+    func();
+    stage.time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::high_resolution_clock::now() - start).count();
+    if(stop && *stop) return false;
+    stage.key = key;
+    stage.valid = true;
+    return true;
+}
+
+img::image<vec4f> grade_image(grade_cache& cache, const img::image<vec4f>& img,
+    const grade_params& params, const grade_lut* lut, std::atomic<bool>* stop) {
+    // reset the cache for a new source image
+    if(cache.stages.empty() || cache.source != img.data() || cache.size != img.size()) {
+        cache = grade_cache{};
+        cache.source = img.data();
+        cache.size = img.size();
+        for(auto name : {"grade", "downscale", "bilateral", "upscale", "median", "quantize", "sobel"})
+            cache.stages.push_back({name});
+    }
+
+    // keys accumulate the parameters of the upstream stages
+    auto key = std::vector<float>{params.exposure, (float)params.filmic, (float)params.srgb,
+        params.tint.x, params.tint.y, params.tint.z, params.saturation, params.contrast,
+        params.vignette, params.grain, (float)params.mosaic, (float)params.grid, (float)(lut != nullptr)};
+    if(lut) key.insert(key.end(), {(float)lut->size, lut->max_value});
+
+    // tone mapping and color grading, without the custom filter
+    auto color_params = params;
+    color_params.custom_filter_switch = false;
+    if(!run_stage(cache.stages[0], key, [&]() {
+        cache.graded = lut ? grade_image(img, *lut, color_params, stop) : grade_image(img, color_params, stop);
+    }, stop)) return {};
+    if(!params.custom_filter_switch) return cache.graded;
+
+    // Watercolor filter - same stages as apply_watercolor()
+    vec2i img_size = img.size();
+    vec2i img_size_d = img_size / params.scale_factor;
+
+    key.push_back((float)params.scale_factor);
+    if(!run_stage(cache.stages[1], key, [&]() {
+        cache.downscaled = img::resize_image(cache.graded, img_size_d);
+    }, stop)) return {};
+
+    key.insert(key.end(), {(float)params.bilateral_kernel_size, params.bilateral_threshold, (float)params.bilateral_loops});
+    if(!run_stage(cache.stages[2], key, [&]() {
+        cache.smoothed = cache.downscaled;
+        bilateral_filter_mt(cache.smoothed, cache.smoothed, params.bilateral_kernel_size, params.bilateral_threshold, params.bilateral_loops, img_size_d, stop);
+    }, stop)) return {};
+
+    if(!run_stage(cache.stages[3], key, [&]() {
+        auto upscaled = img::resize_image(cache.smoothed, img_size);
+        for(int i = 0; i < img_size.y*img_size.x; i++) upscaled[i] = clamp(upscaled[i], 0, 1);
+        cache.upscaled = img::float_to_byte(upscaled);
+    }, stop)) return {};
+
+    key.push_back((float)params.median_kernel_size);
+    if(!run_stage(cache.stages[4], key, [&]() {
+        cache.filtered = cache.upscaled;
+        median_byte_image_mt(cache.filtered, cache.filtered, params.median_kernel_size, 15, stop);
+    }, stop)) return {};
+
+    if(!run_stage(cache.stages[5], key, [&]() {
+        auto quantized = cache.filtered;
+        quantize_byte_image_mt(quantized, quantized, 10.f, img_size);
+        cache.quantized = img::byte_to_float(quantized);
+    }, stop)) return {};
+
+    key.push_back(params.sobel_threshold);
+    if(!run_stage(cache.stages[6], key, [&]() {
+        cache.edges = cache.quantized;
+        sobel_edge_detection(cache.edges, cache.edges, params.sobel_threshold, stop);
+    }, stop)) return {};
+
+    return cache.edges;
+}
+
+}  // namespace yocto::grade
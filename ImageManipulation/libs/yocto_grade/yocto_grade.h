@@ -35,10 +35,12 @@
 
 #define GAUSSIAN(x, o) ((1.f / sqrt(2*pif*o*o)) * exp(-((x*x)/(2*o*o))))
 
+#include <yocto/yocto_commonio.h>
 #include <yocto/yocto_image.h>
 #include <yocto/yocto_math.h>
 #include <thread>
 #include <atomic>
+#include <chrono>
 #include <future>
 
 // -----------------------------------------------------------------------------
@@ -49,6 +51,7 @@ namespace yocto::grade {
 // Using directives
 using namespace yocto::math;
 namespace img = yocto::image;
+namespace cli = yocto::commonio;
 
 // Color grading parameters
 struct grade_params {
@@ -73,22 +76,89 @@ struct grade_params {
 
 // Custom filter utils
 template <typename Func>
-void parallel_for(const vec2i& size, Func&& func);
+void parallel_for(const vec2i& size, Func&& func, std::atomic<bool>* stop = nullptr);
 // draw edges to the input image
-void sobel_edge_detection(img::image<vec4f> & in, img::image<vec4f> & out, float threshold);
+void sobel_edge_detection(img::image<vec4f> & in, img::image<vec4f> & out, float threshold, std::atomic<bool>* stop = nullptr);
 // Applies a bilateral filter to every image pixel
-void bilateral_filter_mt(img::image<vec4f> & in, img::image<vec4f> & out, int kernel_size, float threshold, int loops, vec2i num_threads);
+void bilateral_filter_mt(img::image<vec4f> & in, img::image<vec4f> & out, int kernel_size, float threshold, int loops, vec2i num_threads, std::atomic<bool>* stop = nullptr);
 // Applies a median filter for every image pixel
-void median_byte_image_mt(img::image<vec4b> & in, img::image<vec4b> & out, int kernel_size, int num_threads);
+void median_byte_image_mt(img::image<vec4b> & in, img::image<vec4b> & out, int kernel_size, int num_threads, std::atomic<bool>* stop = nullptr);
 // Quantize byte images channels by a factor f
 void quantize_byte_image_mt(img::image<vec4b> & in, img::image<vec4b> & out, int f, vec2i num_threads);
 // calculate median value for every RGB channel
 vec3b median(vec3i * arr, int n);
 
-// Grading functions
-img::image<vec4f> grade_image(
+// Per-color part of the grading chain: tone mapping, tint, saturation and
+// contrast. Vignette, grain, mosaic, grid and the custom filter are spatial.
+vec3f grade_color(const vec3f& rgb, const grade_params& params);
+
+// Grading functions. Grading returns early if stop is set, for example when
+// a newer edit makes the result useless.
+img::image<vec4f> grade_image(const img::image<vec4f>& img,
+    const grade_params& params, std::atomic<bool>* stop = nullptr);
+// Fast path of grade_image() that writes 8-bit pixels directly, using lookup
+// tables for the sRGB and contrast curves. Without grain, it matches
+// float_to_byte(grade_image(img, params)) within one level per channel.
+// The custom filter falls back to the float path.
+img::image<vec4b> grade_image_byte(
     const img::image<vec4f>& img, const grade_params& params);
 
+// Per-color grading baked into a 1D shaper followed by a 3D lattice. The
+// shaper maps linear colors in [0, max_value] to lattice coordinates.
+struct grade_lut {
+  int                size      = 0;
+  float              max_value = 1;
+  std::vector<float> shaper    = {};
+  std::vector<vec3f> values    = {};  // size^3 entries, red varies fastest
+};
+
+// Bakes grade_color() into a lut with size^3 entries, typically 33 or 65.
+grade_lut make_grade_lut(
+    const grade_params& params, int size = 33, float max_value = 1);
+// Evaluates a lut with tetrahedral interpolation.
+vec3f eval_grade_lut(const grade_lut& lut, const vec3f& rgb);
+// Grades an image using a lut for the per-color part of the chain, while the
+// spatial effects are computed as in grade_image().
+img::image<vec4f> grade_image(const img::image<vec4f>& img,
+    const grade_lut& lut, const grade_params& params,
+    std::atomic<bool>* stop = nullptr);
+// Saves a lut as a .cube file with a 1D shaper and a 3D lattice.
+bool save_cube(
+    const std::string& filename, const grade_lut& lut, std::string& error);
+
+// Stage of the cached grading pipeline. The key holds the parameters of the
+// stage and of all the stages it depends on.
+struct grade_stage {
+  std::string        name   = "";
+  std::vector<float> key    = {};
+  bool               valid  = false;
+  int64_t            time   = 0;  // last computation time in nanoseconds
+  int                hits   = 0;
+  int                misses = 0;
+};
+
+// Cached outputs of the grading pipeline: grade, downscale, bilateral,
+// upscale, median, quantize and sobel. Edits only recompute the stages whose
+// key changed. The cache is tied to the last source image it was used with.
+struct grade_cache {
+  const void*              source     = nullptr;
+  vec2i                    size       = {0, 0};
+  std::vector<grade_stage> stages     = {};
+  img::image<vec4f>        graded     = {};
+  img::image<vec4f>        downscaled = {};
+  img::image<vec4f>        smoothed   = {};
+  img::image<vec4b>        upscaled   = {};
+  img::image<vec4b>        filtered   = {};
+  img::image<vec4f>        quantized  = {};
+  img::image<vec4f>        edges      = {};
+};
+
+// Grades an image like grade_image(), reusing the stages in the cache whose
+// parameters did not change. Uses the lut for the per-color grading if given.
+img::image<vec4f> grade_image(grade_cache& cache, const img::image<vec4f>& img,
+    const grade_params& params, const grade_lut* lut = nullptr,
+    std::atomic<bool>* stop = nullptr);
+
 };  // namespace yocto::grade
 
 #endif
@@ -46,7 +46,7 @@ using namespace std::string_literals;
 #include "ext/filesystem.hpp"
 namespace sfs = ghc::filesystem;
 
-// construct a scene from io
+// construct a scene from io, moving texture and shape data out of ioscene
 void init_scene(trc::scene* scene, sio::model* ioscene, trc::camera*& camera,
     sio::camera* iocamera, sio::progress_callback progress_cb = {}) {
   // handle progress
@@ -74,13 +74,13 @@ void init_scene(trc::scene* scene, sio::model* ioscene, trc::camera*& camera,
     if (progress_cb) progress_cb("convert texture", progress.x++, progress.y);
     auto texture = add_texture(scene);
     if (!iotexture->colorf.empty()) {
-      set_texture(texture, iotexture->colorf);
+      set_texture(texture, std::move(iotexture->colorf));
     } else if (!iotexture->colorb.empty()) {
-      set_texture(texture, iotexture->colorb);
+      set_texture(texture, std::move(iotexture->colorb));
     } else if (!iotexture->scalarf.empty()) {
-      set_texture(texture, iotexture->scalarf);
+      set_texture(texture, std::move(iotexture->scalarf));
     } else if (!iotexture->scalarb.empty()) {
-      set_texture(texture, iotexture->scalarb);
+      set_texture(texture, std::move(iotexture->scalarb));
     }
     texture_map[iotexture] = texture;
   }
@@ -124,16 +124,16 @@ void init_scene(trc::scene* scene, sio::model* ioscene, trc::camera*& camera,
   for (auto ioshape : ioscene->shapes) {
     if (progress_cb) progress_cb("convert shape", progress.x++, progress.y);
     auto shape = add_shape(scene);
-    set_points(shape, ioshape->points);
-    set_lines(shape, ioshape->lines);
-    set_triangles(shape, ioshape->triangles);
-    set_quads(shape, ioshape->quads);
-    set_positions(shape, ioshape->positions);
-    set_normals(shape, ioshape->normals);
-    set_texcoords(shape, ioshape->texcoords);
-    set_colors(shape, ioshape->colors);
-    set_radius(shape, ioshape->radius);
-    set_tangents(shape, ioshape->tangents);
+    set_points(shape, std::move(ioshape->points));
+    set_lines(shape, std::move(ioshape->lines));
+    set_triangles(shape, std::move(ioshape->triangles));
+    set_quads(shape, std::move(ioshape->quads));
+    set_positions(shape, std::move(ioshape->positions));
+    set_normals(shape, std::move(ioshape->normals));
+    set_texcoords(shape, std::move(ioshape->texcoords));
+    set_colors(shape, std::move(ioshape->colors));
+    set_radius(shape, std::move(ioshape->radius));
+    set_tangents(shape, std::move(ioshape->tangents));
     shape_map[ioshape] = shape;
   }
 
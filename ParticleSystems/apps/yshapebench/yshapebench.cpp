@@ -0,0 +1,175 @@
+//
+// LICENSE:
+//
+// Copyright (c) 2016 -- 2020 Fabio Pellacini
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <yocto/yocto_commonio.h>
+#include <yocto/yocto_math.h>
+#include <yocto/yocto_shape.h>
+using namespace yocto::math;
+namespace cli = yocto::commonio;
+namespace shp = yocto::shape;
+
+#include <algorithm>
+using namespace std::string_literals;
+
+// Benchmark parameters
+struct bench_params {
+  int steps   = 300;     // sphere steps, giving 2 * steps^2 triangles
+  int points  = 100000;  // number of query points
+  int checks  = 200;     // queries checked against brute force
+  int nearest = 16;      // number of elements for nearest queries
+  int seed    = 7;
+};
+
+// Bumpy sphere, so that closest queries do not degenerate to a distance
+// from the center.
+void make_bench_shape(std::vector<vec4i>& quads, std::vector<vec3f>& positions,
+    const bench_params& params) {
+  auto normals   = std::vector<vec3f>{};
+  auto texcoords = std::vector<vec2f>{};
+  shp::make_uvsphere(quads, positions, normals, texcoords,
+      {params.steps, params.steps});
+  for (auto idx = 0; idx < positions.size(); idx++) {
+    auto uv = texcoords[idx];
+    positions[idx] += normals[idx] * 0.2f * sin(5 * 2 * pif * uv.x) *
+                      sin(pif * uv.y);
+  }
+}
+
+// Distances from a point to all triangles, sorted.
+std::vector<float> brute_force_distances(const std::vector<vec3i>& triangles,
+    const std::vector<vec3f>& positions, const vec3f& point) {
+  auto distances = std::vector<float>{};
+  distances.reserve(triangles.size());
+  for (auto& t : triangles) {
+    auto uv   = zero2f;
+    auto dist = 0.0f;
+    overlap_triangle(point, flt_max, positions[t.x], positions[t.y],
+        positions[t.z], 0, 0, 0, uv, dist);
+    distances.push_back(dist);
+  }
+  std::sort(distances.begin(), distances.end());
+  return distances;
+}
+
+int main(int argc, const char* argv[]) {
+  // command line parameters
+  auto params = bench_params{};
+
+  // parse command line
+  auto cli = cli::make_cli(
+      "yshapebench", "Benchmark closest and nearest element queries");
+  add_option(cli, "--steps", params.steps, "Sphere steps.");
+  add_option(cli, "--points,-n", params.points, "Number of query points.");
+  add_option(cli, "--checks", params.checks, "Brute force checks.");
+  add_option(cli, "--nearest,-k", params.nearest, "Nearest elements.");
+  add_option(cli, "--seed", params.seed, "Random seed.");
+  parse_cli(cli, argc, argv);
+
+  // make shape and query points
+  auto quads     = std::vector<vec4i>{};
+  auto positions = std::vector<vec3f>{};
+  make_bench_shape(quads, positions, params);
+  auto triangles = shp::quads_to_triangles(quads);
+  auto radius    = std::vector<float>(positions.size(), 0);
+  auto rng       = make_rng(params.seed);
+  auto points    = std::vector<vec3f>(params.points);
+  for (auto& point : points) point = (rand3f(rng) - 0.5f) * 3;
+  cli::print_info("triangles: " + std::to_string(triangles.size()) +
+                  " quads: " + std::to_string(quads.size()) +
+                  " points: " + std::to_string(points.size()));
+
+  // build bvhs
+  auto triangles_bvh = shp::bvh_tree{};
+  auto quads_bvh     = shp::bvh_tree{};
+  {
+    auto timer = cli::print_timed("build bvhs");
+    shp::make_triangles_bvh(triangles_bvh, triangles, positions, radius);
+    shp::make_quads_bvh(quads_bvh, quads, positions, radius);
+  }
+
+  // check against brute force
+  auto mismatches = 0;
+  {
+    auto timer = cli::print_timed("check queries");
+    for (auto idx = 0; idx < min(params.checks, params.points); idx++) {
+      auto& point     = points[idx];
+      auto  distances = brute_force_distances(triangles, positions, point);
+      auto  closest   = shp::closest_triangles_bvh(
+          triangles_bvh, triangles, positions, point);
+      auto qclosest = shp::closest_quads_bvh(
+          quads_bvh, quads, positions, point);
+      if (!closest.hit || abs(closest.distance - distances[0]) > 1e-5f)
+        mismatches++;
+      if (!qclosest.hit || abs(qclosest.distance - distances[0]) > 1e-5f)
+        mismatches++;
+      auto nearest = shp::nearest_triangles_bvh(
+          triangles_bvh, triangles, positions, point, params.nearest);
+      for (auto k = 0; k < nearest.size(); k++) {
+        if (abs(nearest[k].distance - distances[k]) > 1e-5f) mismatches++;
+      }
+    }
+  }
+  if (mismatches) cli::print_fatal("mismatches: " + std::to_string(mismatches));
+
+  // closest queries
+  {
+    auto timer = cli::print_timed("closest triangles serial");
+    shp::closest_triangles_bvh(
+        triangles_bvh, triangles, positions, points, flt_max, true);
+  }
+  {
+    auto timer = cli::print_timed("closest triangles parallel");
+    shp::closest_triangles_bvh(
+        triangles_bvh, triangles, positions, points, flt_max, false);
+  }
+  {
+    auto timer = cli::print_timed("closest quads parallel");
+    shp::closest_quads_bvh(
+        quads_bvh, quads, positions, points, flt_max, false);
+  }
+
+  // overlap queries, which visit nodes in order instead of nearest first
+  {
+    auto timer = cli::print_timed("overlap triangles serial");
+    for (auto& point : points)
+      shp::overlap_triangles_bvh(
+          triangles_bvh, triangles, positions, radius, point, flt_max);
+  }
+
+  // nearest queries
+  {
+    auto timer = cli::print_timed(
+        "nearest " + std::to_string(params.nearest) + " triangles serial");
+    for (auto& point : points)
+      shp::nearest_triangles_bvh(
+          triangles_bvh, triangles, positions, point, params.nearest);
+  }
+
+  // done
+  return 0;
+}
@@ -8,10 +8,14 @@
 
 #include "yocto_shape.h"
 
+#include <algorithm>
 #include <atomic>
 #include <deque>
+#include <future>
 #include <memory>
 #include <string>
+#include <thread>
+#include <type_traits>
 using namespace std::string_literals;
 
 #include "yocto_obj.h"
@@ -55,6 +59,26 @@ using math::zero2f;
 using math::zero3f;
 using math::zero4f;
 
+// Simple parallel for used since our target platforms do not yet support
+// parallel algorithms. `Func` takes the integer index.
+template <typename Func>
+inline void parallel_for(int size, Func&& func) {
+  auto             futures  = std::vector<std::future<void>>{};
+  auto             nthreads = std::thread::hardware_concurrency();
+  std::atomic<int> next_idx(0);
+  for (auto thread_id = 0; thread_id < nthreads; thread_id++) {
+    futures.emplace_back(
+        std::async(std::launch::async, [&func, &next_idx, size]() {
+          while (true) {
+            auto idx = next_idx.fetch_add(1);
+            if (idx >= size) break;
+            func(idx);
+          }
+        }));
+  }
+  for (auto& f : futures) f.get();
+}
+
 }  // namespace yocto::shape
 
 // -----------------------------------------------------------------------------
@@ -167,6 +191,148 @@ void update_normals(std::vector<vec3f>& normals,
   for (auto& normal : normals) normal = normalize(normal);
 }
 
+// Build the faces adjacent to each vertex with a counting sort, which keeps
+// faces in order within each row.
+template <typename Face>
+static vertex_faces make_vertex_faces_impl(
+    const std::vector<Face>& elements, int num_vertices) {
+  auto adjacency   = vertex_faces{};
+  auto num_corners = [](const Face& face) {
+    if constexpr (std::is_same_v<Face, vec4i>) {
+      return face.z == face.w ? 3 : 4;
+    } else {
+      return 3;
+    }
+  };
+  adjacency.starts.assign(num_vertices + 1, 0);
+  for (auto& face : elements) {
+    for (auto c = 0; c < num_corners(face); c++)
+      adjacency.starts[face[c] + 1] += 1;
+  }
+  for (auto vid = 0; vid < num_vertices; vid++)
+    adjacency.starts[vid + 1] += adjacency.starts[vid];
+  adjacency.faces.resize(adjacency.starts.back());
+  auto next = std::vector<int>(
+      adjacency.starts.begin(), adjacency.starts.end() - 1);
+  for (auto fid = 0; fid < elements.size(); fid++) {
+    auto& face = elements[fid];
+    for (auto c = 0; c < num_corners(face); c++)
+      adjacency.faces[next[face[c]]++] = fid;
+  }
+  return adjacency;
+}
+vertex_faces make_vertex_faces(
+    const std::vector<vec3i>& triangles, int num_vertices) {
+  return make_vertex_faces_impl(triangles, num_vertices);
+}
+vertex_faces make_vertex_faces(
+    const std::vector<vec4i>& quads, int num_vertices) {
+  return make_vertex_faces_impl(quads, num_vertices);
+}
+
+// Area-weighted face normals.
+static vec3f weighted_normal(
+    const vec3i& t, const std::vector<vec3f>& positions) {
+  auto normal = triangle_normal(
+      positions[t.x], positions[t.y], positions[t.z]);
+  auto area = triangle_area(positions[t.x], positions[t.y], positions[t.z]);
+  return normal * area;
+}
+static vec3f weighted_normal(
+    const vec4i& q, const std::vector<vec3f>& positions) {
+  auto normal = quad_normal(
+      positions[q.x], positions[q.y], positions[q.z], positions[q.w]);
+  auto area = quad_area(
+      positions[q.x], positions[q.y], positions[q.z], positions[q.w]);
+  return normal * area;
+}
+
+// Update normals by computing face normals and gathering them per vertex,
+// both in parallel over blocks.
+template <typename Face>
+static void update_normals_impl(std::vector<vec3f>& normals,
+    const vertex_faces& adjacency, const std::vector<Face>& elements,
+    const std::vector<vec3f>& positions) {
+  if (normals.size() != positions.size() ||
+      adjacency.starts.size() != positions.size() + 1) {
+    throw std::out_of_range("array should be the same length");
+  }
+  auto face_normals = std::vector<vec3f>(elements.size());
+  auto block_size   = 4096;
+  auto num_faces    = (int)elements.size();
+  parallel_for((num_faces + block_size - 1) / block_size, [&](int block) {
+    auto end = min((block + 1) * block_size, num_faces);
+    for (auto fid = block * block_size; fid < end; fid++)
+      face_normals[fid] = weighted_normal(elements[fid], positions);
+  });
+  auto num_vertices = (int)positions.size();
+  parallel_for((num_vertices + block_size - 1) / block_size, [&](int block) {
+    auto end = min((block + 1) * block_size, num_vertices);
+    for (auto vid = block * block_size; vid < end; vid++) {
+      auto normal = zero3f;
+      for (auto idx = adjacency.starts[vid]; idx < adjacency.starts[vid + 1];
+           idx++)
+        normal += face_normals[adjacency.faces[idx]];
+      normals[vid] = normalize(normal);
+    }
+  });
+}
+
+// Update the normals of the vertices sharing a face with the moved ones.
+// Face normals are recomputed by each vertex, since few faces are touched.
+template <typename Face>
+static void update_normals_impl(std::vector<vec3f>& normals,
+    const vertex_faces& adjacency, const std::vector<Face>& elements,
+    const std::vector<vec3f>& positions, const std::vector<int>& moved) {
+  if (normals.size() != positions.size() ||
+      adjacency.starts.size() != positions.size() + 1) {
+    throw std::out_of_range("array should be the same length");
+  }
+  auto vertices = std::vector<int>{};
+  for (auto vid : moved) {
+    for (auto idx = adjacency.starts[vid]; idx < adjacency.starts[vid + 1];
+         idx++) {
+      auto& face = elements[adjacency.faces[idx]];
+      for (auto c = 0; c < (int)sizeof(Face) / (int)sizeof(int); c++)
+        vertices.push_back(face[c]);
+    }
+  }
+  std::sort(vertices.begin(), vertices.end());
+  vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+  auto block_size   = 1024;
+  auto num_vertices = (int)vertices.size();
+  parallel_for((num_vertices + block_size - 1) / block_size, [&](int block) {
+    auto end = min((block + 1) * block_size, num_vertices);
+    for (auto idx = block * block_size; idx < end; idx++) {
+      auto vid    = vertices[idx];
+      auto normal = zero3f;
+      for (auto fidx = adjacency.starts[vid]; fidx < adjacency.starts[vid + 1];
+           fidx++)
+        normal += weighted_normal(elements[adjacency.faces[fidx]], positions);
+      normals[vid] = normalize(normal);
+    }
+  });
+}
+
+void update_normals(std::vector<vec3f>& normals, const vertex_faces& adjacency,
+    const std::vector<vec3i>& triangles, const std::vector<vec3f>& positions) {
+  update_normals_impl(normals, adjacency, triangles, positions);
+}
+void update_normals(std::vector<vec3f>& normals, const vertex_faces& adjacency,
+    const std::vector<vec4i>& quads, const std::vector<vec3f>& positions) {
+  update_normals_impl(normals, adjacency, quads, positions);
+}
+void update_normals(std::vector<vec3f>& normals, const vertex_faces& adjacency,
+    const std::vector<vec3i>& triangles, const std::vector<vec3f>& positions,
+    const std::vector<int>& moved) {
+  update_normals_impl(normals, adjacency, triangles, positions, moved);
+}
+void update_normals(std::vector<vec3f>& normals, const vertex_faces& adjacency,
+    const std::vector<vec4i>& quads, const std::vector<vec3f>& positions,
+    const std::vector<int>& moved) {
+  update_normals_impl(normals, adjacency, quads, positions, moved);
+}
+
 // Compute per-vertex tangent frame for triangle meshes.
 // Tangent space is defined by a four component std::vector.
 // The first three components are the tangent with respect to the U texcoord.
@@ -347,27 +513,48 @@ std::vector<vec3f> align_vertices(
 // -----------------------------------------------------------------------------
 namespace yocto::shape {
 
+// Grow the edge table to hold at least a number of edges at half load.
+static void reserve_edges(edge_map& emap, size_t num_edges) {
+  auto size = (size_t)16;
+  while (size < num_edges * 2) size *= 2;
+  if (size <= emap.table.size()) return;
+  emap.edges.reserve(num_edges);
+  emap.nfaces.reserve(num_edges);
+  emap.table.assign(size, -1);
+  auto mask = size - 1;
+  for (auto idx = 0; idx < emap.edges.size(); idx++) {
+    auto& edge = emap.edges[idx];
+    auto  key  = ((uint64_t)(uint32_t)edge.x << 32) | (uint32_t)edge.y;
+    auto  slot = (key * 0x9e3779b97f4a7c15ull >> 32) & mask;
+    while (emap.table[slot] >= 0) slot = (slot + 1) & mask;
+    emap.table[slot] = idx;
+  }
+}
+
+// Find the slot of an edge, or the empty slot where it would be inserted.
+// Edges have their smaller vertex first.
+static size_t find_edge_slot(const edge_map& emap, const vec2i& edge) {
+  auto mask = emap.table.size() - 1;
+  auto key  = ((uint64_t)(uint32_t)edge.x << 32) | (uint32_t)edge.y;
+  auto slot = (key * 0x9e3779b97f4a7c15ull >> 32) & mask;
+  while (emap.table[slot] >= 0 && emap.edges[emap.table[slot]] != edge)
+    slot = (slot + 1) & mask;
+  return slot;
+}
+
 // Initialize an edge map with elements.
 edge_map make_edge_map(const std::vector<vec3i>& triangles) {
   auto emap = edge_map{};
-  for (auto& t : triangles) {
-    insert_edge(emap, {t.x, t.y});
-    insert_edge(emap, {t.y, t.z});
-    insert_edge(emap, {t.z, t.x});
-  }
+  insert_edges(emap, triangles);
   return emap;
 }
 edge_map make_edge_map(const std::vector<vec4i>& quads) {
   auto emap = edge_map{};
-  for (auto& q : quads) {
-    insert_edge(emap, {q.x, q.y});
-    insert_edge(emap, {q.y, q.z});
-    if (q.z != q.w) insert_edge(emap, {q.z, q.w});
-    insert_edge(emap, {q.w, q.x});
-  }
+  insert_edges(emap, quads);
   return emap;
 }
 void insert_edges(edge_map& emap, const std::vector<vec3i>& triangles) {
+  reserve_edges(emap, emap.edges.size() + triangles.size() * 3 / 2);
   for (auto& t : triangles) {
     insert_edge(emap, {t.x, t.y});
     insert_edge(emap, {t.y, t.z});
@@ -375,6 +562,7 @@ void insert_edges(edge_map& emap, const std::vector<vec3i>& triangles) {
   }
 }
 void insert_edges(edge_map& emap, const std::vector<vec4i>& quads) {
+  reserve_edges(emap, emap.edges.size() + quads.size() * 2);
   for (auto& q : quads) {
     insert_edge(emap, {q.x, q.y});
     insert_edge(emap, {q.y, q.z});
@@ -385,15 +573,17 @@ void insert_edges(edge_map& emap, const std::vector<vec4i>& quads) {
 // Insert an edge and return its index
 int insert_edge(edge_map& emap, const vec2i& edge) {
   auto es = edge.x < edge.y ? edge : vec2i{edge.y, edge.x};
-  auto it = emap.index.find(es);
-  if (it == emap.index.end()) {
-    auto idx = (int)emap.edges.size();
-    emap.index.insert(it, {es, idx});
+  if ((emap.edges.size() + 1) * 2 > emap.table.size())
+    reserve_edges(emap, (emap.edges.size() + 1) * 2);
+  auto slot = find_edge_slot(emap, es);
+  if (emap.table[slot] < 0) {
+    auto idx         = (int)emap.edges.size();
+    emap.table[slot] = idx;
     emap.edges.push_back(es);
     emap.nfaces.push_back(1);
     return idx;
   } else {
-    auto idx = it->second;
+    auto idx = emap.table[slot];
     emap.nfaces[idx] += 1;
     return idx;
   }
@@ -402,10 +592,9 @@ int insert_edge(edge_map& emap, const vec2i& edge) {
 int num_edges(const edge_map& emap) { return emap.edges.size(); }
 // Get the edge index
 int edge_index(const edge_map& emap, const vec2i& edge) {
-  auto es       = edge.x < edge.y ? edge : vec2i{edge.y, edge.x};
-  auto iterator = emap.index.find(es);
-  if (iterator == emap.index.end()) return -1;
-  return iterator->second;
+  if (emap.table.empty()) return -1;
+  auto es = edge.x < edge.y ? edge : vec2i{edge.y, edge.x};
+  return emap.table[find_edge_slot(emap, es)];
 }
 // Get a list of edges, boundary edges, boundary vertices
 std::vector<vec2i> get_edges(const edge_map& emap) { return emap.edges; }
@@ -423,32 +612,81 @@ std::vector<vec2i> get_edges(const std::vector<vec4i>& quads) {
   return get_edges(make_edge_map(quads));
 }
 
+// Pair half-edges sorted by their smaller vertex with a counting sort, which
+// keeps memory accesses local for meshes with coherent vertex order. Each
+// vertex bucket is then sorted by the other vertex, so twins are adjacent.
+// Half-edges are given as pairs of vertices, with -1 for missing ones. On
+// non-manifold edges, later half-edges are paired with the first one.
+static std::vector<int> halfedge_twins(const std::vector<vec2i>& halfedges) {
+  auto num_vertices = 0;
+  for (auto& halfedge : halfedges)
+    num_vertices = max(num_vertices, max(halfedge) + 1);
+  auto twins  = std::vector<int>(halfedges.size(), -1);
+  auto starts = std::vector<int>(num_vertices + 1, 0);
+  for (auto& halfedge : halfedges) {
+    if (halfedge.x < 0) continue;
+    starts[min(halfedge.x, halfedge.y) + 1] += 1;
+  }
+  for (auto vertex = 0; vertex < num_vertices; vertex++)
+    starts[vertex + 1] += starts[vertex];
+  auto sorted  = std::vector<int>(starts.back());
+  auto offsets = std::vector<int>(starts.begin(), starts.end() - 1);
+  for (auto idx = 0; idx < halfedges.size(); idx++) {
+    auto& halfedge = halfedges[idx];
+    if (halfedge.x < 0) continue;
+    sorted[offsets[min(halfedge.x, halfedge.y)]++] = idx;
+  }
+  for (auto vertex = 0; vertex < num_vertices; vertex++) {
+    auto other = [&](int halfedge) {
+      return halfedges[halfedge].x + halfedges[halfedge].y - vertex;
+    };
+    std::sort(sorted.begin() + starts[vertex],
+        sorted.begin() + starts[vertex + 1], [&](int a, int b) {
+          return other(a) != other(b) ? other(a) < other(b) : a < b;
+        });
+    for (auto i = starts[vertex]; i < starts[vertex + 1];) {
+      auto first = sorted[i], j = i + 1;
+      for (; j < starts[vertex + 1] && other(sorted[j]) == other(first); j++) {
+        twins[sorted[j]] = first;
+        twins[first]     = sorted[j];
+      }
+      i = j;
+    }
+  }
+  return twins;
+}
+
+// Build the opposite half-edge of each half-edge
+std::vector<int> halfedge_twins(const std::vector<vec3i>& triangles) {
+  auto halfedges = std::vector<vec2i>(triangles.size() * 3);
+  for (auto i = 0; i < triangles.size(); i++) {
+    auto& t              = triangles[i];
+    halfedges[i * 3 + 0] = {t.x, t.y};
+    halfedges[i * 3 + 1] = {t.y, t.z};
+    halfedges[i * 3 + 2] = {t.z, t.x};
+  }
+  return halfedge_twins(halfedges);
+}
+std::vector<int> halfedge_twins(const std::vector<vec4i>& quads) {
+  auto halfedges = std::vector<vec2i>(quads.size() * 4);
+  for (auto i = 0; i < quads.size(); i++) {
+    auto& q              = quads[i];
+    halfedges[i * 4 + 0] = {q.x, q.y};
+    halfedges[i * 4 + 1] = {q.y, q.z};
+    halfedges[i * 4 + 2] = q.z != q.w ? vec2i{q.z, q.w} : vec2i{-1, -1};
+    halfedges[i * 4 + 3] = {q.w, q.x};
+  }
+  return halfedge_twins(halfedges);
+}
+
 // Build adjacencies between faces (sorted counter-clockwise)
 std::vector<vec3i> face_adjacencies(const std::vector<vec3i>& triangles) {
-  auto get_edge = [](const vec3i& triangle, int i) -> vec2i {
-    auto x = triangle[i], y = triangle[i < 2 ? i + 1 : 0];
-    return x < y ? vec2i{x, y} : vec2i{y, x};
-  };
+  auto twins       = halfedge_twins(triangles);
   auto adjacencies = std::vector<vec3i>{triangles.size(), vec3i{-1, -1, -1}};
-  auto edge_map    = std::unordered_map<vec2i, int>();
-  edge_map.reserve((size_t)(triangles.size() * 1.5));
-  for (int i = 0; i < triangles.size(); ++i) {
-    for (int k = 0; k < 3; ++k) {
-      auto edge = get_edge(triangles[i], k);
-      auto it   = edge_map.find(edge);
-      if (it == edge_map.end()) {
-        edge_map.insert(it, {edge, i});
-      } else {
-        auto neighbor     = it->second;
-        adjacencies[i][k] = neighbor;
-        for (int kk = 0; kk < 3; ++kk) {
-          auto edge2 = get_edge(triangles[neighbor], kk);
-          if (edge2 == edge) {
-            adjacencies[neighbor][kk] = i;
-            break;
-          }
-        }
-      }
+  for (auto i = 0; i < triangles.size(); i++) {
+    for (auto k = 0; k < 3; k++) {
+      auto twin = twins[i * 3 + k];
+      if (twin >= 0) adjacencies[i][k] = twin / 3;
     }
   }
   return adjacencies;
@@ -806,66 +1044,79 @@ namespace yocto::shape {
 #endif
 #endif
 
-// Splits a BVH node using the SAH heuristic. Returns split position and axis.
+// Splits a BVH node using the SAH heuristic over binned primitive centers.
+// The cost of every bin boundary is evaluated with two sweeps per axis.
+// Returns split position and axis, with the position set to start if no
+// boundary separates the primitives.
 static std::pair<int, int> split_sah(std::vector<int>& primitives,
     const std::vector<bbox3f>& bboxes, const std::vector<vec3f>& centers,
     int start, int end) {
-  // initialize split axis and position
-  auto split_axis = 0;
-  auto mid        = (start + end) / 2;
-
   // compute primintive bounds and size
   auto cbbox = invalidb3f;
   for (auto i = start; i < end; i++)
     cbbox = merge(cbbox, centers[primitives[i]]);
   auto csize = cbbox.max - cbbox.min;
-  if (csize == zero3f) return {mid, split_axis};
-
-  // consider N bins, compute their cost and keep the minimum
-  const int nbins    = 16;
-  auto      middle   = 0.0f;
-  auto      min_cost = flt_max;
-  auto      area     = [](auto& b) {
-    auto size = b.max - b.min;
-    return 1e-12f + 2 * size.x * size.y + 2 * size.x * size.z +
-           2 * size.y * size.z;
+  if (csize == zero3f) return {start, 0};
+
+  // bin index of a primitive center along an axis
+  const int nbins   = 16;
+  auto      get_bin = [&cbbox, &csize, &centers](int primitive, int axis) {
+    auto bin = (int)(nbins * (centers[primitive][axis] - cbbox.min[axis]) /
+                     csize[axis]);
+    return clamp(bin, 0, nbins - 1);
+  };
+  auto area = [](const bbox3f& bbox) {
+    auto size = bbox.max - bbox.min;
+    return size.x * size.y + size.x * size.z + size.y * size.z;
   };
-  for (auto saxis = 0; saxis < 3; saxis++) {
+
+  // consider all bin boundaries along all axes and keep the cheapest
+  auto split_axis = -1, split_bin = 0;
+  auto min_cost = flt_max;
+  for (auto axis = 0; axis < 3; axis++) {
+    if (csize[axis] == 0) continue;
+    bbox3f bin_bboxes[nbins];
+    int    bin_counts[nbins];
+    for (auto b = 0; b < nbins; b++) {
+      bin_bboxes[b] = invalidb3f;
+      bin_counts[b] = 0;
+    }
+    for (auto i = start; i < end; i++) {
+      auto bin        = get_bin(primitives[i], axis);
+      bin_bboxes[bin] = merge(bin_bboxes[bin], bboxes[primitives[i]]);
+      bin_counts[bin] += 1;
+    }
+    float right_costs[nbins];
+    auto  right_bbox  = invalidb3f;
+    auto  right_count = 0;
+    for (auto b = nbins - 1; b > 0; b--) {
+      right_bbox = merge(right_bbox, bin_bboxes[b]);
+      right_count += bin_counts[b];
+      right_costs[b] = right_count ? right_count * area(right_bbox) : 0;
+    }
+    auto left_bbox  = invalidb3f;
+    auto left_count = 0;
     for (auto b = 1; b < nbins; b++) {
-      auto split     = cbbox.min[saxis] + b * csize[saxis] / nbins;
-      auto left_bbox = invalidb3f, right_bbox = invalidb3f;
-      auto left_nprims = 0, right_nprims = 0;
-      for (auto i = start; i < end; i++) {
-        if (centers[primitives[i]][saxis] < split) {
-          left_bbox = merge(left_bbox, bboxes[primitives[i]]);
-          left_nprims += 1;
-        } else {
-          right_bbox = merge(right_bbox, bboxes[primitives[i]]);
-          right_nprims += 1;
-        }
-      }
-      auto cost = 1 + left_nprims * area(left_bbox) / area(cbbox) +
-                  right_nprims * area(right_bbox) / area(cbbox);
+      left_bbox = merge(left_bbox, bin_bboxes[b - 1]);
+      left_count += bin_counts[b - 1];
+      if (left_count == 0 || left_count == end - start) continue;
+      auto cost = left_count * area(left_bbox) + right_costs[b];
       if (cost < min_cost) {
         min_cost   = cost;
-        middle     = split;
-        split_axis = saxis;
+        split_axis = axis;
+        split_bin  = b;
       }
     }
   }
-  // split
-  mid = (int)(std::partition(primitives.data() + start, primitives.data() + end,
-                  [split_axis, middle, &centers](
-                      auto a) { return centers[a][split_axis] < middle; }) -
-              primitives.data());
-
-  // if we were not able to split, just break the primitives in half
-  if (mid == start || mid == end) {
-    throw std::runtime_error("bad bvh split");
-    split_axis = 0;
-    mid        = (start + end) / 2;
-  }
+  if (split_axis < 0) return {start, 0};
 
+  // split
+  auto mid = (int)(std::partition(primitives.data() + start,
+                       primitives.data() + end,
+                       [split_axis, split_bin, &get_bin](auto a) {
+                         return get_bin(a, split_axis) < split_bin;
+                       }) -
+                   primitives.data());
   return {mid, split_axis};
 }
 
@@ -892,37 +1143,28 @@ static std::pair<int, int> split_balanced(std::vector<int>& primitives,
 
   // balanced tree split: find the largest axis of the
   // bounding box and split along this one right in the middle
-  mid = (start + end) / 2;
   std::nth_element(primitives.data() + start, primitives.data() + mid,
       primitives.data() + end, [axis, &centers](auto a, auto b) {
         return centers[a][axis] < centers[b][axis];
       });
 
-  // if we were not able to split, just break the primitives in half
-  if (mid == start || mid == end) {
-    throw std::runtime_error("bad bvh split");
-    axis = 0;
-    mid  = (start + end) / 2;
-  }
-
   return {mid, axis};
 }
 
 // Splits a BVH node using the middle heutirtic. Returns split position and
-// axis.
+// axis, with the position set to start if the primitives cannot be split.
 static std::pair<int, int> split_middle(std::vector<int>& primitives,
     const std::vector<bbox3f>& bboxes, const std::vector<vec3f>& centers,
     int start, int end) {
   // initialize split axis and position
   auto axis = 0;
-  auto mid  = (start + end) / 2;
 
   // compute primintive bounds and size
   auto cbbox = invalidb3f;
   for (auto i = start; i < end; i++)
     cbbox = merge(cbbox, centers[primitives[i]]);
   auto csize = cbbox.max - cbbox.min;
-  if (csize == zero3f) return {mid, axis};
+  if (csize == zero3f) return {start, axis};
 
   // split along largest
   if (csize.x >= csize.y && csize.x >= csize.z) axis = 0;
@@ -932,54 +1174,61 @@ static std::pair<int, int> split_middle(std::vector<int>& primitives,
   // split the space in the middle along the largest axis
   auto cmiddle = (cbbox.max + cbbox.min) / 2;
   auto middle  = cmiddle[axis];
-  mid = (int)(std::partition(primitives.data() + start, primitives.data() + end,
-                  [axis, middle, &centers](
-                      auto a) { return centers[a][axis] < middle; }) -
-              primitives.data());
-
-  // if we were not able to split, just break the primitives in half
-  if (mid == start || mid == end) {
-    throw std::runtime_error("bad bvh split");
-    axis = 0;
-    mid  = (start + end) / 2;
-  }
+  auto mid     = (int)(std::partition(primitives.data() + start,
+                       primitives.data() + end,
+                       [axis, middle, &centers](
+                           auto a) { return centers[a][axis] < middle; }) -
+                   primitives.data());
 
   return {mid, axis};
 }
 
+// Traversal routines use fixed stacks that hold at most bvh_max_depth nodes.
+static_assert(bvh_max_depth < 128, "bvh traversal stacks hold 128 nodes");
+
+// Splits a BVH node with the requested heuristic. Falls back to a balanced
+// split when the heuristic cannot separate the primitives, and for nodes
+// deep enough that only median splits guarantee to stay within
+// bvh_max_depth.
+static std::pair<int, int> split_nodes(std::vector<int>& primitives,
+    const std::vector<bbox3f>& bboxes, const std::vector<vec3f>& centers,
+    int start, int end, int depth, bvh_split split) {
+  if (depth < bvh_max_depth - 32) {
+    auto [mid, axis] = split == bvh_split::sah
+                           ? split_sah(primitives, bboxes, centers, start, end)
+                       : split == bvh_split::middle
+                           ? split_middle(
+                                 primitives, bboxes, centers, start, end)
+                           : std::pair<int, int>{start, 0};
+    if (mid != start && mid != end) return {mid, axis};
+  }
+  return split_balanced(primitives, bboxes, centers, start, end);
+}
+
 #if !defined(_WIN32) && !defined(_WIN64)
 #pragma GCC diagnostic pop
 #endif
 
-// Build BVH nodes
-static void build_bvh(bvh_tree& bvh, std::vector<bbox3f>& bboxes) {
-  // get values
-  auto& nodes      = bvh.nodes;
-  auto& primitives = bvh.primitives;
-
-  // prepare to build nodes
-  nodes.clear();
-  nodes.reserve(bboxes.size() * 2);
-
-  // prepare primitives
-  bvh.primitives.resize(bboxes.size());
-  for (auto idx = 0; idx < bboxes.size(); idx++) bvh.primitives[idx] = idx;
-
-  // prepare centers
-  auto centers = std::vector<vec3f>(bboxes.size());
-  for (auto idx = 0; idx < bboxes.size(); idx++)
-    centers[idx] = center(bboxes[idx]);
-
-  // queue up first node
-  auto queue = std::deque<vec3i>{{0, 0, (int)bboxes.size()}};
-  nodes.emplace_back();
-
+// Build BVH nodes for the subtrees queued in `queue`, given as node id,
+// primitive range and depth. Children are stored next to each other after
+// their parent, so that updates can proceed in reverse order. Subtrees with
+// at most `defer_size` primitives are not built but returned in `deferred`.
+static void build_bvh_nodes(std::vector<bvh_node>& nodes,
+    std::vector<int>& primitives, const std::vector<bbox3f>& bboxes,
+    const std::vector<vec3f>& centers, std::deque<vec4i>& queue,
+    std::vector<vec4i>& deferred, bvh_split split, int defer_size) {
   // create nodes until the queue is empty
   while (!queue.empty()) {
     // grab node to work on
     auto next = queue.front();
     queue.pop_front();
-    auto nodeid = next.x, start = next.y, end = next.z;
+    auto nodeid = next.x, start = next.y, end = next.z, depth = next.w;
+
+    // defer small subtrees
+    if (end - start <= defer_size && end - start > bvh_max_prims) {
+      deferred.push_back(next);
+      continue;
+    }
 
     // grab node
     auto& node = nodes[nodeid];
@@ -992,7 +1241,8 @@ static void build_bvh(bvh_tree& bvh, std::vector<bbox3f>& bboxes) {
     // split into two children
     if (end - start > bvh_max_prims) {
       // get split
-      auto [mid, axis] = split_middle(primitives, bboxes, centers, start, end);
+      auto [mid, axis] = split_nodes(
+          primitives, bboxes, centers, start, end, depth, split);
 
       // make an internal node
       node.internal = true;
@@ -1001,8 +1251,8 @@ static void build_bvh(bvh_tree& bvh, std::vector<bbox3f>& bboxes) {
       node.start    = (int)nodes.size();
       nodes.emplace_back();
       nodes.emplace_back();
-      queue.push_back({node.start + 0, start, mid});
-      queue.push_back({node.start + 1, mid, end});
+      queue.push_back({node.start + 0, start, mid, depth + 1});
+      queue.push_back({node.start + 1, mid, end, depth + 1});
     } else {
       // Make a leaf node
       node.internal = false;
@@ -1010,13 +1260,67 @@ static void build_bvh(bvh_tree& bvh, std::vector<bbox3f>& bboxes) {
       node.start    = start;
     }
   }
+}
+
+// Build BVH nodes
+void make_bvh(bvh_tree& bvh, const std::vector<bbox3f>& bboxes,
+    bvh_split split, bool noparallel) {
+  // get values
+  auto& nodes      = bvh.nodes;
+  auto& primitives = bvh.primitives;
+
+  // prepare to build nodes
+  nodes.clear();
+  nodes.reserve(bboxes.size() * 2);
+
+  // prepare primitives
+  bvh.primitives.resize(bboxes.size());
+  for (auto idx = 0; idx < bboxes.size(); idx++) bvh.primitives[idx] = idx;
+
+  // prepare centers
+  auto centers = std::vector<vec3f>(bboxes.size());
+  for (auto idx = 0; idx < bboxes.size(); idx++)
+    centers[idx] = center(bboxes[idx]);
+
+  // build the top of the tree serially, deferring subtrees small enough
+  // to be built independently
+  auto defer_size = noparallel ? 0 : max(4096, (int)bboxes.size() / 64);
+  auto queue      = std::deque<vec4i>{{0, 0, (int)bboxes.size(), 0}};
+  auto deferred   = std::vector<vec4i>{};
+  nodes.emplace_back();
+  build_bvh_nodes(nodes, primitives, bboxes, centers, queue, deferred, split,
+      defer_size);
+
+  // build deferred subtrees in parallel, each in its own node array rooted
+  // at index 0; primitives ranges are disjoint so they can be split in place
+  auto subtrees = std::vector<std::vector<bvh_node>>(deferred.size());
+  parallel_for((int)deferred.size(), [&](int idx) {
+    auto& task        = deferred[idx];
+    auto  subqueue    = std::deque<vec4i>{{0, task.y, task.z, task.w}};
+    auto  subdeferred = std::vector<vec4i>{};
+    auto& subtree     = subtrees[idx];
+    subtree.reserve((task.z - task.y) * 2);
+    subtree.emplace_back();
+    build_bvh_nodes(subtree, primitives, bboxes, centers, subqueue,
+        subdeferred, split, 0);
+  });
+
+  // splice subtrees, replacing the deferred nodes with the subtree roots
+  for (auto idx = 0; idx < deferred.size(); idx++) {
+    auto& subtree = subtrees[idx];
+    auto  offset  = (int)nodes.size() - 1;
+    for (auto& node : subtree)
+      if (node.internal) node.start += offset;
+    nodes[deferred[idx].x] = subtree[0];
+    nodes.insert(nodes.end(), subtree.begin() + 1, subtree.end());
+  }
 
   // cleanup
   nodes.shrink_to_fit();
 }
 
 // Update bvh
-static void update_bvh(bvh_tree& bvh, const std::vector<bbox3f>& bboxes) {
+void update_bvh(bvh_tree& bvh, const std::vector<bbox3f>& bboxes) {
   for (auto nodeid = (int)bvh.nodes.size() - 1; nodeid >= 0; nodeid--) {
     auto& node = bvh.nodes[nodeid];
     node.bbox  = invalidb3f;
@@ -1043,7 +1347,7 @@ void make_points_bvh(bvh_tree& bvh, const std::vector<int>& points,
   }
 
   // build nodes
-  build_bvh(bvh, bboxes);
+  make_bvh(bvh, bboxes);
 }
 void make_lines_bvh(bvh_tree& bvh, const std::vector<vec2i>& lines,
     const std::vector<vec3f>& positions, const std::vector<float>& radius) {
@@ -1056,7 +1360,7 @@ void make_lines_bvh(bvh_tree& bvh, const std::vector<vec2i>& lines,
   }
 
   // build nodes
-  build_bvh(bvh, bboxes);
+  make_bvh(bvh, bboxes);
 }
 void make_triangles_bvh(bvh_tree& bvh, const std::vector<vec3i>& triangles,
     const std::vector<vec3f>& positions, const std::vector<float>& radius) {
@@ -1069,7 +1373,7 @@ void make_triangles_bvh(bvh_tree& bvh, const std::vector<vec3i>& triangles,
   }
 
   // build nodes
-  build_bvh(bvh, bboxes);
+  make_bvh(bvh, bboxes);
 }
 void make_quads_bvh(bvh_tree& bvh, const std::vector<vec4i>& quads,
     const std::vector<vec3f>& positions, const std::vector<float>& radius) {
@@ -1082,7 +1386,7 @@ void make_quads_bvh(bvh_tree& bvh, const std::vector<vec4i>& quads,
   }
 
   // build nodes
-  build_bvh(bvh, bboxes);
+  make_bvh(bvh, bboxes);
 }
 
 void update_points_bvh(bvh_tree& bvh, const std::vector<int>& points,
@@ -1274,7 +1578,7 @@ static bool overlap_elements_bvh(const bvh_tree& bvh, Overlap&& overlap_element,
   if (bvh.nodes.empty()) return false;
 
   // node stack
-  int  node_stack[64];
+  int  node_stack[128];
   auto node_cur          = 0;
   node_stack[node_cur++] = 0;
 
@@ -1388,6 +1692,227 @@ bvh_intersection overlap_quads_bvh(const bvh_tree& bvh,
   return intersection;
 }
 
+// Squared distance between a point and a bbox, zero if the point is inside.
+static float distance_squared_bbox(const vec3f& pos, const bbox3f& bbox) {
+  auto dd = 0.0f;
+  for (auto axis = 0; axis < 3; axis++) {
+    if (pos[axis] < bbox.min[axis])
+      dd += (bbox.min[axis] - pos[axis]) * (bbox.min[axis] - pos[axis]);
+    if (pos[axis] > bbox.max[axis])
+      dd += (pos[axis] - bbox.max[axis]) * (pos[axis] - bbox.max[axis]);
+  }
+  return dd;
+}
+
+// Find the k elements closest to a point within a maximum distance, kept in
+// `nearest` as a max-heap on distance. Children are visited nearest first and
+// nodes farther than the k-th element found so far are skipped. Only the
+// element, uv and distance of the results are set.
+template <typename Closest>
+static void nearest_elements_bvh(const bvh_tree& bvh,
+    Closest&& closest_element, const vec3f& pos, float max_distance, int k,
+    std::vector<bvh_closest>& nearest) {
+  // check if empty
+  nearest.clear();
+  if (bvh.nodes.empty() || k <= 0) return;
+
+  // heap ordering
+  auto farther = [](const bvh_closest& a, const bvh_closest& b) {
+    return a.distance < b.distance;
+  };
+
+  // node stack holding node ids and squared distances
+  int   node_stack[128];
+  float dist_stack[128];
+  auto  node_cur         = 0;
+  node_stack[node_cur]   = 0;
+  dist_stack[node_cur++] = distance_squared_bbox(pos, bvh.nodes[0].bbox);
+
+  // walking stack
+  while (node_cur) {
+    // grab node and skip if too far
+    node_cur--;
+    if (dist_stack[node_cur] > max_distance * max_distance) continue;
+    auto& node = bvh.nodes[node_stack[node_cur]];
+
+    // visit node, pushing the nearest child last so it is visited next
+    if (node.internal) {
+      auto dist0 = distance_squared_bbox(pos, bvh.nodes[node.start + 0].bbox);
+      auto dist1 = distance_squared_bbox(pos, bvh.nodes[node.start + 1].bbox);
+      auto first = dist0 <= dist1 ? 0 : 1;
+      node_stack[node_cur]   = node.start + 1 - first;
+      dist_stack[node_cur++] = first ? dist0 : dist1;
+      node_stack[node_cur]   = node.start + first;
+      dist_stack[node_cur++] = first ? dist1 : dist0;
+    } else {
+      for (auto idx = 0; idx < node.num; idx++) {
+        auto primitive = bvh.primitives[node.start + idx];
+        auto closest   = bvh_closest{};
+        if (!closest_element(
+                primitive, pos, max_distance, closest.uv, closest.distance))
+          continue;
+        closest.element = primitive;
+        closest.hit     = true;
+        if (nearest.size() == (size_t)k) {
+          std::pop_heap(nearest.begin(), nearest.end(), farther);
+          nearest.pop_back();
+        }
+        nearest.push_back(closest);
+        std::push_heap(nearest.begin(), nearest.end(), farther);
+        if (nearest.size() == (size_t)k)
+          max_distance = nearest.front().distance;
+      }
+    }
+  }
+}
+
+// Find the element closest to a point within a maximum distance.
+template <typename Closest>
+static bvh_closest closest_elements_bvh(const bvh_tree& bvh,
+    Closest&& closest_element, const vec3f& pos, float max_distance) {
+  auto nearest = std::vector<bvh_closest>{};
+  nearest.reserve(1);
+  nearest_elements_bvh(bvh, closest_element, pos, max_distance, 1, nearest);
+  return nearest.empty() ? bvh_closest{} : nearest.front();
+}
+
+// Set closest position and normal for triangle and quad elements
+static void eval_closest_triangle(bvh_closest& closest,
+    const std::vector<vec3i>& triangles, const std::vector<vec3f>& positions) {
+  if (!closest.hit) return;
+  auto& t          = triangles[closest.element];
+  closest.position = interpolate_triangle(
+      positions[t.x], positions[t.y], positions[t.z], closest.uv);
+  closest.normal = triangle_normal(
+      positions[t.x], positions[t.y], positions[t.z]);
+}
+static void eval_closest_quad(bvh_closest& closest,
+    const std::vector<vec4i>& quads, const std::vector<vec3f>& positions) {
+  if (!closest.hit) return;
+  auto& q          = quads[closest.element];
+  closest.position = interpolate_quad(positions[q.x], positions[q.y],
+      positions[q.z], positions[q.w], closest.uv);
+  closest.normal   = closest.uv.x + closest.uv.y <= 1
+                       ? triangle_normal(
+                             positions[q.x], positions[q.y], positions[q.w])
+                       : triangle_normal(
+                             positions[q.z], positions[q.w], positions[q.y]);
+}
+
+// Find the shape element closest to a point within a maximum distance.
+bvh_closest closest_triangles_bvh(const bvh_tree& bvh,
+    const std::vector<vec3i>& triangles, const std::vector<vec3f>& positions,
+    const vec3f& pos, float max_distance) {
+  auto closest = closest_elements_bvh(
+      bvh,
+      [&triangles, &positions](int idx, const vec3f& pos, float max_distance,
+          vec2f& uv, float& distance) {
+        auto& t = triangles[idx];
+        return overlap_triangle(pos, max_distance, positions[t.x],
+            positions[t.y], positions[t.z], 0, 0, 0, uv, distance);
+      },
+      pos, max_distance);
+  eval_closest_triangle(closest, triangles, positions);
+  return closest;
+}
+bvh_closest closest_quads_bvh(const bvh_tree& bvh,
+    const std::vector<vec4i>& quads, const std::vector<vec3f>& positions,
+    const vec3f& pos, float max_distance) {
+  auto closest = closest_elements_bvh(
+      bvh,
+      [&quads, &positions](int idx, const vec3f& pos, float max_distance,
+          vec2f& uv, float& distance) {
+        auto& q = quads[idx];
+        return overlap_quad(pos, max_distance, positions[q.x], positions[q.y],
+            positions[q.z], positions[q.w], 0, 0, 0, 0, uv, distance);
+      },
+      pos, max_distance);
+  eval_closest_quad(closest, quads, positions);
+  return closest;
+}
+
+// Find the closest shape element for each point, running queries in parallel
+// over blocks of points.
+std::vector<bvh_closest> closest_triangles_bvh(const bvh_tree& bvh,
+    const std::vector<vec3i>& triangles, const std::vector<vec3f>& positions,
+    const std::vector<vec3f>& points, float max_distance, bool noparallel) {
+  auto closests = std::vector<bvh_closest>(points.size());
+  if (noparallel) {
+    for (auto idx = 0; idx < points.size(); idx++)
+      closests[idx] = closest_triangles_bvh(
+          bvh, triangles, positions, points[idx], max_distance);
+  } else {
+    const auto block = 256;
+    parallel_for(((int)points.size() + block - 1) / block, [&](int block_id) {
+      auto end = min((block_id + 1) * block, (int)points.size());
+      for (auto idx = block_id * block; idx < end; idx++)
+        closests[idx] = closest_triangles_bvh(
+            bvh, triangles, positions, points[idx], max_distance);
+    });
+  }
+  return closests;
+}
+std::vector<bvh_closest> closest_quads_bvh(const bvh_tree& bvh,
+    const std::vector<vec4i>& quads, const std::vector<vec3f>& positions,
+    const std::vector<vec3f>& points, float max_distance, bool noparallel) {
+  auto closests = std::vector<bvh_closest>(points.size());
+  if (noparallel) {
+    for (auto idx = 0; idx < points.size(); idx++)
+      closests[idx] = closest_quads_bvh(
+          bvh, quads, positions, points[idx], max_distance);
+  } else {
+    const auto block = 256;
+    parallel_for(((int)points.size() + block - 1) / block, [&](int block_id) {
+      auto end = min((block_id + 1) * block, (int)points.size());
+      for (auto idx = block_id * block; idx < end; idx++)
+        closests[idx] = closest_quads_bvh(
+            bvh, quads, positions, points[idx], max_distance);
+    });
+  }
+  return closests;
+}
+
+// Find the k shape elements nearest to a point within a maximum distance.
+std::vector<bvh_closest> nearest_triangles_bvh(const bvh_tree& bvh,
+    const std::vector<vec3i>& triangles, const std::vector<vec3f>& positions,
+    const vec3f& pos, int k, float max_distance) {
+  auto nearest = std::vector<bvh_closest>{};
+  nearest.reserve(k);
+  nearest_elements_bvh(
+      bvh,
+      [&triangles, &positions](int idx, const vec3f& pos, float max_distance,
+          vec2f& uv, float& distance) {
+        auto& t = triangles[idx];
+        return overlap_triangle(pos, max_distance, positions[t.x],
+            positions[t.y], positions[t.z], 0, 0, 0, uv, distance);
+      },
+      pos, max_distance, k, nearest);
+  std::sort(nearest.begin(), nearest.end(),
+      [](auto& a, auto& b) { return a.distance < b.distance; });
+  for (auto& closest : nearest)
+    eval_closest_triangle(closest, triangles, positions);
+  return nearest;
+}
+std::vector<bvh_closest> nearest_quads_bvh(const bvh_tree& bvh,
+    const std::vector<vec4i>& quads, const std::vector<vec3f>& positions,
+    const vec3f& pos, int k, float max_distance) {
+  auto nearest = std::vector<bvh_closest>{};
+  nearest.reserve(k);
+  nearest_elements_bvh(
+      bvh,
+      [&quads, &positions](int idx, const vec3f& pos, float max_distance,
+          vec2f& uv, float& distance) {
+        auto& q = quads[idx];
+        return overlap_quad(pos, max_distance, positions[q.x], positions[q.y],
+            positions[q.z], positions[q.w], 0, 0, 0, 0, uv, distance);
+      },
+      pos, max_distance, k, nearest);
+  std::sort(nearest.begin(), nearest.end(),
+      [](auto& a, auto& b) { return a.distance < b.distance; });
+  for (auto& closest : nearest) eval_closest_quad(closest, quads, positions);
+  return nearest;
+}
+
 }  // namespace yocto::shape
 
 // -----------------------------------------------------------------------------
@@ -1435,7 +1960,7 @@ void init_shape_bvh(bvh_shape& shape, bool embree) {
   }
 
   // build nodes
-  build_bvh(shape.bvh, bboxes);
+  make_bvh(shape.bvh, bboxes);
 }
 
 void init_scene_bvh(bvh_scene& scene, bool embree) {
@@ -1462,7 +1987,7 @@ void init_scene_bvh(bvh_scene& scene, bool embree) {
   }
 
   // build nodes
-  build_bvh(scene.bvh, bboxes);
+  make_bvh(scene.bvh, bboxes);
 }
 
 void update_shape_bvh(bvh_shape& shape) {
@@ -1722,7 +2247,7 @@ static bool overlap_shape_bvh(const bvh_shape& shape, const vec3f& pos,
   if (shape.bvh.nodes.empty()) return false;
 
   // node stack
-  int  node_stack[64];
+  int  node_stack[128];
   auto node_cur          = 0;
   node_stack[node_cur++] = 0;
 
@@ -1808,7 +2333,7 @@ static bool overlap_scene_bvh(const bvh_scene& scene, const vec3f& pos,
   if (scene.bvh.nodes.empty()) return false;
 
   // node stack
-  int  node_stack[64];
+  int  node_stack[128];
   auto node_cur          = 0;
   node_stack[node_cur++] = 0;
 
@@ -1967,49 +2492,76 @@ vec3i get_cell_index(const hash_grid& grid, const vec3f& position) {
   return vec3i{(int)scaledpos.x, (int)scaledpos.y, (int)scaledpos.z};
 }
 
-// Create a hash_grid
-hash_grid make_hash_grid(float cell_size) {
-  auto grid          = hash_grid{};
-  grid.cell_size     = cell_size;
-  grid.cell_inv_size = 1 / cell_size;
-  return grid;
+// Gets the hash bucket of a cell
+static int get_cell_bucket(const hash_grid& grid, const vec3i& cell) {
+  auto hash = ((uint32_t)cell.x * 73856093u) ^ ((uint32_t)cell.y * 19349663u) ^
+              ((uint32_t)cell.z * 83492791u);
+  return (int)(hash & (uint32_t)(grid.buckets.size() - 2));
 }
+
+// Create a hash_grid
 hash_grid make_hash_grid(const std::vector<vec3f>& positions, float cell_size) {
   auto grid          = hash_grid{};
   grid.cell_size     = cell_size;
   grid.cell_inv_size = 1 / cell_size;
-  for (auto& position : positions) insert_vertex(grid, position);
+  update_hash_grid(grid, positions);
   return grid;
 }
-// Inserts a point into the grid
-int insert_vertex(hash_grid& grid, const vec3f& position) {
-  auto vertex_id = (int)grid.positions.size();
-  auto cell      = get_cell_index(grid, position);
-  grid.cells[cell].push_back(vertex_id);
-  grid.positions.push_back(position);
-  return vertex_id;
+
+// Rebuild the grid with a counting sort of vertices by bucket. The sort is
+// stable, so vertices in a cell are kept in increasing order.
+void update_hash_grid(hash_grid& grid, const std::vector<vec3f>& positions) {
+  auto num_vertices = (int)positions.size();
+  auto num_buckets  = 1;
+  while (num_buckets < num_vertices) num_buckets *= 2;
+  grid.positions = positions;
+  grid.cells.resize(num_vertices);
+  grid.buckets.assign(num_buckets + 1, 0);
+  grid.vertices.resize(num_vertices);
+  parallel_for(num_vertices, [&grid](int vertex) {
+    grid.cells[vertex] = get_cell_index(grid, grid.positions[vertex]);
+  });
+  for (auto& cell : grid.cells) grid.buckets[get_cell_bucket(grid, cell) + 1]++;
+  for (auto bucket = 0; bucket < num_buckets; bucket++)
+    grid.buckets[bucket + 1] += grid.buckets[bucket];
+  auto offsets = std::vector<int>(grid.buckets.begin(), grid.buckets.end() - 1);
+  for (auto vertex = 0; vertex < num_vertices; vertex++) {
+    auto bucket = get_cell_bucket(grid, grid.cells[vertex]);
+    grid.vertices[offsets[bucket]++] = vertex;
+  }
+}
+
+// Visit the vertices in a cell
+template <typename Func>
+static void for_each_cell_vertex(
+    const hash_grid& grid, const vec3i& cell, Func&& func) {
+  auto bucket = get_cell_bucket(grid, cell);
+  for (auto idx = grid.buckets[bucket]; idx < grid.buckets[bucket + 1]; idx++) {
+    auto vertex = grid.vertices[idx];
+    if (grid.cells[vertex] == cell) func(vertex);
+  }
 }
+
 // Finds the nearest neighbors within a given radius
 void find_neighbors(const hash_grid& grid, std::vector<int>& neighbors,
     const vec3f& position, float max_radius, int skip_id) {
-  auto cell        = get_cell_index(grid, position);
-  auto cell_radius = (int)(max_radius * grid.cell_inv_size) + 1;
   neighbors.clear();
+  if (grid.vertices.empty()) return;
+  // search one cell beyond the radius, as a margin for rounding in the
+  // cell indices of points near cell boundaries
+  auto cell               = get_cell_index(grid, position);
+  auto cell_radius        = (int)(max_radius * grid.cell_inv_size) + 1;
   auto max_radius_squared = max_radius * max_radius;
   for (auto k = -cell_radius; k <= cell_radius; k++) {
     for (auto j = -cell_radius; j <= cell_radius; j++) {
       for (auto i = -cell_radius; i <= cell_radius; i++) {
-        auto ncell         = cell + vec3i{i, j, k};
-        auto cell_iterator = grid.cells.find(ncell);
-        if (cell_iterator == grid.cells.end()) continue;
-        auto& ncell_vertices = cell_iterator->second;
-        for (auto vertex_id : ncell_vertices) {
+        for_each_cell_vertex(grid, cell + vec3i{i, j, k}, [&](int vertex_id) {
           if (distance_squared(grid.positions[vertex_id], position) >
               max_radius_squared)
-            continue;
-          if (vertex_id == skip_id) continue;
+            return;
+          if (vertex_id == skip_id) return;
           neighbors.push_back(vertex_id);
-        }
+        });
       }
     }
   }
@@ -2022,6 +2574,71 @@ void find_neighbors(const hash_grid& grid, std::vector<int>& neighbors,
     int vertex, float max_radius) {
   find_neighbors(grid, neighbors, grid.positions[vertex], max_radius, vertex);
 }
+void find_neighbors(const hash_grid& grid,
+    std::vector<std::vector<int>>& neighbors,
+    const std::vector<vec3f>& positions, float max_radius) {
+  neighbors.resize(positions.size());
+  parallel_for((int)positions.size(), [&](int idx) {
+    find_neighbors(grid, neighbors[idx], positions[idx], max_radius, -1);
+  });
+}
+void find_neighbors(const hash_grid& grid,
+    std::vector<std::vector<int>>& neighbors, float max_radius) {
+  neighbors.resize(grid.positions.size());
+  parallel_for((int)grid.positions.size(), [&](int vertex) {
+    find_neighbors(
+        grid, neighbors[vertex], grid.positions[vertex], max_radius, vertex);
+  });
+}
+
+// Finds the k nearest neighbors by visiting rings of cells of increasing
+// radius. Vertices outside the first r rings are at least (r-1) cells away,
+// which bounds the search.
+void find_nearest_neighbors(const hash_grid& grid, std::vector<int>& neighbors,
+    const vec3f& position, int num_neighbors, float max_radius, int skip_id) {
+  neighbors.clear();
+  if (grid.vertices.empty() || num_neighbors <= 0) return;
+  auto cell               = get_cell_index(grid, position);
+  auto cell_radius        = (int)(max_radius * grid.cell_inv_size) + 1;
+  auto max_radius_squared = max_radius * max_radius;
+  auto nearest            = std::vector<std::pair<float, int>>{};
+  for (auto r = 0; r <= cell_radius; r++) {
+    if (nearest.size() == (size_t)num_neighbors && r > 1) {
+      auto ring_distance = (r - 1) * grid.cell_size;
+      if (nearest.front().first <= ring_distance * ring_distance) break;
+    }
+    for (auto k = -r; k <= r; k++) {
+      for (auto j = -r; j <= r; j++) {
+        auto step = (abs(k) == r || abs(j) == r) ? 1 : max(2 * r, 1);
+        for (auto i = -r; i <= r; i += step) {
+          for_each_cell_vertex(grid, cell + vec3i{i, j, k}, [&](int vertex_id) {
+            auto dist2 = distance_squared(grid.positions[vertex_id], position);
+            if (dist2 > max_radius_squared || vertex_id == skip_id) return;
+            if (nearest.size() == (size_t)num_neighbors) {
+              if (dist2 >= nearest.front().first) return;
+              std::pop_heap(nearest.begin(), nearest.end());
+              nearest.pop_back();
+            }
+            nearest.push_back({dist2, vertex_id});
+            std::push_heap(nearest.begin(), nearest.end());
+          });
+        }
+      }
+    }
+  }
+  std::sort_heap(nearest.begin(), nearest.end());
+  for (auto& [dist2, vertex_id] : nearest) neighbors.push_back(vertex_id);
+}
+void find_nearest_neighbors(const hash_grid& grid, std::vector<int>& neighbors,
+    const vec3f& position, int num_neighbors, float max_radius) {
+  find_nearest_neighbors(
+      grid, neighbors, position, num_neighbors, max_radius, -1);
+}
+void find_nearest_neighbors(const hash_grid& grid, std::vector<int>& neighbors,
+    int vertex, int num_neighbors, float max_radius) {
+  find_nearest_neighbors(grid, neighbors, grid.positions[vertex],
+      num_neighbors, max_radius, vertex);
+}
 
 }  // namespace yocto::shape
 
@@ -2252,22 +2869,59 @@ std::vector<std::vector<vec4i>> ungroup_quads(
   return ungroup_elems_impl(quads, ids);
 }
 
-// Weld vertices within a threshold.
+// Weld vertices within a threshold. Vertices are visited in order and mapped
+// to the first previously welded vertex found within the threshold. The
+// neighbors of each vertex are found in parallel over blocks of vertices,
+// and then clusters are resolved with a serial pass over the candidates, so
+// the result does not depend on the number of threads.
 std::pair<std::vector<vec3f>, std::vector<int>> weld_vertices(
     const std::vector<vec3f>& positions, float threshold) {
-  auto indices   = std::vector<int>(positions.size());
-  auto welded    = std::vector<vec3f>{};
-  auto grid      = make_hash_grid(threshold);
-  auto neighbors = std::vector<int>{};
-  for (auto vertex = 0; vertex < positions.size(); vertex++) {
-    auto& position = positions[vertex];
-    find_neighbors(grid, neighbors, position, threshold);
-    if (neighbors.empty()) {
-      welded.push_back(position);
-      indices[vertex] = (int)welded.size() - 1;
-      insert_vertex(grid, position);
-    } else {
-      indices[vertex] = neighbors.front();
+  auto grid = make_hash_grid(positions, threshold);
+
+  // find earlier neighbors of each vertex, in the order they are visited
+  auto num_vertices = (int)positions.size();
+  auto block_size   = 4096;
+  auto num_blocks   = (num_vertices + block_size - 1) / block_size;
+  auto candidates   = std::vector<std::vector<int>>(num_blocks);
+  auto offsets      = std::vector<std::vector<int>>(num_blocks);
+  parallel_for(num_blocks, [&](int block) {
+    auto  neighbors        = std::vector<int>{};
+    auto& block_candidates = candidates[block];
+    auto& block_offsets    = offsets[block];
+    auto  start            = block * block_size;
+    auto  end              = min(start + block_size, num_vertices);
+    block_offsets.push_back(0);
+    for (auto vertex = start; vertex < end; vertex++) {
+      find_neighbors(grid, neighbors, vertex, threshold);
+      for (auto neighbor : neighbors) {
+        if (neighbor < vertex) block_candidates.push_back(neighbor);
+      }
+      block_offsets.push_back((int)block_candidates.size());
+    }
+  });
+
+  // resolve clusters
+  auto indices = std::vector<int>(positions.size());
+  auto welded  = std::vector<vec3f>{};
+  auto kept    = std::vector<bool>(positions.size(), false);
+  for (auto block = 0; block < num_blocks; block++) {
+    auto& block_candidates = candidates[block];
+    auto& block_offsets    = offsets[block];
+    for (auto idx = 0; idx < (int)block_offsets.size() - 1; idx++) {
+      auto vertex     = block * block_size + idx;
+      indices[vertex] = -1;
+      for (auto cidx = block_offsets[idx]; cidx < block_offsets[idx + 1];
+           cidx++) {
+        auto neighbor = block_candidates[cidx];
+        if (!kept[neighbor]) continue;
+        indices[vertex] = indices[neighbor];
+        break;
+      }
+      if (indices[vertex] < 0) {
+        welded.push_back(positions[vertex]);
+        indices[vertex] = (int)welded.size() - 1;
+        kept[vertex]    = true;
+      }
     }
   }
   return {welded, indices};
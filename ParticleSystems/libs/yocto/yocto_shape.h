@@ -172,6 +172,34 @@ void update_normals(std::vector<vec3f>& normals,
 void update_normals(std::vector<vec3f>& normals,
     const std::vector<vec4i>& quads, const std::vector<vec3f>& positions);
 
+// Faces adjacent to each vertex, stored as compressed rows in face order.
+// The faces of vertex `vid` are `faces[starts[vid]]` to
+// `faces[starts[vid + 1] - 1]`. Build once and reuse while the
+// connectivity does not change.
+struct vertex_faces {
+  std::vector<int> starts = {};
+  std::vector<int> faces  = {};
+};
+vertex_faces make_vertex_faces(
+    const std::vector<vec3i>& triangles, int num_vertices);
+vertex_faces make_vertex_faces(
+    const std::vector<vec4i>& quads, int num_vertices);
+
+// Update normals in parallel by gathering the area-weighted face normals
+// around each vertex. Faces are summed in order, so the results match the
+// serial version exactly. If `moved` is given, only the vertices that share
+// a face with a moved vertex are updated.
+void update_normals(std::vector<vec3f>& normals, const vertex_faces& adjacency,
+    const std::vector<vec3i>& triangles, const std::vector<vec3f>& positions);
+void update_normals(std::vector<vec3f>& normals, const vertex_faces& adjacency,
+    const std::vector<vec4i>& quads, const std::vector<vec3f>& positions);
+void update_normals(std::vector<vec3f>& normals, const vertex_faces& adjacency,
+    const std::vector<vec3i>& triangles, const std::vector<vec3f>& positions,
+    const std::vector<int>& moved);
+void update_normals(std::vector<vec3f>& normals, const vertex_faces& adjacency,
+    const std::vector<vec4i>& quads, const std::vector<vec3f>& positions,
+    const std::vector<int>& moved);
+
 // Compute per-vertex tangent space for triangle meshes.
 // Tangent space is defined by a four component std::vector.
 // The first three components are the tangent with respect to the u texcoord.
@@ -224,14 +252,15 @@ std::vector<vec3f> align_vertices(
 // -----------------------------------------------------------------------------
 namespace yocto::shape {
 
-// Dictionary to store edge information. `index` is the index to the edge
-// array, `edges` the array of edges and `nfaces` the number of adjacent faces.
+// Dictionary to store edge information. `edges` is the array of edges,
+// `nfaces` the number of adjacent faces and `table` an open addressing hash
+// table of indices into the edge array, keyed by the edge vertices.
 // We store only bidirectional edges to keep the dictionary small. Use the
 // functions below to access this data.
 struct edge_map {
-  std::unordered_map<vec2i, int> index  = {};
-  std::vector<vec2i>             edges  = {};
-  std::vector<int>               nfaces = {};
+  std::vector<vec2i> edges  = {};
+  std::vector<int>   nfaces = {};
+  std::vector<int>   table  = {};
 };
 
 // Initialize an edge map with elements.
@@ -250,6 +279,12 @@ std::vector<vec2i> get_boundary(const edge_map& emap);
 std::vector<vec2i> get_edges(const std::vector<vec3i>& triangles);
 std::vector<vec2i> get_edges(const std::vector<vec4i>& quads);
 
+// Build the opposite half-edge of each half-edge, or -1 on boundaries.
+// The k-th half-edge of face i has index i * 3 + k for triangles and
+// i * 4 + k for quads.
+std::vector<int> halfedge_twins(const std::vector<vec3i>& triangles);
+std::vector<int> halfedge_twins(const std::vector<vec4i>& quads);
+
 // Build adjacencies between faces (sorted counter-clockwise)
 std::vector<vec3i> face_adjacencies(const std::vector<vec3i>& triangles);
 
@@ -278,6 +313,13 @@ namespace yocto::shape {
 // Maximum number of primitives per BVH node.
 const int bvh_max_prims = 4;
 
+// Maximum depth of BVH trees. Nodes past bvh_max_depth - 32 are split at the
+// median, so that traversals can use fixed-size stacks.
+const int bvh_max_depth = 96;
+
+// Heuristic used to split BVH nodes. SAH gives the fastest traversals.
+enum struct bvh_split { sah, middle, balanced };
+
 // BVH tree node containing its bounds, indices to the BVH arrays of either
 // primitives or internal nodes, the node element type,
 // and the split axis. Leaf and internal nodes are identical, except that
@@ -312,6 +354,16 @@ struct bvh_intersection {
   bool  hit      = false;
 };
 
+// Make a bvh over primitive bounds, with primitives referring to the indices
+// in `bboxes`. The top of the tree is split serially, while the remaining
+// subtrees are built in parallel unless `noparallel` is set.
+void make_bvh(bvh_tree& bvh, const std::vector<bbox3f>& bboxes,
+    bvh_split split = bvh_split::sah, bool noparallel = false);
+
+// Refit bvh nodes after changes in primitive bounds, keeping the tree
+// topology.
+void update_bvh(bvh_tree& bvh, const std::vector<bbox3f>& bboxes);
+
 // Make shape bvh
 void make_points_bvh(bvh_tree& bvh, const std::vector<int>& points,
     const std::vector<vec3f>& positions, const std::vector<float>& radius);
@@ -370,6 +422,48 @@ bvh_intersection overlap_quads_bvh(const bvh_tree& bvh,
     const std::vector<float>& radius, const vec3f& pos, float max_distance,
     bool find_any = false);
 
+// Results of closest_xxx and nearest_xxx functions that include hit flag,
+// shape element id, element uv, distance, closest surface position and
+// element geometric normal. Results values are set only if hit is true.
+struct bvh_closest {
+  int   element  = -1;
+  vec2f uv       = {0, 0};
+  float distance = 0;
+  vec3f position = {0, 0, 0};
+  vec3f normal   = {0, 0, 1};
+  bool  hit      = false;
+};
+
+// Find the shape element closest to a point within a maximum distance.
+// Nodes are visited nearest first and skipped once farther than the closest
+// element found so far.
+bvh_closest closest_triangles_bvh(const bvh_tree& bvh,
+    const std::vector<vec3i>& triangles, const std::vector<vec3f>& positions,
+    const vec3f& pos, float max_distance = flt_max);
+bvh_closest closest_quads_bvh(const bvh_tree& bvh,
+    const std::vector<vec4i>& quads, const std::vector<vec3f>& positions,
+    const vec3f& pos, float max_distance = flt_max);
+
+// Find the closest shape element for each point, running queries in parallel
+// unless `noparallel` is set.
+std::vector<bvh_closest> closest_triangles_bvh(const bvh_tree& bvh,
+    const std::vector<vec3i>& triangles, const std::vector<vec3f>& positions,
+    const std::vector<vec3f>& points, float max_distance = flt_max,
+    bool noparallel = false);
+std::vector<bvh_closest> closest_quads_bvh(const bvh_tree& bvh,
+    const std::vector<vec4i>& quads, const std::vector<vec3f>& positions,
+    const std::vector<vec3f>& points, float max_distance = flt_max,
+    bool noparallel = false);
+
+// Find the k shape elements nearest to a point within a maximum distance,
+// sorted by increasing distance.
+std::vector<bvh_closest> nearest_triangles_bvh(const bvh_tree& bvh,
+    const std::vector<vec3i>& triangles, const std::vector<vec3f>& positions,
+    const vec3f& pos, int k, float max_distance = flt_max);
+std::vector<bvh_closest> nearest_quads_bvh(const bvh_tree& bvh,
+    const std::vector<vec4i>& quads, const std::vector<vec3f>& positions,
+    const vec3f& pos, int k, float max_distance = flt_max);
+
 // BVH data for whole shapes. This interface makes copies of all the data.
 struct bvh_shape {
   // elements
@@ -443,25 +537,40 @@ bvh_intersection overlap_scene_bvh(const bvh_scene& bvh, const vec3f& pos,
 // -----------------------------------------------------------------------------
 namespace yocto::shape {
 
-// A sparse grid of cells, containing list of points. Cells are stored in
-// a dictionary to get sparsity. Helpful for nearest neighboor lookups.
+// A sparse grid of cells, containing list of points. Vertices are sorted by
+// the hash of their cell into a single array, with an offset table over the
+// hash buckets, so that the grid is compact and cheap to rebuild each frame.
+// Cells may share a bucket, so lookups check the cell of each vertex.
 struct hash_grid {
-  float                                       cell_size     = 0;
-  float                                       cell_inv_size = 0;
-  std::vector<vec3f>                          positions     = {};
-  std::unordered_map<vec3i, std::vector<int>> cells         = {};
+  float              cell_size     = 0;
+  float              cell_inv_size = 0;
+  std::vector<vec3f> positions     = {};
+  std::vector<vec3i> cells         = {};  // cell of each vertex
+  std::vector<int>   buckets       = {};  // offsets into vertices
+  std::vector<int>   vertices      = {};  // vertices sorted by bucket
 };
 
 // Create a hash_grid
-hash_grid make_hash_grid(float cell_size);
 hash_grid make_hash_grid(const std::vector<vec3f>& positions, float cell_size);
-// Inserts a point into the grid
-int insert_vertex(hash_grid& grid, const vec3f& position);
+// Rebuild the grid for new positions, reusing its memory
+void update_hash_grid(hash_grid& grid, const std::vector<vec3f>& positions);
 // Finds the nearest neighbors within a given radius
 void find_neighbors(const hash_grid& grid, std::vector<int>& neighbors,
     const vec3f& position, float max_radius);
 void find_neighbors(const hash_grid& grid, std::vector<int>& neighbors,
     int vertex, float max_radius);
+// Finds the neighbors within a given radius for many points in parallel,
+// either for the given positions or for all grid vertices.
+void find_neighbors(const hash_grid& grid,
+    std::vector<std::vector<int>>& neighbors,
+    const std::vector<vec3f>& positions, float max_radius);
+void find_neighbors(const hash_grid& grid,
+    std::vector<std::vector<int>>& neighbors, float max_radius);
+// Finds the k nearest neighbors within a given radius, sorted by distance
+void find_nearest_neighbors(const hash_grid& grid, std::vector<int>& neighbors,
+    const vec3f& position, int num_neighbors, float max_radius);
+void find_nearest_neighbors(const hash_grid& grid, std::vector<int>& neighbors,
+    int vertex, int num_neighbors, float max_radius);
 
 }  // namespace yocto::shape
 
@@ -34,6 +34,8 @@
 #include <future>
 #include <memory>
 #include <mutex>
+
+#include "yocto_shape.h"
 using namespace std::string_literals;
 
 #ifdef YOCTO_EMBREE
@@ -45,6 +47,9 @@ using namespace std::string_literals;
 // -----------------------------------------------------------------------------
 namespace yocto::trace {
 
+// Namespace aliases
+namespace shp = yocto::shape;
+
 // import math symbols for use
 using math::abs;
 using math::acos;
@@ -850,315 +855,37 @@ static bool intersect_scene_embree_bvh(const trc::scene* scene,
 }
 #endif
 
-// primitive used to sort bvh entries
-struct bvh_primitive {
-  bbox3f bbox      = invalidb3f;
-  vec3f  center    = zero3f;
-  vec2i  primitive = {0, 0};
-};
-
-// Splits a BVH node using the SAH heuristic. Returns split position and axis.
-static std::pair<int, int> split_sah(
-    std::vector<bvh_primitive>& primitives, int start, int end) {
-  // initialize split axis and position
-  auto split_axis = 0;
-  auto mid        = (start + end) / 2;
-
-  // compute primintive bounds and size
-  auto cbbox = invalidb3f;
-  for (auto i = start; i < end; i++) cbbox = merge(cbbox, primitives[i].center);
-  auto csize = cbbox.max - cbbox.min;
-  if (csize == zero3f) return {mid, split_axis};
-
-  // consider N bins, compute their cost and keep the minimum
-  const int nbins    = 16;
-  auto      middle   = 0.0f;
-  auto      min_cost = flt_max;
-  auto      area     = [](auto& b) {
-    auto size = b.max - b.min;
-    return 1e-12f + 2 * size.x * size.y + 2 * size.x * size.z +
-           2 * size.y * size.z;
-  };
-  for (auto saxis = 0; saxis < 3; saxis++) {
-    for (auto b = 1; b < nbins; b++) {
-      auto split     = cbbox.min[saxis] + b * csize[saxis] / nbins;
-      auto left_bbox = invalidb3f, right_bbox = invalidb3f;
-      auto left_nprims = 0, right_nprims = 0;
-      for (auto i = start; i < end; i++) {
-        if (primitives[i].center[saxis] < split) {
-          left_bbox = merge(left_bbox, primitives[i].bbox);
-          left_nprims += 1;
-        } else {
-          right_bbox = merge(right_bbox, primitives[i].bbox);
-          right_nprims += 1;
-        }
-      }
-      auto cost = 1 + left_nprims * area(left_bbox) / area(cbbox) +
-                  right_nprims * area(right_bbox) / area(cbbox);
-      if (cost < min_cost) {
-        min_cost   = cost;
-        middle     = split;
-        split_axis = saxis;
-      }
-    }
-  }
-  // split
-  mid = (int)(std::partition(primitives.data() + start, primitives.data() + end,
-                  [split_axis, middle](auto& primitive) {
-                    return primitive.center[split_axis] < middle;
-                  }) -
-              primitives.data());
-
-  // if we were not able to split, just break the primitives in half
-  if (mid == start || mid == end) {
-    throw std::runtime_error("bad bvh split");
-    split_axis = 0;
-    mid        = (start + end) / 2;
-  }
-
-  return {mid, split_axis};
-}
-
-// Splits a BVH node using the balance heuristic. Returns split position and
-// axis.
-static std::pair<int, int> split_balanced(
-    std::vector<bvh_primitive>& primitives, int start, int end) {
-  // initialize split axis and position
-  auto axis = 0;
-  auto mid  = (start + end) / 2;
-
-  // compute primintive bounds and size
-  auto cbbox = invalidb3f;
-  for (auto i = start; i < end; i++) cbbox = merge(cbbox, primitives[i].center);
-  auto csize = cbbox.max - cbbox.min;
-  if (csize == zero3f) return {mid, axis};
-
-  // split along largest
-  if (csize.x >= csize.y && csize.x >= csize.z) axis = 0;
-  if (csize.y >= csize.x && csize.y >= csize.z) axis = 1;
-  if (csize.z >= csize.x && csize.z >= csize.y) axis = 2;
-
-  // balanced tree split: find the largest axis of the
-  // bounding box and split along this one right in the middle
-  mid = (start + end) / 2;
-  std::nth_element(primitives.data() + start, primitives.data() + mid,
-      primitives.data() + end, [axis](auto& primitive_a, auto& primitive_b) {
-        return primitive_a.center[axis] < primitive_b.center[axis];
-      });
-
-  // if we were not able to split, just break the primitives in half
-  if (mid == start || mid == end) {
-    // throw std::runtime_error("bad bvh split");
-    mid = (start + end) / 2;
-  }
-
-  return {mid, axis};
-}
-
-// Splits a BVH node using the middle heutirtic. Returns split position and
-// axis.
-static std::pair<int, int> split_middle(
-    std::vector<bvh_primitive>& primitives, int start, int end) {
-  // initialize split axis and position
-  auto axis = 0;
-  auto mid  = (start + end) / 2;
-
-  // compute primintive bounds and size
-  auto cbbox = invalidb3f;
-  for (auto i = start; i < end; i++) cbbox = merge(cbbox, primitives[i].center);
-  auto csize = cbbox.max - cbbox.min;
-  if (csize == zero3f) return {mid, axis};
+// Build BVH nodes with the shape bvh builder, mapping its primitive indices
+// to the trace primitives, given as element and type or object and instance.
+static void build_bvh(bvh_tree* bvh, const std::vector<bbox3f>& bboxes,
+    const std::vector<vec2i>& primitives, const trace_params& params) {
+  // pick split heuristic
+  auto split = shp::bvh_split::sah;
+  if (params.bvh == bvh_type::middle) split = shp::bvh_split::middle;
+  if (params.bvh == bvh_type::balanced) split = shp::bvh_split::balanced;
 
-  // split along largest
-  if (csize.x >= csize.y && csize.x >= csize.z) axis = 0;
-  if (csize.y >= csize.x && csize.y >= csize.z) axis = 1;
-  if (csize.z >= csize.x && csize.z >= csize.y) axis = 2;
-
-  // split the space in the middle along the largest axis
-  mid = (int)(std::partition(primitives.data() + start, primitives.data() + end,
-                  [axis, middle = center(cbbox)[axis]](auto& primitive) {
-                    return primitive.center[axis] < middle;
-                  }) -
-              primitives.data());
-
-  // if we were not able to split, just break the primitives in half
-  if (mid == start || mid == end) {
-    // throw std::runtime_error("bad bvh split");
-    mid = (start + end) / 2;
-  }
-
-  return {mid, axis};
-}
-
-// Split bvh nodes according to a type
-static std::pair<int, int> split_nodes(
-    std::vector<bvh_primitive>& primitives, int start, int end, bvh_type type) {
-  switch (type) {
-    case bvh_type::default_: return split_middle(primitives, start, end);
-    case bvh_type::highquality: return split_sah(primitives, start, end);
-    case bvh_type::middle: return split_middle(primitives, start, end);
-    case bvh_type::balanced: return split_balanced(primitives, start, end);
-    default: throw std::runtime_error("should not have gotten here");
-  }
-}
-
-// Maximum number of primitives per BVH node.
-const int bvh_max_prims = 4;
-
-// Build BVH nodes
-static void build_bvh_serial(std::vector<bvh_node>& nodes,
-    std::vector<bvh_primitive>& primitives, bvh_type type) {
-  // prepare to build nodes
-  nodes.clear();
-  nodes.reserve(primitives.size() * 2);
-
-  // queue up first node
-  auto queue = std::deque<vec3i>{{0, 0, (int)primitives.size()}};
-  nodes.emplace_back();
+  // build nodes
+  auto sbvh = shp::bvh_tree{};
+  shp::make_bvh(sbvh, bboxes, split, params.noparallel);
 
-  // create nodes until the queue is empty
-  while (!queue.empty()) {
-    // grab node to work on
-    auto next = queue.front();
-    queue.pop_front();
-    auto nodeid = next.x, start = next.y, end = next.z;
+  // copy nodes and primitives
+  bvh->nodes.resize(sbvh.nodes.size());
+  for (auto idx = 0; idx < sbvh.nodes.size(); idx++) {
+    auto& snode = sbvh.nodes[idx];
+    auto& node  = bvh->nodes[idx];
 
-    // grab node
-    auto& node = nodes[nodeid];
-
-    // compute bounds
-    node.bbox = invalidb3f;
-    for (auto i = start; i < end; i++)
-      node.bbox = merge(node.bbox, primitives[i].bbox);
-
-    // split into two children
-    if (end - start > bvh_max_prims) {
-      // get split
-      auto [mid, axis] = split_nodes(primitives, start, end, type);
-
-      // make an internal node
-      node.internal = true;
-      node.axis     = axis;
-      node.num      = 2;
-      node.start    = (int)nodes.size();
-      nodes.emplace_back();
-      nodes.emplace_back();
-      queue.push_back({node.start + 0, start, mid});
-      queue.push_back({node.start + 1, mid, end});
-    } else {
-      // Make a leaf node
-      node.internal = false;
-      node.num      = end - start;
-      node.start    = start;
-    }
+    node.bbox     = snode.bbox;
+    node.start    = snode.start;
+    node.num      = snode.num;
+    node.internal = snode.internal;
+    node.axis     = snode.axis;
   }
-
-  // cleanup
-  nodes.shrink_to_fit();
-}
-
-#if 0
-
-// Build BVH nodes
-static void build_bvh_parallel(
-    const shared_ptr<bvh_tree>& bvh, std::vector<bbox3f>& bboxes, bvh_type type) {
-  // get values
-  auto& nodes      = bvh->nodes;
-  auto& primitives = bvh->primitives;
-
-  // prepare to build nodes
-  nodes.clear();
-  nodes.reserve(bboxes.size() * 2);
-
-  // prepare primitives
-  bvh->primitives.resize(bboxes.size());
-  for (auto idx = 0; idx < bboxes.size(); idx++) bvh->primitives[idx] = idx;
-
-  // prepare centers
-  auto centers = std::vector<vec3f>(bboxes.size());
-  for (auto idx = 0; idx < bboxes.size(); idx++)
-    centers[idx] = center(bboxes[idx]);
-
-  // queue up first node
-  auto queue = std::deque<vec3i>{{0, 0, (int)primitives.size()}};
-  nodes.emplace_back();
-
-  // synchronization
-  std::atomic<int>          num_processed_prims(0);
-  std::mutex                queue_mutex;
-  std::vector<std::future<void>> futures;
-  auto                      nthreads = std::thread::hardware_concurrency();
-
-  // create nodes until the queue is empty
-  for (auto thread_id = 0; thread_id < nthreads; thread_id++) {
-    futures.emplace_back(std::async(
-        std::launch::async, [&nodes, &primitives, &bboxes, &centers, &type,
-                                &num_processed_prims, &queue_mutex, &queue] {
-          while (true) {
-            // exit if needed
-            if (num_processed_prims >= primitives.size()) return;
-
-            // grab node to work on
-            auto next = zero3i;
-            {
-              std::lock_guard<std::mutex> lock{queue_mutex};
-              if (!queue.empty()) {
-                next = queue.front();
-                queue.pop_front();
-              }
-            }
-
-            // wait a bit if needed
-            if (next == zero3i) {
-              std::this_thread::sleep_for(std::chrono::microseconds(10));
-              continue;
-            }
-
-            // grab node
-            auto  nodeid = next.x, start = next.y, end = next.z;
-            auto& node = nodes[nodeid];
-
-            // compute bounds
-            node.bbox = invalidb3f;
-            for (auto i = start; i < end; i++)
-              node.bbox = merge(node.bbox, bboxes[primitives[i]]);
-
-            // split into two children
-            if (end - start > bvh_max_prims) {
-              // get split
-              auto [mid, axis] = split_nodes(
-                  primitives, bboxes, centers, start, end, type);
-
-              // make an internal node
-              {
-                std::lock_guard<std::mutex> lock{queue_mutex};
-                node.internal = true;
-                node.axis     = axis;
-                node.num      = 2;
-                node.start    = (int)nodes.size();
-                nodes.emplace_back();
-                nodes.emplace_back();
-                queue.push_back({node.start + 0, start, mid});
-                queue.push_back({node.start + 1, mid, end});
-              }
-            } else {
-              // Make a leaf node
-              node.internal = false;
-              node.num      = end - start;
-              node.start    = start;
-              num_processed_prims += node.num;
-            }
-          }
-        }));
+  bvh->primitives.resize(sbvh.primitives.size());
+  for (auto idx = 0; idx < sbvh.primitives.size(); idx++) {
+    bvh->primitives[idx] = primitives[sbvh.primitives[idx]];
   }
-  for (auto& f : futures) f.get();
-
-  // cleanup
-  nodes.shrink_to_fit();
 }
 
-#endif
-
 // Update bvh
 static void update_bvh(bvh_tree* bvh, const std::vector<bbox3f>& bboxes) {
   for (auto nodeid = (int)bvh->nodes.size() - 1; nodeid >= 0; nodeid--) {
@@ -1187,54 +914,41 @@ static void init_bvh(trc::shape* shape, const trace_params& params) {
 #endif
 
   // build primitives
-  auto primitives = std::vector<bvh_primitive>{};
+  auto bboxes     = std::vector<bbox3f>{};
+  auto primitives = std::vector<vec2i>{};
   if (!shape->points.empty()) {
     for (auto idx = 0; idx < shape->points.size(); idx++) {
-      auto& p             = shape->points[idx];
-      auto& primitive     = primitives.emplace_back();
-      primitive.bbox      = point_bounds(shape->positions[p], shape->radius[p]);
-      primitive.center    = center(primitive.bbox);
-      primitive.primitive = {idx, 0};
+      auto& p = shape->points[idx];
+      bboxes.push_back(point_bounds(shape->positions[p], shape->radius[p]));
+      primitives.push_back({idx, 0});
     }
   } else if (!shape->lines.empty()) {
     for (auto idx = 0; idx < shape->lines.size(); idx++) {
-      auto& l         = shape->lines[idx];
-      auto& primitive = primitives.emplace_back();
-      primitive.bbox = line_bounds(shape->positions[l.x], shape->positions[l.y],
-          shape->radius[l.x], shape->radius[l.y]);
-      primitive.center    = center(primitive.bbox);
-      primitive.primitive = {idx, 1};
+      auto& l = shape->lines[idx];
+      bboxes.push_back(line_bounds(shape->positions[l.x],
+          shape->positions[l.y], shape->radius[l.x], shape->radius[l.y]));
+      primitives.push_back({idx, 1});
     }
   } else if (!shape->triangles.empty()) {
     for (auto idx = 0; idx < shape->triangles.size(); idx++) {
-      auto& primitive = primitives.emplace_back();
-      auto& t         = shape->triangles[idx];
-      primitive.bbox  = triangle_bounds(
-          shape->positions[t.x], shape->positions[t.y], shape->positions[t.z]);
-      primitive.center    = center(primitive.bbox);
-      primitive.primitive = {idx, 2};
+      auto& t = shape->triangles[idx];
+      bboxes.push_back(triangle_bounds(
+          shape->positions[t.x], shape->positions[t.y], shape->positions[t.z]));
+      primitives.push_back({idx, 2});
     }
   } else if (!shape->quads.empty()) {
     for (auto idx = 0; idx < shape->quads.size(); idx++) {
-      auto& q         = shape->quads[idx];
-      auto& primitive = primitives.emplace_back();
-      primitive.bbox = quad_bounds(shape->positions[q.x], shape->positions[q.y],
-          shape->positions[q.z], shape->positions[q.w]);
-      primitive.center    = center(primitive.bbox);
-      primitive.primitive = {idx, 3};
+      auto& q = shape->quads[idx];
+      bboxes.push_back(quad_bounds(shape->positions[q.x],
+          shape->positions[q.y], shape->positions[q.z], shape->positions[q.w]));
+      primitives.push_back({idx, 3});
     }
   }
 
   // build nodes
   if (shape->bvh) delete shape->bvh;
   shape->bvh = new bvh_tree{};
-  build_bvh_serial(shape->bvh->nodes, primitives, params.bvh);
-
-  // set bvh primitives
-  shape->bvh->primitives.reserve(primitives.size());
-  for (auto& primitive : primitives) {
-    shape->bvh->primitives.push_back(primitive.primitive);
-  }
+  build_bvh(shape->bvh, bboxes, primitives, params);
 }
 
 void init_bvh(trc::scene* scene, const trace_params& params,
@@ -1261,19 +975,17 @@ void init_bvh(trc::scene* scene, const trace_params& params,
   if (progress_cb) progress_cb("build scene bvh", progress.x++, progress.y);
 
   // instance bboxes
-  auto primitives            = std::vector<bvh_primitive>{};
-  auto object_id             = 0;
-  auto empty_instance_frames = std::vector<frame3f>{identity3x4f};
+  auto bboxes     = std::vector<bbox3f>{};
+  auto primitives = std::vector<vec2i>{};
+  auto object_id  = 0;
   for (auto object : scene->objects) {
     auto instance_id = 0;
     for (auto& frame : object->instance->frames) {
-      auto& primitive = primitives.emplace_back();
-      primitive.bbox  = object->shape->bvh->nodes.empty()
+      bboxes.push_back(object->shape->bvh->nodes.empty()
                            ? invalidb3f
                            : transform_bbox(frame * object->frame,
-                                 object->shape->bvh->nodes[0].bbox);
-      primitive.center    = center(primitive.bbox);
-      primitive.primitive = {object_id, instance_id};
+                                 object->shape->bvh->nodes[0].bbox));
+      primitives.push_back({object_id, instance_id});
       instance_id += 1;
     }
     object_id += 1;
@@ -1282,13 +994,7 @@ void init_bvh(trc::scene* scene, const trace_params& params,
   // build nodes
   if (scene->bvh) delete scene->bvh;
   scene->bvh = new bvh_tree{};
-  build_bvh_serial(scene->bvh->nodes, primitives, params.bvh);
-
-  // set bvh primitives
-  scene->bvh->primitives.reserve(primitives.size());
-  for (auto& primitive : primitives) {
-    scene->bvh->primitives.push_back(primitive.primitive);
-  }
+  build_bvh(scene->bvh, bboxes, primitives, params);
 
   // handle progress
   if (progress_cb) progress_cb("build bvh", progress.x++, progress.y);
@@ -2564,61 +2270,103 @@ void set_focus(trc::camera* camera, float aperture, float focus) {
 
 // Add texture
 void set_texture(trc::texture* texture, const img::image<vec3b>& img) {
-  texture->colorb  = img;
+  set_texture(texture, img::image<vec3b>{img});
+}
+void set_texture(trc::texture* texture, img::image<vec3b>&& img) {
+  texture->colorb  = std::move(img);
   texture->colorf  = {};
   texture->scalarb = {};
   texture->scalarf = {};
 }
 void set_texture(trc::texture* texture, const img::image<vec3f>& img) {
+  set_texture(texture, img::image<vec3f>{img});
+}
+void set_texture(trc::texture* texture, img::image<vec3f>&& img) {
   texture->colorb  = {};
-  texture->colorf  = img;
+  texture->colorf  = std::move(img);
   texture->scalarb = {};
   texture->scalarf = {};
 }
 void set_texture(trc::texture* texture, const img::image<byte>& img) {
+  set_texture(texture, img::image<byte>{img});
+}
+void set_texture(trc::texture* texture, img::image<byte>&& img) {
   texture->colorb  = {};
   texture->colorf  = {};
-  texture->scalarb = img;
+  texture->scalarb = std::move(img);
   texture->scalarf = {};
 }
 void set_texture(trc::texture* texture, const img::image<float>& img) {
+  set_texture(texture, img::image<float>{img});
+}
+void set_texture(trc::texture* texture, img::image<float>&& img) {
   texture->colorb  = {};
   texture->colorf  = {};
   texture->scalarb = {};
-  texture->scalarf = img;
+  texture->scalarf = std::move(img);
 }
 
 // Add shape
 void set_points(trc::shape* shape, const std::vector<int>& points) {
   shape->points = points;
 }
+void set_points(trc::shape* shape, std::vector<int>&& points) {
+  shape->points = std::move(points);
+}
 void set_lines(trc::shape* shape, const std::vector<vec2i>& lines) {
   shape->lines = lines;
 }
+void set_lines(trc::shape* shape, std::vector<vec2i>&& lines) {
+  shape->lines = std::move(lines);
+}
 void set_triangles(trc::shape* shape, const std::vector<vec3i>& triangles) {
   shape->triangles = triangles;
 }
+void set_triangles(trc::shape* shape, std::vector<vec3i>&& triangles) {
+  shape->triangles = std::move(triangles);
+}
 void set_quads(trc::shape* shape, const std::vector<vec4i>& quads) {
   shape->quads = quads;
 }
+void set_quads(trc::shape* shape, std::vector<vec4i>&& quads) {
+  shape->quads = std::move(quads);
+}
 void set_positions(trc::shape* shape, const std::vector<vec3f>& positions) {
   shape->positions = positions;
 }
+void set_positions(trc::shape* shape, std::vector<vec3f>&& positions) {
+  shape->positions = std::move(positions);
+}
 void set_normals(trc::shape* shape, const std::vector<vec3f>& normals) {
   shape->normals = normals;
 }
+void set_normals(trc::shape* shape, std::vector<vec3f>&& normals) {
+  shape->normals = std::move(normals);
+}
 void set_texcoords(trc::shape* shape, const std::vector<vec2f>& texcoords) {
   shape->texcoords = texcoords;
 }
+void set_texcoords(trc::shape* shape, std::vector<vec2f>&& texcoords) {
+  shape->texcoords = std::move(texcoords);
+}
 void set_colors(trc::shape* shape, const std::vector<vec3f>& colors) {
   shape->colors = colors;
 }
+void set_colors(trc::shape* shape, std::vector<vec3f>&& colors) {
+  shape->colors = std::move(colors);
+}
 void set_radius(trc::shape* shape, const std::vector<float>& radius) {
   shape->radius = radius;
 }
+void set_radius(trc::shape* shape, std::vector<float>&& radius) {
+  shape->radius = std::move(radius);
+}
 void set_tangents(trc::shape* shape, const std::vector<vec4f>& tangents) {
   shape->tangents = tangents;
 }
+void set_tangents(trc::shape* shape, std::vector<vec4f>&& tangents) {
+  shape->tangents = std::move(tangents);
+}
 
 // Add object
 void set_frame(trc::object* object, const frame3f& frame) {
@@ -144,6 +144,12 @@ void set_texture(trc::texture* texture, const img::image<vec3f>& img);
 void set_texture(trc::texture* texture, const img::image<byte>& img);
 void set_texture(trc::texture* texture, const img::image<float>& img);
 
+// texture properties, taking ownership of the image without copies
+void set_texture(trc::texture* texture, img::image<vec3b>&& img);
+void set_texture(trc::texture* texture, img::image<vec3f>&& img);
+void set_texture(trc::texture* texture, img::image<byte>&& img);
+void set_texture(trc::texture* texture, img::image<float>&& img);
+
 // material properties
 void set_emission(trc::material* material, const vec3f& emission,
     trc::texture* emission_tex = nullptr);
@@ -179,6 +185,18 @@ void set_colors(trc::shape* shape, const std::vector<vec3f>& colors);
 void set_radius(trc::shape* shape, const std::vector<float>& radius);
 void set_tangents(trc::shape* shape, const std::vector<vec4f>& tangents);
 
+// shape properties, taking ownership of the arrays without copies
+void set_points(trc::shape* shape, std::vector<int>&& points);
+void set_lines(trc::shape* shape, std::vector<vec2i>&& lines);
+void set_triangles(trc::shape* shape, std::vector<vec3i>&& triangles);
+void set_quads(trc::shape* shape, std::vector<vec4i>&& quads);
+void set_positions(trc::shape* shape, std::vector<vec3f>&& positions);
+void set_normals(trc::shape* shape, std::vector<vec3f>&& normals);
+void set_texcoords(trc::shape* shape, std::vector<vec2f>&& texcoords);
+void set_colors(trc::shape* shape, std::vector<vec3f>&& colors);
+void set_radius(trc::shape* shape, std::vector<float>&& radius);
+void set_tangents(trc::shape* shape, std::vector<vec4f>&& tangents);
+
 // instance properties
 void set_frames(trc::instance* instance, const std::vector<frame3f>& frames);
 
@@ -173,6 +173,12 @@ void init_simulation(par::scene* scene, const simulation_params& params) {
       velocity += math::sample_sphere(math::rand2f(shape->emit_rng)) * shape->emit_rngscale * math::rand1f(shape->emit_rng);
     }
 
+    // initialize normal adjacency
+    if(shape->quads.size() > 0)
+      shape->adjacency = yocto::shape::make_vertex_faces(shape->quads, (int)shape->positions.size());
+    else
+      shape->adjacency = yocto::shape::make_vertex_faces(shape->triangles, (int)shape->positions.size());
+
     // clear springs array
     shape->springs.clear();
 
@@ -303,10 +309,11 @@ void simulate_massspring(par::scene* scene, const simulation_params& params) {
 
   // RECOMPUTE NORMALS
   for (auto& shape : scene->shapes) {
+    shape->normals.resize(shape->positions.size());
     if(shape->quads.size() > 0)
-      shape->normals = yocto::shape::compute_normals(shape->quads, shape->positions);
+      yocto::shape::update_normals(shape->normals, shape->adjacency, shape->quads, shape->positions);
     else
-      shape->normals = yocto::shape::compute_normals(shape->triangles, shape->positions);
+      yocto::shape::update_normals(shape->normals, shape->adjacency, shape->triangles, shape->positions);
   }
 }
 
@@ -396,10 +403,11 @@ void simulate_pbd(par::scene* scene, const simulation_params& params) {
 
   // RECOMPUTE NORMALS
   for (auto& shape : scene->shapes) {
+    shape->normals.resize(shape->positions.size());
     if(shape->quads.size() > 0)
-      shape->normals = yocto::shape::compute_normals(shape->quads, shape->positions);
+      yocto::shape::update_normals(shape->normals, shape->adjacency, shape->quads, shape->positions);
     else
-      shape->normals = yocto::shape::compute_normals(shape->triangles, shape->positions);
+      yocto::shape::update_normals(shape->normals, shape->adjacency, shape->triangles, shape->positions);
   }
 }
 
@@ -120,6 +120,7 @@ struct shape {
   std::vector<spring>    springs       = {};
   std::vector<float>     lambdas       = {};
   std::vector<collision> collisions    = {};
+  shp::vertex_faces      adjacency     = {};
 
   // initial configuration to reply animation
   std::vector<vec3f> initial_positions  = {};
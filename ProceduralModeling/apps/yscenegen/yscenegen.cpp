@@ -99,22 +99,15 @@ void sample_shape(std::vector<vec3f>& positions, std::vector<vec3f>& normals,
   auto triangles  = shape->triangles;
   auto qtriangles = shp::quads_to_triangles(shape->quads);
   triangles.insert(triangles.end(), qtriangles.begin(), qtriangles.end());
-  auto cdf = shp::sample_triangles_cdf(triangles, shape->positions);
-  auto rng = make_rng(19873991);
-  for (auto idx = 0; idx < num; idx++) {
-    auto [elem, uv] = shp::sample_triangles(cdf, rand1f(rng), rand2f(rng));
-    auto q          = triangles[elem];
-    positions.push_back(interpolate_triangle(shape->positions[q.x],
-        shape->positions[q.y], shape->positions[q.z], uv));
-    normals.push_back(normalize(interpolate_triangle(
-        shape->normals[q.x], shape->normals[q.y], shape->normals[q.z], uv)));
-    if (!texcoords.empty()) {
-      texcoords.push_back(interpolate_triangle(shape->texcoords[q.x],
-          shape->texcoords[q.y], shape->texcoords[q.z], uv));
-    } else {
-      texcoords.push_back(uv);
-    }
-  }
+  auto spositions = std::vector<vec3f>{};
+  auto snormals   = std::vector<vec3f>{};
+  auto stexcoords = std::vector<vec2f>{};
+  shp::sample_triangles(spositions, snormals, stexcoords, triangles,
+      shape->positions, shape->normals, shape->texcoords, num, 19873991);
+  positions.insert(positions.end(), spositions.begin(), spositions.end());
+  normals.insert(normals.end(), snormals.begin(), snormals.end());
+  if (!texcoords.empty())
+    texcoords.insert(texcoords.end(), stexcoords.begin(), stexcoords.end());
 }
 
 struct terrain_params {
@@ -143,7 +136,10 @@ void make_terrain(
       object->shape->positions[i] = position;
   }
   // update shape normals
-  yocto::shape::update_normals(object->shape->normals, object->shape->quads, object->shape->positions);
+  auto adjacency = yocto::shape::make_vertex_faces(
+      object->shape->quads, (int)object->shape->positions.size());
+  yocto::shape::update_normals(object->shape->normals, adjacency,
+      object->shape->quads, object->shape->positions);
 }
 
 struct displacement_params {
@@ -167,7 +163,10 @@ void make_displacement(
         object->shape->positions[i] = position;
     }
     // update shape normals
-    yocto::shape::update_normals(object->shape->normals, object->shape->quads, object->shape->positions);
+    auto adjacency = yocto::shape::make_vertex_faces(
+        object->shape->quads, (int)object->shape->positions.size());
+    yocto::shape::update_normals(object->shape->normals, adjacency,
+        object->shape->quads, object->shape->positions);
 }
 
 struct hair_params {
@@ -46,7 +46,8 @@ namespace sfs = ghc::filesystem;
 
 // construct a scene from io
 void init_scene(trc::scene* scene, sio::model* ioscene, trc::camera*& camera,
-    sio::camera* iocamera, sio::progress_callback progress_cb = {}) {
+    sio::camera* iocamera, const sio::tesselation_params& tparams = {},
+    sio::progress_callback progress_cb = {}) {
   // handle progress
   auto progress = vec2i{
       0, (int)ioscene->cameras.size() + (int)ioscene->environments.size() +
@@ -112,7 +113,7 @@ void init_scene(trc::scene* scene, sio::model* ioscene, trc::camera*& camera,
 
   for (auto iosubdiv : ioscene->subdivs) {
     if (progress_cb) progress_cb("convert subdiv", progress.x++, progress.y);
-    tesselate_subdiv(ioscene, iosubdiv);
+    tesselate_subdiv(ioscene, iosubdiv, tparams);
   }
 
   auto shape_map     = std::unordered_map<sio::shape*, trc::shape*>{};
@@ -170,6 +171,8 @@ void init_scene(trc::scene* scene, sio::model* ioscene, trc::camera*& camera,
 int main(int argc, const char* argv[]) {
   // options
   auto params      = trc::trace_params{};
+  auto tparams     = sio::tesselation_params{};
+  auto tpixels     = 0.0f;
   auto save_batch  = false;
   auto add_skyenv  = false;
   auto camera_name = ""s;
@@ -193,6 +196,8 @@ int main(int argc, const char* argv[]) {
   add_option(cli, "--save-batch", save_batch, "Save images progressively");
   add_option(cli, "--bvh", params.bvh, "Bvh type", trc::bvh_names);
   add_option(cli, "--skyenv/--no-skyenv", add_skyenv, "Add sky envmap");
+  add_option(cli, "--tesselation-pixels", tpixels,
+      "Displacement edge length in pixels (0 for uniform tesselation).");
   add_option(cli, "--output-image,-o", imfilename, "Image filename");
   add_option(cli, "scene", filename, "Scene filename", true);
   parse_cli(cli, argc, argv);
@@ -210,11 +215,19 @@ int main(int argc, const char* argv[]) {
   // get camera
   auto iocamera = get_camera(ioscene, camera_name);
 
+  // tesselate subdivs from the camera
+  if (tpixels) {
+    tparams.camera      = iocamera;
+    tparams.resolution  = params.resolution;
+    tparams.edge_pixels = tpixels;
+  }
+
   // convert scene
   auto scene_guard = std::make_unique<trc::scene>();
   auto scene       = scene_guard.get();
   auto camera      = (trc::camera*)nullptr;
-  init_scene(scene, ioscene, camera, iocamera, cli::print_progress);
+  init_scene(
+      scene, ioscene, camera, iocamera, tparams, cli::print_progress);
 
   // cleanup
   if (ioscene_guard) ioscene_guard.reset();
@@ -47,6 +47,7 @@
 #include <deque>
 #include <future>
 #include <memory>
+#include <thread>
 
 #include "ext/filesystem.hpp"
 #include "ext/json.hpp"
@@ -90,6 +91,26 @@ using math::sqrt;
 using math::tan;
 using math::uint;
 
+// Simple parallel for used since our target platforms do not yet support
+// parallel algorithms. `Func` takes the integer index.
+template <typename Func>
+inline void parallel_for(int size, Func&& func) {
+  auto             futures  = std::vector<std::future<void>>{};
+  auto             nthreads = std::thread::hardware_concurrency();
+  std::atomic<int> next_idx(0);
+  for (auto thread_id = 0; thread_id < nthreads; thread_id++) {
+    futures.emplace_back(
+        std::async(std::launch::async, [&func, &next_idx, size]() {
+          while (true) {
+            auto idx = next_idx.fetch_add(1);
+            if (idx >= size) break;
+            func(idx);
+          }
+        }));
+  }
+  for (auto& f : futures) f.get();
+}
+
 }  // namespace yocto::sceneio
 
 // -----------------------------------------------------------------------------
@@ -612,9 +633,7 @@ std::unique_ptr<subdiv> subdivide_subdiv(
   std::tie(tesselated->quadstexcoord, tesselated->texcoords) =
       yshp::subdivide_catmullclark(
           tesselated->quadstexcoord, tesselated->texcoords, subdivisions, true);
-  std::tie(tesselated->quadsnorm, tesselated->normals) =
-      yshp::subdivide_catmullclark(
-          tesselated->quadsnorm, tesselated->normals, subdivisions, true);
+  // subdivided normals would be replaced below, so they are not subdivided
   std::tie(tesselated->quadspos, tesselated->positions) =
       yshp::subdivide_catmullclark(
           tesselated->quadspos, tesselated->positions, subdivisions);
@@ -692,7 +711,356 @@ void tesselate_subdiv(scn::model* scene, scn::subdiv* subdiv) {
   shape->radius    = {};
 }
 
+// Bilinear interpolation of the quad corners, without splitting into triangles.
+template <typename T>
+static T interpolate_bilinear(
+    const T& p0, const T& p1, const T& p2, const T& p3, const vec2f& uv) {
+  return p0 * ((1 - uv.x) * (1 - uv.y)) + p1 * (uv.x * (1 - uv.y)) +
+         p2 * (uv.x * uv.y) + p3 * ((1 - uv.x) * uv.y);
+}
+
+// Projected length in pixels of a segment, taking the largest over all frames.
+static float eval_edge_pixels(const tesselation_params& params,
+    const std::vector<frame3f>& frames, const vec3f& p0, const vec3f& p1) {
+  auto camera = params.camera;
+  auto pixel  = camera->film / (camera->lens * params.resolution);
+  auto length = 0.0f;
+  for (auto& frame : frames) {
+    auto q0 = transform_point(frame, p0), q1 = transform_point(frame, p1);
+    auto size = pixel;
+    if (!camera->orthographic)
+      size *= max(distance(camera->frame.o, (q0 + q1) / 2), camera->lens);
+    length = max(length, distance(q0, q1) / size);
+  }
+  return length;
+}
+
+// Dice each quad patch into triangles, with the number of segments of each
+// edge given by `rates`. Corners and edge vertices are shared by adjacent
+// patches, so patches with the same edge rates match exactly. Each patch
+// owns its interior grid, which is stitched to the boundary with triangle
+// strips, and its texture coordinates. Triangles are stored as degenerate
+// quads. Displacement is applied along the interpolated normals, averaging
+// the displacement of vertices shared by patches as in `displace_subdiv()`.
+static std::unique_ptr<subdiv> dice_subdiv(scn::subdiv* subdiv,
+    const yshp::edge_map& emap, const std::vector<int>& rates,
+    float displacement, scn::texture* displacement_tex, bool smooth) {
+  auto& quads   = subdiv->quadspos;
+  auto& tquads  = subdiv->quadstexcoord;
+  auto  normals = compute_normals(subdiv->quadspos, subdiv->positions);
+
+  // edge vertices, stored from the smaller to the larger vertex index
+  auto edges      = yshp::get_edges(emap);
+  auto edge_start = std::vector<int>(edges.size() + 1);
+  edge_start[0]   = (int)subdiv->positions.size();
+  for (auto idx = 0; idx < edges.size(); idx++)
+    edge_start[idx + 1] = edge_start[idx] + rates[idx] - 1;
+
+  // patch rates and storage offsets
+  auto patch_rates = std::vector<vec4i>(quads.size());
+  auto vert_start  = std::vector<int>(quads.size() + 1);
+  auto tvert_start = std::vector<int>(quads.size() + 1);
+  auto tri_start   = std::vector<int>(quads.size() + 1);
+  vert_start[0] = edge_start.back(), tvert_start[0] = 0, tri_start[0] = 0;
+  for (auto fid = 0; fid < quads.size(); fid++) {
+    auto& q = quads[fid];
+    auto& r = patch_rates[fid];
+    for (auto side = 0; side < 4; side++) {
+      auto eid = yshp::edge_index(emap, {q[side], q[(side + 1) % 4]});
+      r[side]  = eid < 0 ? 1 : rates[eid];
+    }
+    auto nu = max(r.x, r.z), nv = max(r.y, r.w);
+    auto ninterior  = (nu - 1) * (nv - 1);
+    auto ntriangles = 0;
+    if (nv == 1) {
+      ntriangles = r.x + r.z;
+    } else if (nu == 1) {
+      ntriangles = r.y + r.w;
+    } else {
+      ntriangles = 2 * (nu - 2) * (nv - 2) + r.x + r.y + r.z + r.w +
+                   2 * (nu - 2) + 2 * (nv - 2);
+    }
+    vert_start[fid + 1]  = vert_start[fid] + ninterior;
+    tvert_start[fid + 1] = tvert_start[fid] + r.x + r.y + r.z + r.w +
+                           ninterior;
+    tri_start[fid + 1]   = tri_start[fid] + ntriangles;
+  }
+
+  auto diced           = std::make_unique<scn::subdiv>();
+  auto vnormals        = std::vector<vec3f>(vert_start.back());
+  auto tdisp           = std::vector<float>(tvert_start.back());
+  auto tvert_to_vert   = std::vector<int>(tvert_start.back());
+  diced->positions     = std::vector<vec3f>(vert_start.back());
+  diced->texcoords     = std::vector<vec2f>(tvert_start.back());
+  diced->quadspos      = std::vector<vec4i>(tri_start.back());
+  diced->quadstexcoord = std::vector<vec4i>(tri_start.back());
+
+  // corners and edge vertices
+  for (auto vid = 0; vid < subdiv->positions.size(); vid++) {
+    diced->positions[vid] = subdiv->positions[vid];
+    vnormals[vid]         = normals[vid];
+  }
+  parallel_for((int)edges.size(), [&](int eid) {
+    auto [a, b] = edges[eid];
+    for (auto k = 1; k < rates[eid]; k++) {
+      auto t   = (float)k / rates[eid];
+      auto vid = edge_start[eid] + k - 1;
+      diced->positions[vid] = lerp(
+          subdiv->positions[a], subdiv->positions[b], t);
+      vnormals[vid] = normalize(lerp(normals[a], normals[b], t));
+    }
+  });
+
+  // patches
+  auto block_size = 256;
+  auto nblocks    = ((int)quads.size() + block_size - 1) / block_size;
+  parallel_for(nblocks, [&](int block) {
+    // local vertices are the boundary ring followed by the interior grid
+    auto lverts  = std::vector<int>{};
+    auto outer   = std::vector<int>{};
+    auto inner   = std::vector<int>{};
+    auto outer_t = std::vector<float>{};
+    auto inner_t = std::vector<float>{};
+    auto end     = min((block + 1) * block_size, (int)quads.size());
+    for (auto fid = block * block_size; fid < end; fid++) {
+      auto& q     = quads[fid];
+      auto& qt    = tquads[fid];
+      auto& r     = patch_rates[fid];
+      auto  nu    = max(r.x, r.z), nv = max(r.y, r.w);
+      auto  nring = r.x + r.y + r.z + r.w;
+      auto  tvert = tvert_start[fid];
+      auto  tri   = tri_start[fid];
+
+      // local vertex positions, texcoords and displacement
+      auto add_vertex = [&](int vid, const vec2f& uv) {
+        auto tid = tvert + (int)lverts.size();
+        lverts.push_back(vid);
+        diced->texcoords[tid] = interpolate_bilinear(subdiv->texcoords[qt.x],
+            subdiv->texcoords[qt.y], subdiv->texcoords[qt.z],
+            subdiv->texcoords[qt.w], uv);
+        auto disp = mean(
+            eval_texture(displacement_tex, diced->texcoords[tid], true));
+        if (!displacement_tex->scalarb.empty() ||
+            !displacement_tex->colorb.empty())
+          disp -= 0.5f;
+        tdisp[tid]         = displacement * disp;
+        tvert_to_vert[tid] = vid;
+      };
+      lverts.clear();
+      for (auto side = 0; side < 4; side++) {
+        auto a = q[side], b = q[(side + 1) % 4];
+        auto eid = yshp::edge_index(emap, {a, b});
+        for (auto k = 0; k < r[side]; k++) {
+          auto t   = (float)k / r[side];
+          auto vid = a;
+          if (k > 0 && eid >= 0)
+            vid = edge_start[eid] + (a < b ? k : r[side] - k) - 1;
+          auto uv = side == 0   ? vec2f{t, 0}
+                    : side == 1 ? vec2f{1, t}
+                    : side == 2 ? vec2f{1 - t, 1}
+                                : vec2f{0, 1 - t};
+          add_vertex(vid, uv);
+        }
+      }
+      for (auto j = 1; j < nv; j++) {
+        for (auto i = 1; i < nu; i++) {
+          auto uv  = vec2f{(float)i / nu, (float)j / nv};
+          auto vid = vert_start[fid] + (j - 1) * (nu - 1) + (i - 1);
+          diced->positions[vid] = interpolate_bilinear(subdiv->positions[q.x],
+              subdiv->positions[q.y], subdiv->positions[q.z],
+              subdiv->positions[q.w], uv);
+          vnormals[vid] = normalize(interpolate_bilinear(normals[q.x],
+              normals[q.y], normals[q.z], normals[q.w], uv));
+          add_vertex(vid, uv);
+        }
+      }
+
+      // triangles
+      auto add_triangle = [&](int a, int b, int c) {
+        diced->quadspos[tri] = {lverts[a], lverts[b], lverts[c], lverts[c]};
+        diced->quadstexcoord[tri++] = {
+            tvert + a, tvert + b, tvert + c, tvert + c};
+      };
+      auto ring = [&](int idx) { return idx % nring; };
+      auto grid = [&](int i, int j) {
+        return nring + (j - 1) * (nu - 1) + (i - 1);
+      };
+      auto add_outer = [&](int side, bool reversed) {
+        auto start = 0;
+        for (auto s = 0; s < side; s++) start += r[s];
+        outer.clear();
+        outer_t.clear();
+        for (auto k = 0; k <= r[side]; k++) {
+          auto kk = reversed ? r[side] - k : k;
+          outer.push_back(ring(start + kk));
+          outer_t.push_back((float)k / r[side]);
+        }
+      };
+      auto add_inner = [&](int side) {
+        inner.clear();
+        inner_t.clear();
+        auto count = (side % 2 == 0) ? nu - 1 : nv - 1;
+        for (auto k = 1; k <= count; k++) {
+          auto kk = side >= 2 ? count + 1 - k : k;
+          if (side == 0) inner.push_back(grid(kk, 1));
+          if (side == 1) inner.push_back(grid(nu - 1, kk));
+          if (side == 2) inner.push_back(grid(kk, nv - 1));
+          if (side == 3) inner.push_back(grid(1, kk));
+          inner_t.push_back((float)k / (count + 1));
+        }
+      };
+      // stitch two polylines with a strip of triangles, advancing along the
+      // one whose next vertex comes first; `flip` swaps the orientation
+      auto stitch = [&](const std::vector<int>& a, const std::vector<float>& ta,
+                        const std::vector<int>& b, const std::vector<float>& tb,
+                        bool flip) {
+        auto i = 0, j = 0;
+        auto m = (int)a.size() - 1, n = (int)b.size() - 1;
+        while (i < m || j < n) {
+          if (j == n || (i < m && ta[i + 1] <= tb[j + 1])) {
+            if (flip) add_triangle(a[i], b[j], a[i + 1]);
+            else add_triangle(a[i], a[i + 1], b[j]);
+            i++;
+          } else {
+            if (flip) add_triangle(a[i], b[j], b[j + 1]);
+            else add_triangle(a[i], b[j + 1], b[j]);
+            j++;
+          }
+        }
+      };
+      if (nv == 1) {
+        add_outer(0, false);
+        inner = outer, inner_t = outer_t;
+        add_outer(2, true);
+        std::swap(inner, outer);
+        std::swap(inner_t, outer_t);
+        stitch(outer, outer_t, inner, inner_t, false);
+      } else if (nu == 1) {
+        add_outer(3, true);
+        inner = outer, inner_t = outer_t;
+        add_outer(1, false);
+        std::swap(inner, outer);
+        std::swap(inner_t, outer_t);
+        stitch(outer, outer_t, inner, inner_t, true);
+      } else {
+        for (auto side = 0; side < 4; side++) {
+          add_outer(side, false);
+          add_inner(side);
+          stitch(outer, outer_t, inner, inner_t, false);
+        }
+        for (auto j = 1; j < nv - 1; j++) {
+          for (auto i = 1; i < nu - 1; i++) {
+            add_triangle(grid(i, j), grid(i + 1, j), grid(i + 1, j + 1));
+            add_triangle(grid(i, j), grid(i + 1, j + 1), grid(i, j + 1));
+          }
+        }
+      }
+    }
+  });
+
+  // remove triangles collapsed by degenerate patches
+  auto ntriangles = 0;
+  for (auto idx = 0; idx < diced->quadspos.size(); idx++) {
+    auto& t = diced->quadspos[idx];
+    if (t.x == t.y || t.y == t.z || t.z == t.x) continue;
+    diced->quadspos[ntriangles]        = diced->quadspos[idx];
+    diced->quadstexcoord[ntriangles++] = diced->quadstexcoord[idx];
+  }
+  diced->quadspos.resize(ntriangles);
+  diced->quadstexcoord.resize(ntriangles);
+
+  // displacement
+  auto offset = std::vector<float>(diced->positions.size(), 0);
+  auto count  = std::vector<int>(diced->positions.size(), 0);
+  for (auto tid = 0; tid < tdisp.size(); tid++) {
+    offset[tvert_to_vert[tid]] += tdisp[tid];
+    count[tvert_to_vert[tid]] += 1;
+  }
+  for (auto vid = 0; vid < diced->positions.size(); vid++) {
+    if (count[vid])
+      diced->positions[vid] += vnormals[vid] * offset[vid] / count[vid];
+  }
+  if (smooth || !subdiv->normals.empty()) {
+    diced->quadsnorm = diced->quadspos;
+    diced->normals   = compute_normals(diced->quadspos, diced->positions);
+  }
+
+  return diced;
+}
+
+void tesselate_subdiv(scn::model* scene, scn::subdiv* subdiv,
+    const tesselation_params& params) {
+  if (!params.camera) return tesselate_subdiv(scene, subdiv);
+
+  auto material = (scn::material*)nullptr;
+  auto shape    = (scn::shape*)nullptr;
+  auto frames   = std::vector<frame3f>{};
+  for (auto object : scene->objects) {
+    if (object->subdiv != subdiv) continue;
+    if (!material) {
+      material = object->material;
+      shape    = object->shape;
+    }
+    if (object->instance) {
+      for (auto& frame : object->instance->frames)
+        frames.push_back(frame * object->frame);
+    } else {
+      frames.push_back(object->frame);
+    }
+  }
+
+  // pick the level from the largest control edge on screen; displaced
+  // surfaces stop at patches that are diced below
+  auto displaced = material->displacement && material->displacement_tex;
+  auto max_pixels = 0.0f;
+  for (auto& q : subdiv->quadspos) {
+    for (auto side = 0; side < 4; side++) {
+      max_pixels = max(max_pixels,
+          eval_edge_pixels(params, frames, subdiv->positions[q[side]],
+              subdiv->positions[q[(side + 1) % 4]]));
+    }
+  }
+  auto target = displaced ? params.patch_pixels : params.edge_pixels;
+  auto level  = 0;
+  while (level < material->subdivisions && max_pixels > target) {
+    max_pixels /= 2;
+    level += 1;
+  }
+
+  auto tesselated = subdivide_subdiv(subdiv, level, material->smooth);
+  if (displaced) {
+    if (tesselated->texcoords.empty())
+      throw std::runtime_error("missing texture coordinates");
+    auto emap  = yshp::make_edge_map(tesselated->quadspos);
+    auto edges = yshp::get_edges(emap);
+    auto rates = std::vector<int>(edges.size());
+    parallel_for((int)edges.size(), [&](int eid) {
+      auto pixels = eval_edge_pixels(params, frames,
+          tesselated->positions[edges[eid].x],
+          tesselated->positions[edges[eid].y]);
+      rates[eid] = clamp(
+          (int)std::ceil(pixels / params.edge_pixels), 1, params.max_rate);
+    });
+    tesselated = dice_subdiv(tesselated.get(), emap, rates,
+        material->displacement, material->displacement_tex, material->smooth);
+  }
+  std::tie(shape->quads, shape->positions, shape->normals, shape->texcoords) =
+      split_facevarying(tesselated->quadspos, tesselated->quadsnorm,
+          tesselated->quadstexcoord, tesselated->positions,
+          tesselated->normals, tesselated->texcoords);
+  shape->points    = {};
+  shape->lines     = {};
+  shape->triangles = {};
+  shape->colors    = {};
+  shape->radius    = {};
+}
+
 void tesselate_subdivs(scn::model* scene, progress_callback progress_cb) {
+  tesselate_subdivs(scene, tesselation_params{}, progress_cb);
+}
+
+void tesselate_subdivs(scn::model* scene, const tesselation_params& params,
+    progress_callback progress_cb) {
   if (scene->subdivs.empty()) return;
 
   // handle progress
@@ -701,7 +1069,7 @@ void tesselate_subdivs(scn::model* scene, progress_callback progress_cb) {
   // tesselate subdivs
   for (auto subdiv : scene->subdivs) {
     if (progress_cb) progress_cb("tesseleate subdiv", progress.x++, progress.y);
-    tesselate_subdiv(scene, subdiv);
+    tesselate_subdiv(scene, subdiv, params);
   }
 
   // done
@@ -332,9 +332,28 @@ bbox3f compute_bounds(const scn::model* scene);
 // -----------------------------------------------------------------------------
 namespace yocto::sceneio {
 
+// Screen-space tesselation parameters. If a camera is given, the subdivision
+// level of each object is chosen from its projected size, and displaced
+// subdivs are diced into patches whose edges are about `edge_pixels` long
+// on an image of `resolution` pixels. Edge rates are shared by adjacent
+// patches, so the result is crack-free. Patches are diced at most
+// `max_rate` times per edge and the subdivision level never exceeds the
+// material one. Without a camera, subdivs are tesselated uniformly.
+struct tesselation_params {
+  const scn::camera* camera       = nullptr;
+  int                resolution   = 1280;
+  float              edge_pixels  = 1;
+  float              patch_pixels = 16;
+  int                max_rate     = 64;
+};
+
 // Apply subdivision and displacement rules.
 void tesselate_subdivs(scn::model* scene, progress_callback progress_cb = {});
 void tesselate_subdiv(scn::model* scene, scn::subdiv* subdiv);
+void tesselate_subdivs(scn::model* scene, const tesselation_params& params,
+    progress_callback progress_cb = {});
+void tesselate_subdiv(scn::model* scene, scn::subdiv* subdiv,
+    const tesselation_params& params);
 
 }  // namespace yocto::sceneio
 
@@ -10,8 +10,11 @@
 
 #include <atomic>
 #include <deque>
+#include <future>
 #include <memory>
 #include <string>
+#include <thread>
+#include <type_traits>
 using namespace std::string_literals;
 
 #include "yocto_obj.h"
@@ -55,6 +58,26 @@ using math::zero2f;
 using math::zero3f;
 using math::zero4f;
 
+// Simple parallel for used since our target platforms do not yet support
+// parallel algorithms. `Func` takes the integer index.
+template <typename Func>
+inline void parallel_for(int size, Func&& func) {
+  auto             futures  = std::vector<std::future<void>>{};
+  auto             nthreads = std::thread::hardware_concurrency();
+  std::atomic<int> next_idx(0);
+  for (auto thread_id = 0; thread_id < nthreads; thread_id++) {
+    futures.emplace_back(
+        std::async(std::launch::async, [&func, &next_idx, size]() {
+          while (true) {
+            auto idx = next_idx.fetch_add(1);
+            if (idx >= size) break;
+            func(idx);
+          }
+        }));
+  }
+  for (auto& f : futures) f.get();
+}
+
 }  // namespace yocto::shape
 
 // -----------------------------------------------------------------------------
@@ -167,6 +190,102 @@ void update_normals(std::vector<vec3f>& normals,
   for (auto& normal : normals) normal = normalize(normal);
 }
 
+// Build the faces adjacent to each vertex with a counting sort, which keeps
+// faces in order within each row.
+template <typename Face>
+static vertex_faces make_vertex_faces_impl(
+    const std::vector<Face>& elements, int num_vertices) {
+  auto adjacency   = vertex_faces{};
+  auto num_corners = [](const Face& face) {
+    if constexpr (std::is_same_v<Face, vec4i>) {
+      return face.z == face.w ? 3 : 4;
+    } else {
+      return 3;
+    }
+  };
+  adjacency.starts.assign(num_vertices + 1, 0);
+  for (auto& face : elements) {
+    for (auto c = 0; c < num_corners(face); c++)
+      adjacency.starts[face[c] + 1] += 1;
+  }
+  for (auto vid = 0; vid < num_vertices; vid++)
+    adjacency.starts[vid + 1] += adjacency.starts[vid];
+  adjacency.faces.resize(adjacency.starts.back());
+  auto next = std::vector<int>(
+      adjacency.starts.begin(), adjacency.starts.end() - 1);
+  for (auto fid = 0; fid < elements.size(); fid++) {
+    auto& face = elements[fid];
+    for (auto c = 0; c < num_corners(face); c++)
+      adjacency.faces[next[face[c]]++] = fid;
+  }
+  return adjacency;
+}
+vertex_faces make_vertex_faces(
+    const std::vector<vec3i>& triangles, int num_vertices) {
+  return make_vertex_faces_impl(triangles, num_vertices);
+}
+vertex_faces make_vertex_faces(
+    const std::vector<vec4i>& quads, int num_vertices) {
+  return make_vertex_faces_impl(quads, num_vertices);
+}
+
+// Area-weighted face normals.
+static vec3f weighted_normal(
+    const vec3i& t, const std::vector<vec3f>& positions) {
+  auto normal = triangle_normal(
+      positions[t.x], positions[t.y], positions[t.z]);
+  auto area = triangle_area(positions[t.x], positions[t.y], positions[t.z]);
+  return normal * area;
+}
+static vec3f weighted_normal(
+    const vec4i& q, const std::vector<vec3f>& positions) {
+  auto normal = quad_normal(
+      positions[q.x], positions[q.y], positions[q.z], positions[q.w]);
+  auto area = quad_area(
+      positions[q.x], positions[q.y], positions[q.z], positions[q.w]);
+  return normal * area;
+}
+
+// Update normals by computing face normals and gathering them per vertex,
+// both in parallel over blocks.
+template <typename Face>
+static void update_normals_impl(std::vector<vec3f>& normals,
+    const vertex_faces& adjacency, const std::vector<Face>& elements,
+    const std::vector<vec3f>& positions) {
+  if (normals.size() != positions.size() ||
+      adjacency.starts.size() != positions.size() + 1) {
+    throw std::out_of_range("array should be the same length");
+  }
+  auto face_normals = std::vector<vec3f>(elements.size());
+  auto block_size   = 4096;
+  auto num_faces    = (int)elements.size();
+  parallel_for((num_faces + block_size - 1) / block_size, [&](int block) {
+    auto end = min((block + 1) * block_size, num_faces);
+    for (auto fid = block * block_size; fid < end; fid++)
+      face_normals[fid] = weighted_normal(elements[fid], positions);
+  });
+  auto num_vertices = (int)positions.size();
+  parallel_for((num_vertices + block_size - 1) / block_size, [&](int block) {
+    auto end = min((block + 1) * block_size, num_vertices);
+    for (auto vid = block * block_size; vid < end; vid++) {
+      auto normal = zero3f;
+      for (auto idx = adjacency.starts[vid]; idx < adjacency.starts[vid + 1];
+           idx++)
+        normal += face_normals[adjacency.faces[idx]];
+      normals[vid] = normalize(normal);
+    }
+  });
+}
+
+void update_normals(std::vector<vec3f>& normals, const vertex_faces& adjacency,
+    const std::vector<vec3i>& triangles, const std::vector<vec3f>& positions) {
+  update_normals_impl(normals, adjacency, triangles, positions);
+}
+void update_normals(std::vector<vec3f>& normals, const vertex_faces& adjacency,
+    const std::vector<vec4i>& quads, const std::vector<vec3f>& positions) {
+  update_normals_impl(normals, adjacency, quads, positions);
+}
+
 // Compute per-vertex tangent frame for triangle meshes.
 // Tangent space is defined by a four component std::vector.
 // The first three components are the tangent with respect to the U texcoord.
@@ -2596,144 +2715,231 @@ std::pair<std::vector<vec4i>, std::vector<T>> subdivide_beziers_impl(
   return tess;
 }
 
-// Subdivide catmullclark.
-template <typename T>
-void subdivide_catmullclark_impl(std::vector<vec4i>& quads,
-    std::vector<T>& vert, const std::vector<vec4i>& quads_,
-    const std::vector<T>& vert_, int level, bool lock_boundary) {
-  // initialization
-  quads = quads_;
-  vert  = vert_;
-  // early exit
-  if (quads.empty() || vert.empty()) return;
-  // loop over levels
-  for (auto l = 0; l < level; l++) {
-    // get edges
-    auto emap     = make_edge_map(quads);
-    auto edges    = get_edges(emap);
-    auto boundary = get_boundary(emap);
-    // number of elements
-    auto nverts    = (int)vert.size();
-    auto nedges    = (int)edges.size();
-    auto nboundary = (int)boundary.size();
-    auto nfaces    = (int)quads.size();
-
-    // split elements ------------------------------------
-    // create vertices
-    auto tvert = std::vector<T>(nverts + nedges + nfaces);
-    for (auto i = 0; i < nverts; i++) tvert[i] = vert[i];
-    for (auto i = 0; i < nedges; i++) {
-      auto e            = edges[i];
-      tvert[nverts + i] = (vert[e.x] + vert[e.y]) / 2;
-    }
-    for (auto i = 0; i < nfaces; i++) {
-      auto q = quads[i];
-      if (q.z != q.w) {
-        tvert[nverts + nedges + i] =
-            (vert[q.x] + vert[q.y] + vert[q.z] + vert[q.w]) / 4;
-      } else {
-        tvert[nverts + nedges + i] = (vert[q.x] + vert[q.y] + vert[q.y]) / 3;
-      }
+// Build one level of Catmull-Clark stencils, following the split, averaging
+// and correction passes of the subdivision rules.
+static void make_catmullclark_stencil(std::vector<vec4i>& tquads,
+    subdiv_stencil& stencil, const std::vector<vec4i>& quads, int nverts,
+    bool lock_boundary) {
+  // get edges
+  auto emap     = make_edge_map(quads);
+  auto edges    = get_edges(emap);
+  auto boundary = get_boundary(emap);
+  // number of elements
+  auto nedges    = (int)edges.size();
+  auto nboundary = (int)boundary.size();
+  auto nfaces    = (int)quads.size();
+  auto ntverts   = nverts + nedges + nfaces;
+
+  // split elements ------------------------------------
+  // create vertices as weights of up to four previous vertices
+  auto tvert_indices = std::vector<vec4i>(ntverts, vec4i{0, 0, 0, 0});
+  auto tvert_weights = std::vector<vec4f>(ntverts, zero4f);
+  for (auto i = 0; i < nverts; i++) {
+    tvert_indices[i] = {i, i, i, i};
+    tvert_weights[i] = {1, 0, 0, 0};
+  }
+  for (auto i = 0; i < nedges; i++) {
+    auto e                    = edges[i];
+    tvert_indices[nverts + i] = {e.x, e.y, e.y, e.y};
+    tvert_weights[nverts + i] = {0.5f, 0.5f, 0, 0};
+  }
+  for (auto i = 0; i < nfaces; i++) {
+    auto q                             = quads[i];
+    tvert_indices[nverts + nedges + i] = q;
+    if (q.z != q.w) {
+      tvert_weights[nverts + nedges + i] = {0.25f, 0.25f, 0.25f, 0.25f};
+    } else {
+      tvert_weights[nverts + nedges + i] = {1 / 3.0f, 1 / 3.0f, 1 / 3.0f, 0};
     }
-    // create quads
-    auto tquads = std::vector<vec4i>(nfaces * 4);  // conservative allocation
-    auto qi     = 0;
-    for (auto i = 0; i < nfaces; i++) {
-      auto q = quads[i];
-      if (q.z != q.w) {
-        tquads[qi++] = {q.x, nverts + edge_index(emap, {q.x, q.y}),
-            nverts + nedges + i, nverts + edge_index(emap, {q.w, q.x})};
-        tquads[qi++] = {q.y, nverts + edge_index(emap, {q.y, q.z}),
-            nverts + nedges + i, nverts + edge_index(emap, {q.x, q.y})};
-        tquads[qi++] = {q.z, nverts + edge_index(emap, {q.z, q.w}),
-            nverts + nedges + i, nverts + edge_index(emap, {q.y, q.z})};
-        tquads[qi++] = {q.w, nverts + edge_index(emap, {q.w, q.x}),
-            nverts + nedges + i, nverts + edge_index(emap, {q.z, q.w})};
-      } else {
-        tquads[qi++] = {q.x, nverts + edge_index(emap, {q.x, q.y}),
-            nverts + nedges + i, nverts + edge_index(emap, {q.z, q.x})};
-        tquads[qi++] = {q.y, nverts + edge_index(emap, {q.y, q.z}),
-            nverts + nedges + i, nverts + edge_index(emap, {q.x, q.y})};
-        tquads[qi++] = {q.z, nverts + edge_index(emap, {q.z, q.x}),
-            nverts + nedges + i, nverts + edge_index(emap, {q.y, q.z})};
-      }
+  }
+  // create quads, looking up each edge once
+  tquads.resize(nfaces * 4);  // conservative allocation
+  auto qi = 0;
+  for (auto i = 0; i < nfaces; i++) {
+    auto q = quads[i];
+    auto f = nverts + nedges + i;
+    if (q.z != q.w) {
+      auto e = vec4i{nverts + edge_index(emap, {q.x, q.y}),
+          nverts + edge_index(emap, {q.y, q.z}),
+          nverts + edge_index(emap, {q.z, q.w}),
+          nverts + edge_index(emap, {q.w, q.x})};
+      tquads[qi++] = {q.x, e.x, f, e.w};
+      tquads[qi++] = {q.y, e.y, f, e.x};
+      tquads[qi++] = {q.z, e.z, f, e.y};
+      tquads[qi++] = {q.w, e.w, f, e.z};
+    } else {
+      auto e = vec3i{nverts + edge_index(emap, {q.x, q.y}),
+          nverts + edge_index(emap, {q.y, q.z}),
+          nverts + edge_index(emap, {q.z, q.x})};
+      tquads[qi++] = {q.x, e.x, f, e.z};
+      tquads[qi++] = {q.y, e.y, f, e.x};
+      tquads[qi++] = {q.z, e.z, f, e.y};
     }
-    tquads.resize(qi);
+  }
+  tquads.resize(qi);
 
-    // split boundary
-    auto tboundary = std::vector<vec2i>(nboundary * 2);
-    for (auto i = 0; i < nboundary; i++) {
-      auto e               = boundary[i];
-      tboundary[i * 2 + 0] = {e.x, nverts + edge_index(emap, e)};
-      tboundary[i * 2 + 1] = {nverts + edge_index(emap, e), e.y};
-    }
+  // split boundary
+  auto tboundary = std::vector<vec2i>(nboundary * 2);
+  for (auto i = 0; i < nboundary; i++) {
+    auto e               = boundary[i];
+    tboundary[i * 2 + 0] = {e.x, nverts + edge_index(emap, e)};
+    tboundary[i * 2 + 1] = {nverts + edge_index(emap, e), e.y};
+  }
+
+  // define vertex valence ---------------------------
+  auto tvert_val = std::vector<int>(ntverts, 2);
+  for (auto& e : tboundary) {
+    tvert_val[e.x] = (lock_boundary) ? 0 : 1;
+    tvert_val[e.y] = (lock_boundary) ? 0 : 1;
+  }
 
-    // setup creases -----------------------------------
-    auto tcrease_edges = std::vector<vec2i>();
-    auto tcrease_verts = std::vector<int>();
+  // averaging pass ----------------------------------
+  // collect the split vertices averaged into each vertex, with a counting
+  // sort by vertex; creases are either the boundary vertices or edges
+  auto acount         = std::vector<int>(ntverts, 0);
+  auto astarts        = std::vector<int>(ntverts + 1, 0);
+  auto visit_averages = [&](auto&& add) {
     if (lock_boundary) {
       for (auto& b : tboundary) {
-        tcrease_verts.push_back(b.x);
-        tcrease_verts.push_back(b.y);
+        for (auto vid : {b.x, b.y}) {
+          if (tvert_val[vid] != 0) continue;
+          add(vid, vec4i{vid, vid, vid, vid}, 1);
+        }
       }
     } else {
-      for (auto& b : tboundary) tcrease_edges.push_back(b);
-    }
-
-    // define vertex valence ---------------------------
-    auto tvert_val = std::vector<int>(tvert.size(), 2);
-    for (auto& e : tboundary) {
-      tvert_val[e.x] = (lock_boundary) ? 0 : 1;
-      tvert_val[e.y] = (lock_boundary) ? 0 : 1;
-    }
-
-    // averaging pass ----------------------------------
-    auto avert  = std::vector<T>(tvert.size(), T());
-    auto acount = std::vector<int>(tvert.size(), 0);
-    for (auto p : tcrease_verts) {
-      if (tvert_val[p] != 0) continue;
-      avert[p] += tvert[p];
-      acount[p] += 1;
-    }
-    for (auto& e : tcrease_edges) {
-      auto c = (tvert[e.x] + tvert[e.y]) / 2;
-      for (auto vid : {e.x, e.y}) {
-        if (tvert_val[vid] != 1) continue;
-        avert[vid] += c;
-        acount[vid] += 1;
+      for (auto& e : tboundary) {
+        for (auto vid : {e.x, e.y}) {
+          if (tvert_val[vid] != 1) continue;
+          add(vid, vec4i{e.x, e.y, e.x, e.y}, 2);
+        }
       }
     }
     for (auto& q : tquads) {
-      auto c = (tvert[q.x] + tvert[q.y] + tvert[q.z] + tvert[q.w]) / 4;
       for (auto vid : {q.x, q.y, q.z, q.w}) {
         if (tvert_val[vid] != 2) continue;
-        avert[vid] += c;
-        acount[vid] += 1;
+        add(vid, q, 4);
       }
     }
-    for (auto i = 0; i < tvert.size(); i++) avert[i] /= (float)acount[i];
-
-    // correction pass ----------------------------------
-    // p = p + (avg_p - p) * (4/avg_count)
-    for (auto i = 0; i < tvert.size(); i++) {
-      if (tvert_val[i] != 2) continue;
-      avert[i] = tvert[i] + (avert[i] - tvert[i]) * (4 / (float)acount[i]);
+  };
+  visit_averages([&](int vid, const vec4i& verts, int num) {
+    acount[vid] += 1;
+    astarts[vid + 1] += num;
+  });
+  for (auto i = 0; i < ntverts; i++) astarts[i + 1] += astarts[i];
+  auto averages = std::vector<int>(astarts.back());
+  auto offsets  = std::vector<int>(astarts.begin(), astarts.end() - 1);
+  visit_averages([&](int vid, const vec4i& verts, int num) {
+    for (auto k = 0; k < num; k++) averages[offsets[vid]++] = verts[k];
+  });
+
+  // correction pass ----------------------------------
+  // p = p + (avg_p - p) * (4/avg_count), expanded on the previous vertices
+  stencil.starts.assign(1, 0);
+  stencil.starts.reserve(ntverts + 1);
+  stencil.indices.clear();
+  stencil.indices.reserve(astarts.back() * 2 + ntverts);
+  stencil.weights.clear();
+  stencil.weights.reserve(astarts.back() * 2 + ntverts);
+  auto accumulator = std::vector<float>(nverts, 0);
+  auto touched     = std::vector<int>{};
+  auto accumulate  = [&](int tvid, float weight) {
+    for (auto k = 0; k < 4; k++) {
+      auto vid = tvert_indices[tvid][k];
+      auto wgt = tvert_weights[tvid][k];
+      if (wgt == 0) continue;
+      if (accumulator[vid] == 0) touched.push_back(vid);
+      accumulator[vid] += weight * wgt;
+    }
+  };
+  for (auto i = 0; i < ntverts; i++) {
+    auto num = astarts[i + 1] - astarts[i];
+    if (acount[i] == 0) {
+      accumulate(i, 1);
+    } else {
+      auto scale = (tvert_val[i] == 2) ? 4 / (float)acount[i] : 1;
+      for (auto a = astarts[i]; a < astarts[i + 1]; a++)
+        accumulate(averages[a], scale / num);
+      if (tvert_val[i] == 2) accumulate(i, 1 - scale);
+    }
+    for (auto vid : touched) {
+      if (accumulator[vid] != 0) {
+        stencil.indices.push_back(vid);
+        stencil.weights.push_back(accumulator[vid]);
+      }
+      accumulator[vid] = 0;
     }
-    tvert = avert;
+    touched.clear();
+    stencil.starts.push_back((int)stencil.indices.size());
+  }
+}
 
-    // done
-    swap(tquads, quads);
+// Build Catmull-Clark stencils for a quad topology.
+catmullclark_stencils make_catmullclark_stencils(const std::vector<vec4i>& quads,
+    int num_vertices, int level, bool lock_boundary) {
+  auto stencils  = catmullclark_stencils{};
+  stencils.quads = quads;
+  if (quads.empty() || num_vertices == 0) return stencils;
+  auto nverts = num_vertices;
+  for (auto l = 0; l < level; l++) {
+    auto tquads = std::vector<vec4i>{};
+    make_catmullclark_stencil(tquads, stencils.levels.emplace_back(),
+        stencils.quads, nverts, lock_boundary);
+    nverts = (int)stencils.levels.back().starts.size() - 1;
+    swap(tquads, stencils.quads);
+  }
+  return stencils;
+}
+
+// Subdivide vertex attributes with Catmull-Clark stencils. Vertices are
+// computed in parallel over blocks of rows.
+template <typename T>
+std::vector<T> apply_catmullclark_stencils_impl(
+    const catmullclark_stencils& stencils, const std::vector<T>& vert_) {
+  auto vert  = vert_;
+  auto tvert = std::vector<T>{};
+  for (auto& stencil : stencils.levels) {
+    auto ntverts = (int)stencil.starts.size() - 1;
+    tvert.resize(ntverts);
+    auto block_size = 4096;
+    parallel_for((ntverts + block_size - 1) / block_size, [&](int block) {
+      auto end = min((block + 1) * block_size, ntverts);
+      for (auto i = block * block_size; i < end; i++) {
+        auto value = T{};
+        for (auto idx = stencil.starts[i]; idx < stencil.starts[i + 1]; idx++)
+          value += vert[stencil.indices[idx]] * stencil.weights[idx];
+        tvert[i] = value;
+      }
+    });
     swap(tvert, vert);
   }
+  return vert;
+}
+std::vector<float> apply_catmullclark_stencils(
+    const catmullclark_stencils& stencils, const std::vector<float>& vert) {
+  return apply_catmullclark_stencils_impl(stencils, vert);
+}
+std::vector<vec2f> apply_catmullclark_stencils(
+    const catmullclark_stencils& stencils, const std::vector<vec2f>& vert) {
+  return apply_catmullclark_stencils_impl(stencils, vert);
 }
+std::vector<vec3f> apply_catmullclark_stencils(
+    const catmullclark_stencils& stencils, const std::vector<vec3f>& vert) {
+  return apply_catmullclark_stencils_impl(stencils, vert);
+}
+std::vector<vec4f> apply_catmullclark_stencils(
+    const catmullclark_stencils& stencils, const std::vector<vec4f>& vert) {
+  return apply_catmullclark_stencils_impl(stencils, vert);
+}
+
+// Subdivide catmullclark.
 template <typename T>
 std::pair<std::vector<vec4i>, std::vector<T>> subdivide_catmullclark_impl(
     const std::vector<vec4i>& quads, const std::vector<T>& vert, int level,
     bool lock_boundary) {
-  auto tess = std::pair<std::vector<vec4i>, std::vector<T>>{};
-  subdivide_catmullclark_impl(
-      tess.first, tess.second, quads, vert, level, lock_boundary);
-  return tess;
+  if (quads.empty() || vert.empty()) return {quads, vert};
+  auto stencils = make_catmullclark_stencils(
+      quads, (int)vert.size(), level, lock_boundary);
+  return {stencils.quads, apply_catmullclark_stencils(stencils, vert)};
 }
 
 std::pair<std::vector<vec2i>, std::vector<float>> subdivide_lines(
@@ -2917,44 +3123,149 @@ std::vector<float> sample_quads_cdf(
   return cdf;
 }
 
-// Samples a set of points over a triangle mesh uniformly. The rng function
-// takes the point index and returns vec3f numbers uniform directibuted in
-// [0,1]^3. unorm and texcoord are optional.
-void sample_triangles(std::vector<vec3f>& sampled_positions,
+// Build an alias table with Vose's method, splitting elements with more than
+// the average weight among the ones with less.
+alias_table make_alias_table(const std::vector<float>& weights) {
+  auto alias = alias_table{};
+  auto size  = (int)weights.size();
+  alias.probs.assign(size, 1);
+  alias.aliases.resize(size);
+  for (auto idx = 0; idx < size; idx++) alias.aliases[idx] = idx;
+  auto total = 0.0;
+  for (auto weight : weights) total += weight;
+  if (total <= 0) return alias;
+  auto scaled = std::vector<double>(size);
+  auto small = std::vector<int>{}, large = std::vector<int>{};
+  for (auto idx = 0; idx < size; idx++) {
+    scaled[idx] = weights[idx] * size / total;
+    if (scaled[idx] < 1) {
+      small.push_back(idx);
+    } else {
+      large.push_back(idx);
+    }
+  }
+  while (!small.empty() && !large.empty()) {
+    auto less = small.back(), more = large.back();
+    small.pop_back();
+    alias.probs[less]   = (float)scaled[less];
+    alias.aliases[less] = more;
+    scaled[more] -= 1 - scaled[less];
+    if (scaled[more] < 1) {
+      large.pop_back();
+      small.push_back(more);
+    }
+  }
+  // leftovers are only due to numerical errors and are kept with certainty
+  return alias;
+}
+
+// Pick an element from an alias table.
+static inline int sample_alias(const alias_table& alias, int idx, float rp) {
+  return rp < alias.probs[idx] ? idx : alias.aliases[idx];
+}
+int sample_alias(const alias_table& alias, float ri, float rp) {
+  auto size = (int)alias.probs.size();
+  return sample_alias(alias, clamp((int)(ri * size), 0, size - 1), rp);
+}
+
+// Pick a point on a triangle/quad mesh uniformly using alias tables.
+std::pair<int, vec2f> sample_triangles(
+    const alias_table& alias, const vec2f& re, const vec2f& ruv) {
+  return {sample_alias(alias, re.x, re.y), sample_triangle(ruv)};
+}
+alias_table sample_triangles_alias(
+    const std::vector<vec3i>& triangles, const std::vector<vec3f>& positions) {
+  auto weights = std::vector<float>(triangles.size());
+  for (auto i = 0; i < weights.size(); i++) {
+    auto t     = triangles[i];
+    weights[i] = triangle_area(positions[t.x], positions[t.y], positions[t.z]);
+  }
+  return make_alias_table(weights);
+}
+std::pair<int, vec2f> sample_quads(const std::vector<vec4i>& quads,
+    const alias_table& alias, const vec2f& re, const vec2f& ruv) {
+  auto element = sample_alias(alias, re.x, re.y);
+  if (quads[element].z == quads[element].w) {
+    return {element, sample_triangle(ruv)};
+  } else {
+    return {element, ruv};
+  }
+}
+alias_table sample_quads_alias(
+    const std::vector<vec4i>& quads, const std::vector<vec3f>& positions) {
+  auto weights = std::vector<float>(quads.size());
+  for (auto i = 0; i < weights.size(); i++) {
+    auto q     = quads[i];
+    weights[i] = quad_area(
+        positions[q.x], positions[q.y], positions[q.z], positions[q.w]);
+  }
+  return make_alias_table(weights);
+}
+
+// Generates points in parallel over fixed-size chunks. Each chunk uses its
+// own random stream, so results do not depend on the number of threads.
+// `sample` takes the point index and the chunk rng.
+template <typename Sample>
+static void sample_chunks(int npoints, int seed, int first_chunk,
+    const alias_table& alias, Sample&& sample) {
+  auto chunk_size = 4096;
+  auto size       = (int)alias.probs.size();
+  if (!size) return;
+  parallel_for((npoints + chunk_size - 1) / chunk_size, [&](int chunk) {
+    auto rng = make_rng(seed, (uint64_t)(first_chunk + chunk) * 2 + 1);
+    auto end = min((chunk + 1) * chunk_size, npoints);
+    for (auto i = chunk * chunk_size; i < end; i++) {
+      auto element = sample_alias(alias, rand1i(rng, size), rand1f(rng));
+      sample(i, element, rand2f(rng));
+    }
+  });
+}
+
+// Samples points on triangles, starting from the given chunk stream.
+static void sample_triangles(std::vector<vec3f>& sampled_positions,
     std::vector<vec3f>& sampled_normals, std::vector<vec2f>& sampled_texcoords,
     const std::vector<vec3i>& triangles, const std::vector<vec3f>& positions,
     const std::vector<vec3f>& normals, const std::vector<vec2f>& texcoords,
-    int npoints, int seed) {
+    const alias_table& alias, int npoints, int seed, int first_chunk) {
   sampled_positions.resize(npoints);
   sampled_normals.resize(npoints);
   sampled_texcoords.resize(npoints);
-  auto cdf = sample_triangles_cdf(triangles, positions);
-  auto rng = make_rng(seed);
-  for (auto i = 0; i < npoints; i++) {
-    auto  sample         = sample_triangles(cdf, rand1f(rng), rand2f(rng));
-    auto& t              = triangles[sample.first];
-    auto  uv             = sample.second;
-    sampled_positions[i] = interpolate_triangle(
-        positions[t.x], positions[t.y], positions[t.z], uv);
-    if (!sampled_normals.empty()) {
-      sampled_normals[i] = normalize(
-          interpolate_triangle(normals[t.x], normals[t.y], normals[t.z], uv));
-    } else {
-      sampled_normals[i] = triangle_normal(
-          positions[t.x], positions[t.y], positions[t.z]);
-    }
-    if (!sampled_texcoords.empty()) {
-      sampled_texcoords[i] = interpolate_triangle(
-          texcoords[t.x], texcoords[t.y], texcoords[t.z], uv);
-    } else {
-      sampled_texcoords[i] = zero2f;
-    }
-  }
+  sample_chunks(npoints, seed, first_chunk, alias,
+      [&](int i, int element, const vec2f& ruv) {
+        auto& t              = triangles[element];
+        auto  uv             = sample_triangle(ruv);
+        sampled_positions[i] = interpolate_triangle(
+            positions[t.x], positions[t.y], positions[t.z], uv);
+        if (!normals.empty()) {
+          sampled_normals[i] = normalize(interpolate_triangle(
+              normals[t.x], normals[t.y], normals[t.z], uv));
+        } else {
+          sampled_normals[i] = triangle_normal(
+              positions[t.x], positions[t.y], positions[t.z]);
+        }
+        if (!texcoords.empty()) {
+          sampled_texcoords[i] = interpolate_triangle(
+              texcoords[t.x], texcoords[t.y], texcoords[t.z], uv);
+        } else {
+          sampled_texcoords[i] = zero2f;
+        }
+      });
 }
 
-// Samples a set of points over a triangle mesh uniformly. The rng function
-// takes the point index and returns vec3f numbers uniform directibuted in
-// [0,1]^3. unorm and texcoord are optional.
+// Samples a set of points over a triangle mesh uniformly. unorm and texcoord
+// are optional.
+void sample_triangles(std::vector<vec3f>& sampled_positions,
+    std::vector<vec3f>& sampled_normals, std::vector<vec2f>& sampled_texcoords,
+    const std::vector<vec3i>& triangles, const std::vector<vec3f>& positions,
+    const std::vector<vec3f>& normals, const std::vector<vec2f>& texcoords,
+    int npoints, int seed) {
+  auto alias = sample_triangles_alias(triangles, positions);
+  sample_triangles(sampled_positions, sampled_normals, sampled_texcoords,
+      triangles, positions, normals, texcoords, alias, npoints, seed, 0);
+}
+
+// Samples a set of points over a quad mesh uniformly. unorm and texcoord
+// are optional.
 void sample_quads(std::vector<vec3f>& sampled_positions,
     std::vector<vec3f>& sampled_normals, std::vector<vec2f>& sampled_texcoords,
     const std::vector<vec4i>& quads, const std::vector<vec3f>& positions,
@@ -2963,27 +3274,87 @@ void sample_quads(std::vector<vec3f>& sampled_positions,
   sampled_positions.resize(npoints);
   sampled_normals.resize(npoints);
   sampled_texcoords.resize(npoints);
-  auto cdf = sample_quads_cdf(quads, positions);
-  auto rng = make_rng(seed);
-  for (auto i = 0; i < npoints; i++) {
-    auto  sample         = sample_quads(cdf, rand1f(rng), rand2f(rng));
-    auto& q              = quads[sample.first];
-    auto  uv             = sample.second;
-    sampled_positions[i] = interpolate_quad(
-        positions[q.x], positions[q.y], positions[q.z], positions[q.w], uv);
-    if (!sampled_normals.empty()) {
-      sampled_normals[i] = normalize(interpolate_quad(
-          normals[q.x], normals[q.y], normals[q.z], normals[q.w], uv));
-    } else {
-      sampled_normals[i] = quad_normal(
-          positions[q.x], positions[q.y], positions[q.z], positions[q.w]);
+  auto alias = sample_quads_alias(quads, positions);
+  sample_chunks(npoints, seed, 0, alias,
+      [&](int i, int element, const vec2f& ruv) {
+        auto& q              = quads[element];
+        auto  uv             = q.z == q.w ? sample_triangle(ruv) : ruv;
+        sampled_positions[i] = interpolate_quad(
+            positions[q.x], positions[q.y], positions[q.z], positions[q.w], uv);
+        if (!normals.empty()) {
+          sampled_normals[i] = normalize(interpolate_quad(
+              normals[q.x], normals[q.y], normals[q.z], normals[q.w], uv));
+        } else {
+          sampled_normals[i] = quad_normal(
+              positions[q.x], positions[q.y], positions[q.z], positions[q.w]);
+        }
+        if (!texcoords.empty()) {
+          sampled_texcoords[i] = interpolate_quad(texcoords[q.x],
+              texcoords[q.y], texcoords[q.z], texcoords[q.w], uv);
+        } else {
+          sampled_texcoords[i] = zero2f;
+        }
+      });
+}
+
+// Samples a set of points over a triangle mesh with a Poisson-disk
+// distribution by dart throwing. Candidates are drawn in batches of uniform
+// samples and accepted serially in order against a grid of kept points with
+// cells as large as the radius, so only the 27 surrounding cells are checked.
+// Sampling stops when enough points are kept or a batch keeps less than 1% of
+// its candidates, i.e. the surface is nearly covered.
+void sample_triangles_poisson(std::vector<vec3f>& sampled_positions,
+    std::vector<vec3f>& sampled_normals, std::vector<vec2f>& sampled_texcoords,
+    const std::vector<vec3i>& triangles, const std::vector<vec3f>& positions,
+    const std::vector<vec3f>& normals, const std::vector<vec2f>& texcoords,
+    float radius, int npoints, int seed) {
+  sampled_positions.clear();
+  sampled_normals.clear();
+  sampled_texcoords.clear();
+  auto alias      = sample_triangles_alias(triangles, positions);
+  auto cells      = std::unordered_map<vec3i, std::vector<int>>{};
+  auto get_cell   = [radius](const vec3f& position) {
+    return vec3i{(int)std::floor(position.x / radius),
+        (int)std::floor(position.y / radius),
+        (int)std::floor(position.z / radius)};
+  };
+  auto is_free = [&](const vec3f& position) {
+    auto cell = get_cell(position);
+    for (auto k = -1; k <= 1; k++) {
+      for (auto j = -1; j <= 1; j++) {
+        for (auto i = -1; i <= 1; i++) {
+          auto it = cells.find(cell + vec3i{i, j, k});
+          if (it == cells.end()) continue;
+          for (auto vid : it->second) {
+            if (distance_squared(sampled_positions[vid], position) <
+                radius * radius)
+              return false;
+          }
+        }
+      }
     }
-    if (!sampled_texcoords.empty()) {
-      sampled_texcoords[i] = interpolate_quad(
-          texcoords[q.x], texcoords[q.y], texcoords[q.z], texcoords[q.w], uv);
-    } else {
-      sampled_texcoords[i] = zero2f;
+    return true;
+  };
+  auto batch_size = max(npoints, 4096);
+  auto chunks     = (batch_size + 4095) / 4096;
+  auto candidate_positions = std::vector<vec3f>{};
+  auto candidate_normals   = std::vector<vec3f>{};
+  auto candidate_texcoords = std::vector<vec2f>{};
+  for (auto batch = 0; sampled_positions.size() < (size_t)npoints; batch++) {
+    sample_triangles(candidate_positions, candidate_normals,
+        candidate_texcoords, triangles, positions, normals, texcoords, alias,
+        batch_size, seed, batch * chunks);
+    auto kept = sampled_positions.size();
+    for (auto i = 0; i < batch_size; i++) {
+      if (sampled_positions.size() >= (size_t)npoints) break;
+      if (!is_free(candidate_positions[i])) continue;
+      cells[get_cell(candidate_positions[i])].push_back(
+          (int)sampled_positions.size());
+      sampled_positions.push_back(candidate_positions[i]);
+      sampled_normals.push_back(candidate_normals[i]);
+      sampled_texcoords.push_back(candidate_texcoords[i]);
     }
+    if ((sampled_positions.size() - kept) * 100 < (size_t)batch_size) break;
   }
 }
 
@@ -3072,13 +3443,21 @@ geodesic_solver make_geodesic_solver(const std::vector<vec3i>& triangles,
   return solver;
 }
 
+// Scratch memory for visiting the geodesic graph with the label-correcting
+// queue. It is kept between visits, so repeated updates do not reallocate
+// it; the in-queue flags are all cleared again when a visit ends.
+struct geodesic_workspace {
+  std::deque<int>   nodes    = {};
+  std::vector<bool> in_queue = {};
+};
+
 // `update` is a function that is executed during expansion, every time a node
 // is put into queue. `exit` is a function that tells whether to expand the
 // current node or perform early exit.
 template <typename Update, typename Exit>
 void visit_geodesic_graph(std::vector<float>& field,
     const geodesic_solver& solver, const std::vector<int>& sources,
-    Update&& update, Exit&& exit) {
+    geodesic_workspace& workspace, Update&& update, Exit&& exit) {
   /*
      This algortithm uses the heuristic Small Label Fisrt and Large Label Last
      https://en.wikipedia.org/wiki/Shortest_Path_Faster_Algorithm
@@ -3095,10 +3474,12 @@ void visit_geodesic_graph(std::vector<float>& field,
      the end of the queue.
   */
 
-  auto in_queue = std::vector<bool>(solver.graph.size(), false);
+  if (workspace.in_queue.size() != solver.graph.size())
+    workspace.in_queue.assign(solver.graph.size(), false);
+  auto& in_queue = workspace.in_queue;
 
   // setup queue
-  auto queue = std::deque<int>();
+  auto& queue = workspace.nodes;
   for (auto source : sources) {
     in_queue[source] = true;
     queue.push_back(source);
@@ -3161,12 +3542,19 @@ void visit_geodesic_graph(std::vector<float>& field,
 }
 
 // Compute geodesic distances
-void update_geodesic_distances(std::vector<float>& distances,
+static void update_geodesic_distances(std::vector<float>& distances,
     const geodesic_solver& solver, const std::vector<int>& sources,
-    float max_distance) {
+    float max_distance, geodesic_workspace& workspace) {
   auto update = [](int node, int neighbor, float new_distance) {};
   auto exit   = [&](int node) { return distances[node] > max_distance; };
-  visit_geodesic_graph(distances, solver, sources, update, exit);
+  visit_geodesic_graph(distances, solver, sources, workspace, update, exit);
+}
+void update_geodesic_distances(std::vector<float>& distances,
+    const geodesic_solver& solver, const std::vector<int>& sources,
+    float max_distance) {
+  auto workspace = geodesic_workspace{};
+  update_geodesic_distances(
+      distances, solver, sources, max_distance, workspace);
 }
 
 std::vector<float> compute_geodesic_distances(const geodesic_solver& solver,
@@ -3188,8 +3576,9 @@ std::vector<int> compute_geodesic_paths(const geodesic_solver& solver,
     parents[neighbor] = node;
   };
   auto exit = [end_vertex](int node) { return node == end_vertex; };
+  auto workspace = geodesic_workspace{};
   for (auto source : sources) distances[source] = 0.0f;
-  visit_geodesic_graph(distances, solver, sources, update, exit);
+  visit_geodesic_graph(distances, solver, sources, workspace, update, exit);
   return parents;
 }
 
@@ -3201,6 +3590,7 @@ std::vector<int> sample_vertices_poisson(
   auto verts = std::vector<int>{};
   verts.reserve(num_samples);
   auto distances = std::vector<float>(solver.graph.size(), flt_max);
+  auto workspace = geodesic_workspace{};
   while (true) {
     auto max_index =
         (int)(std::max_element(distances.begin(), distances.end()) -
@@ -3208,7 +3598,8 @@ std::vector<int> sample_vertices_poisson(
     verts.push_back(max_index);
     if (verts.size() >= num_samples) break;
     distances[max_index] = 0.0f;
-    update_geodesic_distances(distances, solver, {max_index}, flt_max);
+    update_geodesic_distances(
+        distances, solver, {max_index}, flt_max, workspace);
   }
   return verts;
 }
@@ -3223,12 +3614,9 @@ std::vector<std::vector<float>> compute_voronoi_fields(
   // time weakly dependant on the number of generators.
   auto total = compute_geodesic_distances(solver, generators);
   auto max   = *std::max_element(total.begin(), total.end());
-  // @Speed: use parallel_for
-  for (int i = 0; i < generators.size(); ++i) {
-    fields[i]                = std::vector<float>(solver.graph.size(), flt_max);
-    fields[i][generators[i]] = 0;
+  parallel_for((int)generators.size(), [&](int i) {
     fields[i] = compute_geodesic_distances(solver, {generators[i]}, max);
-  };
+  });
   return fields;
 }
 
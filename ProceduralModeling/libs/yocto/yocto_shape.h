@@ -172,6 +172,27 @@ void update_normals(std::vector<vec3f>& normals,
 void update_normals(std::vector<vec3f>& normals,
     const std::vector<vec4i>& quads, const std::vector<vec3f>& positions);
 
+// Faces adjacent to each vertex, stored as compressed rows in face order.
+// The faces of vertex `vid` are `faces[starts[vid]]` to
+// `faces[starts[vid + 1] - 1]`. Build once and reuse while the
+// connectivity does not change.
+struct vertex_faces {
+  std::vector<int> starts = {};
+  std::vector<int> faces  = {};
+};
+vertex_faces make_vertex_faces(
+    const std::vector<vec3i>& triangles, int num_vertices);
+vertex_faces make_vertex_faces(
+    const std::vector<vec4i>& quads, int num_vertices);
+
+// Update normals in parallel by gathering the area-weighted face normals
+// around each vertex. Faces are summed in order, so the results match the
+// serial version exactly.
+void update_normals(std::vector<vec3f>& normals, const vertex_faces& adjacency,
+    const std::vector<vec3i>& triangles, const std::vector<vec3f>& positions);
+void update_normals(std::vector<vec3f>& normals, const vertex_faces& adjacency,
+    const std::vector<vec4i>& quads, const std::vector<vec3f>& positions);
+
 // Compute per-vertex tangent space for triangle meshes.
 // Tangent space is defined by a four component std::vector.
 // The first three components are the tangent with respect to the u texcoord.
@@ -603,6 +624,35 @@ std::pair<std::vector<vec4i>, std::vector<vec4f>> subdivide_catmullclark(
     const std::vector<vec4i>& quads, const std::vector<vec4f>& vert, int level,
     bool lock_boundary = false);
 
+// Sparse weights of the vertices of the previous subdivision level for each
+// vertex of a level, stored in compressed rows.
+struct subdiv_stencil {
+  std::vector<int>   starts  = {};
+  std::vector<int>   indices = {};
+  std::vector<float> weights = {};
+};
+
+// Catmull-Clark subdivision stencils. Stencils depend only on the topology,
+// so they can be built once and applied to any number of vertex attributes,
+// or to animated vertices at every frame.
+struct catmullclark_stencils {
+  std::vector<vec4i>          quads  = {};  // subdivided quads
+  std::vector<subdiv_stencil> levels = {};
+};
+
+// Build Catmull-Clark stencils for a quad topology.
+catmullclark_stencils make_catmullclark_stencils(const std::vector<vec4i>& quads,
+    int num_vertices, int level, bool lock_boundary = false);
+// Subdivide vertex attributes with Catmull-Clark stencils.
+std::vector<float> apply_catmullclark_stencils(
+    const catmullclark_stencils& stencils, const std::vector<float>& vert);
+std::vector<vec2f> apply_catmullclark_stencils(
+    const catmullclark_stencils& stencils, const std::vector<vec2f>& vert);
+std::vector<vec3f> apply_catmullclark_stencils(
+    const catmullclark_stencils& stencils, const std::vector<vec3f>& vert);
+std::vector<vec4f> apply_catmullclark_stencils(
+    const catmullclark_stencils& stencils, const std::vector<vec4f>& vert);
+
 }  // namespace yocto::shape
 
 // -----------------------------------------------------------------------------
@@ -635,8 +685,33 @@ std::pair<int, vec2f> sample_quads(const std::vector<vec4i>& quads,
 std::vector<float>    sample_quads_cdf(
        const std::vector<vec4i>& quads, const std::vector<vec3f>& positions);
 
+// Alias table to pick elements proportionally to their weights in constant
+// time. Element `i` is kept with probability `probs[i]`, otherwise
+// `aliases[i]` is returned.
+struct alias_table {
+  std::vector<float> probs   = {};
+  std::vector<int>   aliases = {};
+};
+
+// Build an alias table from element weights and pick an element from it
+// with two uniform numbers.
+alias_table make_alias_table(const std::vector<float>& weights);
+int         sample_alias(const alias_table& alias, float ri, float rp);
+
+// Pick a point on a triangle/quad mesh uniformly using alias tables.
+std::pair<int, vec2f> sample_triangles(
+    const alias_table& alias, const vec2f& re, const vec2f& ruv);
+alias_table sample_triangles_alias(
+    const std::vector<vec3i>& triangles, const std::vector<vec3f>& positions);
+std::pair<int, vec2f> sample_quads(const std::vector<vec4i>& quads,
+    const alias_table& alias, const vec2f& re, const vec2f& ruv);
+alias_table sample_quads_alias(
+    const std::vector<vec4i>& quads, const std::vector<vec3f>& positions);
+
 // Samples a set of points over a triangle/quad mesh uniformly. Returns pos,
-// norm and texcoord of the sampled points.
+// norm and texcoord of the sampled points. Points are generated in parallel
+// in fixed-size chunks, each with its own random stream, so results depend
+// only on the seed.
 void sample_triangles(std::vector<vec3f>& sampled_positions,
     std::vector<vec3f>& sampled_normals, std::vector<vec2f>& sampled_texcoords,
     const std::vector<vec3i>& triangles, const std::vector<vec3f>& positions,
@@ -648,6 +723,15 @@ void sample_quads(std::vector<vec3f>& sampled_positions,
     const std::vector<vec3f>& normals, const std::vector<vec2f>& texcoords,
     int npoints, int seed = 7);
 
+// Samples a set of points over a triangle mesh with a Poisson-disk
+// distribution. Uniform candidates are kept in order if no kept point is
+// closer than `radius`. Returns at most `npoints` points.
+void sample_triangles_poisson(std::vector<vec3f>& sampled_positions,
+    std::vector<vec3f>& sampled_normals, std::vector<vec2f>& sampled_texcoords,
+    const std::vector<vec3i>& triangles, const std::vector<vec3f>& positions,
+    const std::vector<vec3f>& normals, const std::vector<vec2f>& texcoords,
+    float radius, int npoints, int seed = 7);
+
 }  // namespace yocto::shape
 
 // -----------------------------------------------------------------------------
@@ -693,7 +777,8 @@ std::vector<int> compute_geodesic_paths(const geodesic_solver& solver,
 std::vector<int> sample_vertices_poisson(
     const geodesic_solver& solver, int num_samples);
 
-// Compute the distance field needed to compute a voronoi diagram
+// Compute the distance field needed to compute a voronoi diagram.
+// Fields are computed in parallel.
 std::vector<std::vector<float>> compute_voronoi_fields(
     const geodesic_solver& solver, const std::vector<int>& generators);
 
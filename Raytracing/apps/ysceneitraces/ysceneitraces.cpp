@@ -84,7 +84,7 @@ struct app_state {
   }
 };
 
-// construct a scene from io
+// construct a scene from io, moving texture and shape data out of ioscene
 void init_scene(rtr::scene* scene, sio::model* ioscene, rtr::camera*& camera,
     sio::camera* iocamera, sio::progress_callback print_progress = {}) {
   // handle progress
@@ -92,7 +92,7 @@ void init_scene(rtr::scene* scene, sio::model* ioscene, rtr::camera*& camera,
       0, (int)ioscene->cameras.size() + (int)ioscene->environments.size() +
              (int)ioscene->materials.size() + (int)ioscene->textures.size() +
              (int)ioscene->shapes.size() + (int)ioscene->subdivs.size() +
-             (int)ioscene->objects.size()};
+             (int)ioscene->instances.size() + (int)ioscene->objects.size()};
 
   auto camera_map     = std::unordered_map<sio::camera*, rtr::camera*>{};
   camera_map[nullptr] = nullptr;
@@ -113,13 +113,13 @@ void init_scene(rtr::scene* scene, sio::model* ioscene, rtr::camera*& camera,
       print_progress("convert texture", progress.x++, progress.y);
     auto texture = add_texture(scene);
     if (!iotexture->colorf.empty()) {
-      set_texture(texture, iotexture->colorf);
+      set_texture(texture, std::move(iotexture->colorf));
     } else if (!iotexture->colorb.empty()) {
-      set_texture(texture, iotexture->colorb);
+      set_texture(texture, std::move(iotexture->colorb));
     } else if (!iotexture->scalarf.empty()) {
-      set_texture(texture, iotexture->scalarf);
+      set_texture(texture, std::move(iotexture->scalarf));
     } else if (!iotexture->scalarb.empty()) {
-      set_texture(texture, iotexture->scalarb);
+      set_texture(texture, std::move(iotexture->scalarb));
     }
     texture_map[iotexture] = texture;
   }
@@ -163,34 +163,36 @@ void init_scene(rtr::scene* scene, sio::model* ioscene, rtr::camera*& camera,
     if (print_progress)
       print_progress("convert shape", progress.x++, progress.y);
     auto shape = add_shape(scene);
-    set_points(shape, ioshape->points);
-    set_lines(shape, ioshape->lines);
-    set_triangles(shape, ioshape->triangles);
+    set_points(shape, std::move(ioshape->points));
+    set_lines(shape, std::move(ioshape->lines));
+    set_triangles(shape, std::move(ioshape->triangles));
     if(!ioshape->quads.empty())
       set_triangles(shape, shp::quads_to_triangles(ioshape->quads));
-    set_positions(shape, ioshape->positions);
-    set_normals(shape, ioshape->normals);
-    set_texcoords(shape, ioshape->texcoords);
-    set_radius(shape, ioshape->radius);
+    set_positions(shape, std::move(ioshape->positions));
+    set_normals(shape, std::move(ioshape->normals));
+    set_texcoords(shape, std::move(ioshape->texcoords));
+    set_radius(shape, std::move(ioshape->radius));
     shape_map[ioshape] = shape;
   }
 
+  auto instance_map     = std::unordered_map<sio::instance*, rtr::instance*>{};
+  instance_map[nullptr] = nullptr;
+  for (auto ioinstance : ioscene->instances) {
+    if (print_progress)
+      print_progress("convert instance", progress.x++, progress.y);
+    auto instance = add_instance(scene);
+    set_frames(instance, ioinstance->frames);
+    instance_map[ioinstance] = instance;
+  }
+
   for (auto ioobject : ioscene->objects) {
     if (print_progress)
       print_progress("convert object", progress.x++, progress.y);
-    if(ioobject->instance) {
-      for(auto frame : ioobject->instance->frames) {
-        auto object = add_object(scene);
-        set_frame(object, frame * ioobject->frame);
-        set_shape(object, shape_map.at(ioobject->shape));
-        set_material(object, material_map.at(ioobject->material));
-      }
-    } else {
-      auto object = add_object(scene);
-      set_frame(object, ioobject->frame);
-      set_shape(object, shape_map.at(ioobject->shape));
-      set_material(object, material_map.at(ioobject->material));
-    }
+    auto object = add_object(scene);
+    set_frame(object, ioobject->frame);
+    set_shape(object, shape_map.at(ioobject->shape));
+    set_material(object, material_map.at(ioobject->material));
+    set_instance(object, instance_map.at(ioobject->instance));
   }
 
   for (auto ioenvironment : ioscene->environments) {
@@ -275,6 +277,13 @@ int main(int argc, const char* argv[]) {
   add_option(
       cli, "--bounces,-b", app->params.bounces, "Maximum number of bounces.");
   add_option(cli, "--clamp", app->params.clamp, "Final pixel clamping.");
+  add_option(
+      cli, "--mipmap/--no-mipmap", app->params.mipmap, "Use texture mipmaps.");
+  add_option(cli, "--tcache", app->params.tcache, "Texture cache size in MB.");
+  add_option(cli, "--halfldr/--no-halfldr", app->params.halfldr,
+      "Store LDR textures as halfs.");
+  add_option(cli, "--bvhleaves/--no-bvhleaves", app->params.bvhleaves,
+      "Copy triangles into BVH leaves.");
   add_option(cli, "--skyenv/--no-skyenv", add_skyenv, "Add sky envmap");
   add_option(cli, "--output,-o", app->imagename, "Image output");
   add_option(cli, "scene", app->filename, "Scene filename", true);
@@ -299,6 +308,12 @@ int main(int argc, const char* argv[]) {
   // build bvh
   init_bvh(app->scene, app->params, cli::print_progress);
 
+  // build textures
+  init_textures(app->scene, app->params, cli::print_progress);
+
+  // init lights
+  init_lights(app->scene, cli::print_progress);
+
   // allocate buffers
   reset_display(app);
 
@@ -0,0 +1,142 @@
+//
+// LICENSE:
+//
+// Copyright (c) 2016 -- 2020 Fabio Pellacini
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <yocto/yocto_commonio.h>
+#include <yocto/yocto_math.h>
+#include <yocto/yocto_sceneio.h>
+#include <yocto/yocto_shape.h>
+using namespace yocto::math;
+namespace cli = yocto::commonio;
+namespace sio = yocto::sceneio;
+namespace shp = yocto::shape;
+
+#include <memory>
+using namespace std::string_literals;
+
+#include <yocto/ext/filesystem.hpp>
+namespace sfs = ghc::filesystem;
+
+// Benchmark scene parameters
+struct lights_params {
+  int   num    = 4096;  // number of emitters
+  int   colors = 8;     // number of emitter materials
+  float size   = 0.02;  // emitter radius
+  float power  = 4096;  // total emission, split among emitters
+  int   seed   = 7;
+};
+
+// Make a scene lit by many small emitters scattered above a floor with a few
+// occluders. Emitters of the same color share a shape and an instance, so
+// the scene stays small on disk even with thousands of lights.
+void make_lights_scene(sio::model* scene, const lights_params& params) {
+  scene->name      = "lights";
+  auto camera      = add_camera(scene, "camera");
+  camera->frame    = lookat_frame(vec3f{0, 3, 6}, vec3f{0, 0.3, 0}, {0, 1, 0});
+  camera->lens     = 0.035;
+  camera->aspect   = 16.0f / 9.0f;
+  camera->film     = 0.036;
+  camera->focus    = length(vec3f{0, 3, 6} - vec3f{0, 0.3, 0});
+  auto floor       = add_complete_object(scene, "floor");
+  shp::make_floor(floor->shape->quads, floor->shape->positions,
+      floor->shape->normals, floor->shape->texcoords, {1, 1}, {8, 8});
+  floor->material->color = {0.7, 0.7, 0.7};
+  auto rng               = make_rng(params.seed);
+  for (auto idx = 0; idx < 6; idx++) {
+    auto occluder = add_complete_object(scene, "occluder" + std::to_string(idx));
+    shp::make_box(occluder->shape->quads, occluder->shape->positions,
+        occluder->shape->normals, occluder->shape->texcoords, {1, 1, 1},
+        {0.3, 0.6, 0.3});
+    occluder->frame = translation_frame(
+        {rand1f(rng) * 6 - 3, 0.6, rand1f(rng) * 6 - 3});
+    occluder->material->color = {0.5, 0.5, 0.6};
+  }
+  auto emission = params.power / max(params.num, 1) /
+                  (4 * pif * params.size * params.size);
+  auto emitters = std::vector<sio::object*>{};
+  for (auto idx = 0; idx < params.colors; idx++) {
+    auto name    = "emitter" + std::to_string(idx);
+    auto emitter = add_complete_object(scene, name);
+    shp::make_sphere(emitter->shape->quads, emitter->shape->positions,
+        emitter->shape->normals, emitter->shape->texcoords, 4, params.size);
+    auto hue                   = (float)idx / params.colors;
+    emitter->material->emission = emission * hsv_to_rgb({hue, 0.6, 1});
+    emitter->material->color    = {0, 0, 0};
+    emitter->instance           = add_instance(scene, name);
+    emitters.push_back(emitter);
+  }
+  for (auto idx = 0; idx < params.num; idx++) {
+    auto emitter = emitters[sample_uniform(emitters.size(), rand1f(rng))];
+    emitter->instance->frames.push_back(translation_frame({rand1f(rng) * 8 - 4,
+        params.size + rand1f(rng) * 1.5f, rand1f(rng) * 8 - 4}));
+  }
+}
+
+void make_dir(const std::string& dirname) {
+  if (dirname.empty() || sfs::exists(dirname)) return;
+  try {
+    sfs::create_directories(dirname);
+  } catch (...) {
+    cli::print_fatal("cannot create directory " + dirname);
+  }
+}
+
+int main(int argc, const char* argv[]) {
+  // command line parameters
+  auto params = lights_params{};
+  auto output = "lights/lights.json"s;
+
+  // parse command line
+  auto cli = cli::make_cli(
+      "yscenelights", "Make a benchmark scene with many small emitters");
+  add_option(cli, "--lights,-n", params.num, "Number of emitters.");
+  add_option(cli, "--colors", params.colors, "Number of emitter colors.");
+  add_option(cli, "--size", params.size, "Emitter radius.");
+  add_option(cli, "--power", params.power, "Total emitted power.");
+  add_option(cli, "--seed", params.seed, "Random seed.");
+  add_option(cli, "--output,-o", output, "Output scene.");
+  parse_cli(cli, argc, argv);
+
+  // make scene
+  auto scene_guard = std::make_unique<sio::model>();
+  auto scene       = scene_guard.get();
+  make_lights_scene(scene, params);
+
+  // make directories
+  auto dirname = sfs::path(output).parent_path();
+  make_dir(dirname);
+  make_dir(dirname / "shapes");
+  make_dir(dirname / "instances");
+
+  // save scene
+  auto ioerror = ""s;
+  if (!save_scene(output, scene, ioerror, cli::print_progress))
+    cli::print_fatal(ioerror);
+
+  // done
+  return 0;
+}
@@ -198,6 +198,7 @@
 #include <algorithm>
 #include <array>
 #include <cmath>
+#include <cstring>
 #include <functional>
 #include <limits>
 #include <vector>
@@ -979,6 +980,9 @@ inline frame3f& operator*=(frame3f& a, const frame3f& b);
 // Frame inverse, equivalent to rigid affine inverse.
 inline frame3f inverse(const frame3f& a, bool non_rigid = false);
 
+// Check whether a frame rotation is orthonormal, so its inverse is rigid.
+inline bool is_rigid(const frame3f& a, float tolerance = 1e-5f);
+
 // Frame construction from axis.
 inline frame3f frame_fromz(const vec3f& o, const vec3f& v);
 inline frame3f frame_fromzx(const vec3f& o, const vec3f& z_, const vec3f& x_);
@@ -1343,6 +1347,10 @@ inline float  byte_to_float(byte a);
 inline ushort float_to_ushort(float a);
 inline float  ushort_to_float(ushort a);
 
+// Conversion between floats and half-precision floats stored as ushorts.
+inline ushort float_to_half(float a);
+inline float  half_to_float(ushort a);
+
 // Luminance
 inline float luminance(const vec3f& a);
 
@@ -1354,6 +1362,10 @@ inline vec4f srgb_to_rgb(const vec4f& srgb);
 inline vec3f rgb_to_srgb(const vec3f& rgb);
 inline vec4f rgb_to_srgb(const vec4f& rgb);
 
+// sRGB non-linear curve for bytes, evaluated with a precomputed table.
+inline float srgbb_to_rgb(byte srgb);
+inline vec3f srgbb_to_rgb(const vec3b& srgb);
+
 // Apply contrast. Grey should be 0.18 for linear and 0.5 for gamma.
 inline vec3f lincontrast(const vec3f& rgb, float contrast, float grey);
 // Apply contrast in log2. Grey should be 0.18 for linear and 0.5 for gamma.
@@ -1687,6 +1699,24 @@ inline int sample_discrete(const std::vector<float>& cdf, float r);
 // Pdf for uniform discrete distribution sampling.
 inline float sample_discrete_pdf(const std::vector<float>& cdf, int idx);
 
+// Alias table for sampling a discrete distribution in constant time. Each
+// bin is kept with probability `prob` or redirected to its `alias`, while
+// `pdf` stores the normalized probability of each bin.
+struct alias_table {
+  std::vector<float> prob  = {};
+  std::vector<int>   alias = {};
+  std::vector<float> pdf   = {};
+};
+
+// Build an alias table from non-negative weights. The table is empty if all
+// weights are zero.
+inline alias_table make_alias_table(const std::vector<float>& weights);
+// Sample an alias table, using `r` to pick a bin and `ralias` to choose
+// between the bin and its alias.
+inline int sample_alias(const alias_table& table, float r, float ralias);
+// Pdf for alias table sampling.
+inline float sample_alias_pdf(const alias_table& table, int idx);
+
 }  // namespace yocto::math
 
 // -----------------------------------------------------------------------------
@@ -2843,6 +2873,14 @@ inline frame3f inverse(const frame3f& a, bool non_rigid) {
   }
 }
 
+// Check whether a frame rotation is orthonormal.
+inline bool is_rigid(const frame3f& a, float tolerance) {
+  return abs(dot(a.x, a.x) - 1) < tolerance &&
+         abs(dot(a.y, a.y) - 1) < tolerance &&
+         abs(dot(a.z, a.z) - 1) < tolerance && abs(dot(a.x, a.y)) < tolerance &&
+         abs(dot(a.y, a.z)) < tolerance && abs(dot(a.z, a.x)) < tolerance;
+}
+
 // Frame construction from axis.
 inline frame3f frame_fromz(const vec3f& o, const vec3f& v) {
   // https://graphics.pixar.com/library/OrthonormalB/paper.pdf
@@ -3692,6 +3730,37 @@ inline ushort float_to_ushort(float a) {
 }
 inline float ushort_to_float(ushort a) { return a / 65535.0f; }
 
+inline ushort float_to_half(float a) {
+  auto bits = (uint32_t)0;
+  memcpy(&bits, &a, sizeof(bits));
+  auto sign = (ushort)((bits >> 16) & 0x8000);
+  auto exp  = (int)((bits >> 23) & 0xff) - 127 + 15;
+  auto mant = bits & 0x7fffff;
+  if (((bits >> 23) & 0xff) == 0xff)
+    return sign | 0x7c00 | (mant ? 0x200 : 0);  // inf and nan
+  if (exp >= 31) return sign | 0x7c00;          // overflow
+  if (exp <= 0) {                               // denormals and underflow
+    if (exp < -10) return sign;
+    mant = (mant | 0x800000) >> (1 - exp);
+    return sign | (ushort)((mant + 0x1000) >> 13);
+  }
+  return sign | (ushort)((exp << 10) + ((mant + 0x1000) >> 13));
+}
+inline float half_to_float(ushort a) {
+  auto sign = (uint32_t)(a & 0x8000) << 16;
+  auto exp  = (uint32_t)(a >> 10) & 0x1f;
+  auto mant = (uint32_t)(a & 0x3ff);
+  if (exp == 0) {
+    auto value = mant * (1.0f / (1 << 24));
+    return sign ? -value : value;
+  }
+  auto bits = sign | (exp == 31 ? 0x7f800000 : (exp + 112) << 23) |
+              (mant << 13);
+  auto value = 0.0f;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
 // Luminance
 inline float luminance(const vec3f& a) {
   return (0.2126f * a.x + 0.7152f * a.y + 0.0722f * a.z);
@@ -3720,6 +3789,19 @@ inline vec4f rgb_to_srgb(const vec4f& rgb) {
   return {rgb_to_srgb(rgb.x), rgb_to_srgb(rgb.y), rgb_to_srgb(rgb.z), rgb.w};
 }
 
+// sRGB non-linear curve for bytes
+inline float srgbb_to_rgb(byte srgb) {
+  static const auto table = []() {
+    auto table = std::array<float, 256>{};
+    for (auto i = 0; i < 256; i++) table[i] = srgb_to_rgb(i / 255.0f);
+    return table;
+  }();
+  return table[srgb];
+}
+inline vec3f srgbb_to_rgb(const vec3b& srgb) {
+  return {srgbb_to_rgb(srgb.x), srgbb_to_rgb(srgb.y), srgbb_to_rgb(srgb.z)};
+}
+
 // Apply contrast. Grey should be 0.18 for linear and 0.5 for gamma.
 inline vec3f lincontrast(const vec3f& rgb, float contrast, float grey) {
   return max(zero3f, grey + (rgb - grey) * (contrast * 2));
@@ -4820,6 +4902,54 @@ inline float sample_discrete_pdf(const std::vector<float>& cdf, int idx) {
   return cdf.at(idx) - cdf.at(idx - 1);
 }
 
+// Build an alias table from non-negative weights with Vose's method.
+inline alias_table make_alias_table(const std::vector<float>& weights) {
+  auto total = 0.0;
+  for (auto weight : weights) total += weight;
+  if (total <= 0) return {};
+  auto size   = (int)weights.size();
+  auto table  = alias_table{std::vector<float>(size, 1),
+      std::vector<int>(size), std::vector<float>(size)};
+  auto scaled = std::vector<double>(size);
+  auto small  = std::vector<int>{};
+  auto large  = std::vector<int>{};
+  for (auto idx = 0; idx < size; idx++) {
+    table.pdf[idx]   = (float)(weights[idx] / total);
+    table.alias[idx] = idx;
+    scaled[idx]      = weights[idx] / total * size;
+    if (scaled[idx] < 1) {
+      small.push_back(idx);
+    } else {
+      large.push_back(idx);
+    }
+  }
+  while (!small.empty() && !large.empty()) {
+    auto sidx = small.back(), lidx = large.back();
+    small.pop_back();
+    table.prob[sidx]  = (float)scaled[sidx];
+    table.alias[sidx] = lidx;
+    scaled[lidx] -= 1 - scaled[sidx];
+    if (scaled[lidx] < 1) {
+      large.pop_back();
+      small.push_back(lidx);
+    }
+  }
+  // bins left in either list are full up to round-off
+  return table;
+}
+
+// Sample an alias table. Two random numbers are used since the fraction of a
+// single float scaled by a large table size has too few bits left.
+inline int sample_alias(const alias_table& table, float r, float ralias) {
+  auto size = (int)table.prob.size();
+  auto idx  = clamp((int)(r * size), 0, size - 1);
+  return ralias < table.prob[idx] ? idx : table.alias[idx];
+}
+// Pdf for alias table sampling.
+inline float sample_alias_pdf(const alias_table& table, int idx) {
+  return table.pdf.at(idx);
+}
+
 }  // namespace yocto::math
 
 // -----------------------------------------------------------------------------
@@ -34,6 +34,7 @@
 #include <future>
 #include <memory>
 #include <mutex>
+#include <unordered_map>
 using namespace std::string_literals;
 
 #ifdef YOCTO_EMBREE
@@ -49,6 +50,7 @@ namespace yocto::trace {
 using math::abs;
 using math::acos;
 using math::atan2;
+using math::byte_to_float;
 using math::clamp;
 using math::cos;
 using math::exp;
@@ -59,12 +61,15 @@ using math::fresnel_dielectric;
 using math::identity3x3f;
 using math::invalidb3f;
 using math::log;
+using math::make_alias_table;
 using math::make_rng;
 using math::max;
 using math::min;
 using math::pif;
 using math::pow;
 using math::rng_state;
+using math::sample_alias;
+using math::sample_alias_pdf;
 using math::sample_discrete;
 using math::sample_discrete_pdf;
 using math::sample_uniform;
@@ -72,6 +77,7 @@ using math::sample_uniform_pdf;
 using math::sign;
 using math::sin;
 using math::sqrt;
+using math::srgbb_to_rgb;
 using math::zero2f;
 using math::zero2i;
 using math::zero3f;
@@ -212,35 +218,28 @@ static T eval_shape(const trc::shape* shape, const std::vector<T>& vals,
 
 // Check texture size
 static vec2i texture_size(const trc::texture* texture) {
-  if (!texture->colorf.empty()) {
-    return texture->colorf.size();
-  } else if (!texture->colorb.empty()) {
-    return texture->colorb.size();
-  } else if (!texture->scalarf.empty()) {
-    return texture->scalarf.size();
-  } else if (!texture->scalarb.empty()) {
-    return texture->scalarb.size();
-  } else {
-    return zero2i;
+  switch (texture->type) {
+    case texture_type::colorf: return texture->colorf.size();
+    case texture_type::colorb: return texture->colorb.size();
+    case texture_type::scalarf: return texture->scalarf.size();
+    case texture_type::scalarb: return texture->scalarb.size();
+    default: return zero2i;
   }
 }
 
 // Evaluate a texture
 static vec3f lookup_texture(
     const trc::texture* texture, const vec2i& ij, bool ldr_as_linear = false) {
-  if (!texture->colorf.empty()) {
-    return texture->colorf[ij];
-  } else if (!texture->colorb.empty()) {
-    return ldr_as_linear ? byte_to_float(texture->colorb[ij])
-                         : srgb_to_rgb(byte_to_float(texture->colorb[ij]));
-  } else if (!texture->scalarf.empty()) {
-    return vec3f{texture->scalarf[ij]};
-  } else if (!texture->scalarb.empty()) {
-    return ldr_as_linear
-               ? byte_to_float(vec3b{texture->scalarb[ij]})
-               : srgb_to_rgb(byte_to_float(vec3b{texture->scalarb[ij]}));
-  } else {
-    return {1, 1, 1};
+  switch (texture->type) {
+    case texture_type::colorf: return texture->colorf[ij];
+    case texture_type::colorb:
+      return ldr_as_linear ? byte_to_float(texture->colorb[ij])
+                           : srgbb_to_rgb(texture->colorb[ij]);
+    case texture_type::scalarf: return vec3f{texture->scalarf[ij]};
+    case texture_type::scalarb:
+      return vec3f{ldr_as_linear ? byte_to_float(texture->scalarb[ij])
+                                 : srgbb_to_rgb(texture->scalarb[ij])};
+    default: return {1, 1, 1};
   }
 }
 
@@ -1029,7 +1028,8 @@ const int bvh_max_prims = 4;
 
 // Build BVH nodes
 static void build_bvh_serial(std::vector<bvh_node>& nodes,
-    std::vector<bvh_primitive>& primitives, bvh_type type) {
+    std::vector<bvh_primitive>& primitives, bvh_type type,
+    int max_prims = bvh_max_prims) {
   // prepare to build nodes
   nodes.clear();
   nodes.reserve(primitives.size() * 2);
@@ -1054,7 +1054,7 @@ static void build_bvh_serial(std::vector<bvh_node>& nodes,
       node.bbox = merge(node.bbox, primitives[i].bbox);
 
     // split into two children
-    if (end - start > bvh_max_prims) {
+    if (end - start > max_prims) {
       // get split
       auto [mid, axis] = split_nodes(primitives, start, end, type);
 
@@ -1312,6 +1312,15 @@ void init_bvh(trc::scene* scene, const trace_params& params,
     scene->bvh->primitives.push_back(primitive.primitive);
   }
 
+  // cache inverse frames, using the transpose for rigid ones
+  scene->bvh_inv_frames.resize(scene->bvh->primitives.size());
+  for (auto idx = 0; idx < scene->bvh->primitives.size(); idx++) {
+    auto [object_id, instance_id] = scene->bvh->primitives[idx];
+    auto object                   = scene->objects[object_id];
+    auto frame = object->instance->frames[instance_id] * object->frame;
+    scene->bvh_inv_frames[idx] = inverse(frame, !is_rigid(frame));
+  }
+
   // handle progress
   if (progress_cb) progress_cb("build bvh", progress.x++, progress.y);
 }
@@ -1371,15 +1380,15 @@ void update_bvh(trc::scene*            scene,
   }
 #endif
 
-  // build primitives
+  // build primitives and refresh inverse frames
   auto bboxes = std::vector<bbox3f>(scene->bvh->primitives.size());
   for (auto idx = 0; idx < bboxes.size(); idx++) {
     auto instance = scene->bvh->primitives[idx];
     auto object   = scene->objects[instance.x];
     auto sbvh     = object->shape->bvh;
-    bboxes[idx]   = transform_bbox(
-        object->instance->frames[instance.y] * object->frame,
-        sbvh->nodes[0].bbox);
+    auto frame    = object->instance->frames[instance.y] * object->frame;
+    bboxes[idx]   = transform_bbox(frame, sbvh->nodes[0].bbox);
+    scene->bvh_inv_frames[idx] = inverse(frame, !is_rigid(frame));
   }
 
   // update nodes
@@ -1492,7 +1501,7 @@ static bool intersect_shape_bvh(trc::shape* shape, const ray3f& ray_,
 // Intersect ray with a bvh->
 static bool intersect_scene_bvh(const trc::scene* scene, const ray3f& ray_,
     int& objecct, int& instance, int& element, vec2f& uv, float& distance,
-    bool find_any, bool non_rigid_frames) {
+    bool find_any) {
 #ifdef YOCTO_EMBREE
   // call Embree if needed
   if (scene->embree_bvh) {
@@ -1548,8 +1557,7 @@ static bool intersect_scene_bvh(const trc::scene* scene, const ray3f& ray_,
       for (auto idx = node.start; idx < node.start + node.num; idx++) {
         auto [object_id, instance_id] = scene->bvh->primitives[idx];
         auto object                   = scene->objects[object_id];
-        auto frame   = object->instance->frames[instance_id] * object->frame;
-        auto inv_ray = transform_ray(inverse(frame, non_rigid_frames), ray);
+        auto inv_ray = transform_ray(scene->bvh_inv_frames[idx], ray);
         if (intersect_shape_bvh(
                 object->shape, inv_ray, element, uv, distance, find_any)) {
           hit      = true;
@@ -1577,12 +1585,12 @@ static bool intersect_instance_bvh(const trc::object* object, int instance,
       object->shape, inv_ray, element, uv, distance, find_any);
 }
 
-intersection3f intersect_scene_bvh(const trc::scene* scene, const ray3f& ray,
-    bool find_any, bool non_rigid_frames) {
+intersection3f intersect_scene_bvh(
+    const trc::scene* scene, const ray3f& ray, bool find_any) {
   auto intersection = intersection3f{};
   intersection.hit  = intersect_scene_bvh(scene, ray, intersection.object,
       intersection.instance, intersection.element, intersection.uv,
-      intersection.distance, find_any, non_rigid_frames);
+      intersection.distance, find_any);
   return intersection;
 }
 intersection3f intersect_instance_bvh(const trc::object* object, int instance,
@@ -1870,27 +1878,29 @@ static float sample_scattering_pdf(const volume_point& point) {
 }
 
 // Sample lights wrt solid angle
+// Lights are picked by power with the alias table built in `init_lights()`.
 static vec3f sample_lights(const trc::scene* scene, const vec3f& position,
-    float rl, float rel, const vec2f& ruv) {
-  auto  light_id = sample_uniform(scene->lights.size(), rl);
+    const vec2f& rl, const vec2f& rel, const vec2f& ruv) {
+  if (scene->lights_alias.prob.empty()) return zero3f;
+  auto  light_id = sample_alias(scene->lights_alias, rl.x, rl.y);
   auto& light    = scene->lights[light_id];
   if (light->object) {
     auto& object    = light->object;
     auto  shape     = object->shape;
     auto  frame     = object->instance->frames[light->instance] * object->frame;
-    auto  element   = sample_discrete(shape->elements_cdf, rel);
+    auto  element   = sample_discrete(shape->elements_cdf, rel.x);
     auto  uv        = (!shape->triangles.empty()) ? sample_triangle(ruv) : ruv;
     auto  lposition = transform_point(
         frame, eval_shape(shape, shape->positions, element, uv, zero3f));
     return normalize(lposition - position);
   } else if (light->environment) {
     auto& environment = light->environment;
-    if (environment->emission_tex) {
+    if (!environment->texels_alias.prob.empty()) {
       auto emission_tex = environment->emission_tex;
-      auto idx          = sample_discrete(environment->texels_cdf, rel);
-      auto size         = texture_size(emission_tex);
+      auto idx  = sample_alias(environment->texels_alias, rel.x, rel.y);
+      auto size = texture_size(emission_tex);
       auto uv           = vec2f{
-          (idx % size.x + 0.5f) / size.x, (idx / size.x + 0.5f) / size.y};
+          (idx % size.x + ruv.x) / size.x, (idx / size.x + ruv.y) / size.y};
       return transform_direction(environment->frame,
           {cos(uv.x * 2 * pif) * sin(uv.y * pif), cos(uv.y * pif),
               sin(uv.x * 2 * pif) * sin(uv.y * pif)});
@@ -1902,57 +1912,123 @@ static vec3f sample_lights(const trc::scene* scene, const vec3f& position,
   }
 }
 
-// Sample lights pdf
+// Ratio between the world and local area of a light element. Elements are
+// sampled by local area, so this converts their density to world area.
+static float eval_element_scale(
+    const trc::shape* shape, const frame3f& frame, int element) {
+  if (is_rigid(frame)) return 1;
+  auto world_area = 0.0f, local_area = 0.0f;
+  if (!shape->triangles.empty()) {
+    auto& t    = shape->triangles[element];
+    local_area = triangle_area(
+        shape->positions[t.x], shape->positions[t.y], shape->positions[t.z]);
+    world_area = triangle_area(transform_point(frame, shape->positions[t.x]),
+        transform_point(frame, shape->positions[t.y]),
+        transform_point(frame, shape->positions[t.z]));
+  } else if (!shape->quads.empty()) {
+    auto& q    = shape->quads[element];
+    local_area = quad_area(shape->positions[q.x], shape->positions[q.y],
+        shape->positions[q.z], shape->positions[q.w]);
+    world_area = quad_area(transform_point(frame, shape->positions[q.x]),
+        transform_point(frame, shape->positions[q.y]),
+        transform_point(frame, shape->positions[q.z]),
+        transform_point(frame, shape->positions[q.w]));
+  }
+  return local_area != 0 ? world_area / local_area : 1;
+}
+
+// Pdf of sampling an object light wrt solid angle, for all its surfaces
+// crossed by the direction.
+static float sample_object_light_pdf(
+    const trc::light* light, const vec3f& position, const vec3f& direction) {
+  auto  pdf           = 0.0f;
+  auto  next_position = position;
+  auto& object        = light->object;
+  auto  frame = object->instance->frames[light->instance] * object->frame;
+  for (auto bounce = 0; bounce < 100; bounce++) {
+    auto intersection = intersect_instance_bvh(
+        light->object, light->instance, {next_position, direction});
+    if (!intersection.hit) break;
+    // accumulate pdf
+    auto lposition = transform_point(
+        frame, eval_shape(object->shape, object->shape->positions,
+                   intersection.element, intersection.uv, zero3f));
+    auto lnormal = transform_normal(frame,
+        eval_normal(object->shape, intersection.element), non_rigid_frames);
+    // prob triangle * area triangle = area triangle mesh, in world space
+    auto area = object->shape->elements_cdf.back() *
+                eval_element_scale(object->shape, frame, intersection.element);
+    pdf += distance_squared(lposition, position) /
+           (abs(dot(lnormal, direction)) * area);
+    // continue
+    next_position = lposition + direction * 1e-3f;
+  }
+  return pdf;
+}
+
+// Pdf of sampling an environment light wrt solid angle.
+static float sample_environment_light_pdf(
+    const trc::light* light, const vec3f& direction) {
+  auto& environment = light->environment;
+  if (environment->texels_alias.prob.empty()) return 1 / (4 * pif);
+  auto emission_tex = environment->emission_tex;
+  auto size         = texture_size(emission_tex);
+  auto wl = transform_direction(inverse(environment->frame), direction);
+  auto texcoord = vec2f{
+      atan2(wl.z, wl.x) / (2 * pif), acos(clamp(wl.y, -1.0f, 1.0f)) / pif};
+  if (texcoord.x < 0) texcoord.x += 1;
+  auto i    = clamp((int)(texcoord.x * size.x), 0, size.x - 1);
+  auto j    = clamp((int)(texcoord.y * size.y), 0, size.y - 1);
+  auto prob = sample_alias_pdf(environment->texels_alias, j * size.x + i);
+  // texels are sampled uniformly in uv, so use the sine at the sample
+  auto sin_theta = sqrt(max(1 - wl.y * wl.y, 0.0f));
+  if (sin_theta == 0) return 0;
+  return prob / ((2 * pif / size.x) * (pif / size.y) * sin_theta);
+}
+
+// Sample lights pdf. Object lights are found by walking the light bvh, so
+// only the lights whose bounds are crossed by the direction are tested.
 static float sample_lights_pdf(
     const trc::scene* scene, const vec3f& position, const vec3f& direction) {
+  auto& lights_alias = scene->lights_alias;
+  if (lights_alias.prob.empty() || direction == zero3f) return 0;
   auto pdf = 0.0f;
-  for (auto& light : scene->lights) {
-    if (light->object) {
-      // check all intersection
-      auto  lpdf          = 0.0f;
-      auto  next_position = position;
-      auto& object        = light->object;
-      auto  frame = object->instance->frames[light->instance] * object->frame;
-      for (auto bounce = 0; bounce < 100; bounce++) {
-        auto intersection = intersect_instance_bvh(
-            light->object, light->instance, {next_position, direction});
-        if (!intersection.hit) break;
-        // accumulate pdf
-        auto lposition = transform_point(
-            frame, eval_shape(object->shape, object->shape->positions,
-                       intersection.element, intersection.uv, zero3f));
-        auto lnormal = transform_normal(frame,
-            eval_normal(object->shape, intersection.element), non_rigid_frames);
-        // prob triangle * area triangle = area triangle mesh
-        auto area = object->shape->elements_cdf.back();
-        lpdf += distance_squared(lposition, position) /
-                (abs(dot(lnormal, direction)) * area);
-        // continue
-        next_position = lposition + direction * 1e-3f;
-      }
-      pdf += lpdf;
-    } else if (light->environment) {
-      auto& environment = light->environment;
-      if (environment->emission_tex) {
-        auto& cdf          = environment->texels_cdf;
-        auto  emission_tex = environment->emission_tex;
-        auto  size         = texture_size(emission_tex);
-        auto  wl = transform_direction(inverse(environment->frame), direction);
-        auto  texcoord = vec2f{atan2(wl.z, wl.x) / (2 * pif),
-            acos(clamp(wl.y, -1.0f, 1.0f)) / pif};
-        if (texcoord.x < 0) texcoord.x += 1;
-        auto i     = clamp((int)(texcoord.x * size.x), 0, size.x - 1);
-        auto j     = clamp((int)(texcoord.y * size.y), 0, size.y - 1);
-        auto prob  = sample_discrete_pdf(cdf, j * size.x + i) / cdf.back();
-        auto angle = (2 * pif / size.x) * (pif / size.y) *
-                     sin(pif * (j + 0.5f) / size.y);
-        pdf += prob / angle;
+
+  // object lights
+  auto bvh = scene->lights_bvh;
+  if (bvh && !bvh->nodes.empty()) {
+    // balanced splits bound the depth by log2 of the lights
+    int  node_stack[128];
+    auto node_cur          = 0;
+    node_stack[node_cur++] = 0;
+    auto ray               = ray3f{position, direction};
+    auto ray_dinv          = vec3f{1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z};
+    while (node_cur) {
+      auto& node = bvh->nodes[node_stack[--node_cur]];
+      if (!intersect_bbox(ray, ray_dinv, node.bbox)) continue;
+      if (node.internal) {
+        node_stack[node_cur++] = node.start + 0;
+        node_stack[node_cur++] = node.start + 1;
       } else {
-        pdf += 1 / (4 * pif);
+        for (auto idx = node.start; idx < node.start + node.num; idx++) {
+          auto light_id = bvh->primitives[idx].x;
+          pdf += sample_object_light_pdf(
+                     scene->lights[light_id], position, direction) *
+                 sample_alias_pdf(lights_alias, light_id);
+        }
       }
     }
   }
-  pdf *= sample_uniform_pdf(scene->lights.size());
+
+  // environment lights, which are added after all object lights
+  for (auto light_id = (int)scene->lights.size() - 1; light_id >= 0;
+       light_id--) {
+    auto light = scene->lights[light_id];
+    if (!light->environment) break;
+    pdf += sample_environment_light_pdf(light, direction) *
+           sample_alias_pdf(lights_alias, light_id);
+  }
+
   return pdf;
 }
 
@@ -2017,7 +2093,7 @@ static std::pair<vec3f, bool> trace_path(const trc::scene* scene,
           point.incoming = sample_brdf(point, rand1f(rng), rand2f(rng));
         } else {
           point.incoming = sample_lights(
-              scene, point.position, rand1f(rng), rand1f(rng), rand2f(rng));
+              scene, point.position, rand2f(rng), rand2f(rng), rand2f(rng));
         }
         weight *= eval_brdfcos(point) /
                   (0.5f * sample_brdf_pdf(point) +
@@ -2060,7 +2136,7 @@ static std::pair<vec3f, bool> trace_path(const trc::scene* scene,
         point.incoming = sample_scattering(point, rand1f(rng), rand2f(rng));
       } else {
         point.incoming = sample_lights(
-            scene, point.position, rand1f(rng), rand1f(rng), rand2f(rng));
+            scene, point.position, rand2f(rng), rand2f(rng), rand2f(rng));
       }
       weight *=
           eval_scattering(point) /
@@ -2251,6 +2327,7 @@ using sampler_func = std::pair<vec3f, bool> (*)(const trc::scene* scene,
 static sampler_func get_trace_sampler_func(const trace_params& params) {
   switch (params.sampler) {
     case sampler_type::path: return trace_path;
+    case sampler_type::wavefront: return trace_path;
     case sampler_type::naive: return trace_naive;
     case sampler_type::eyelight: return trace_eyelight;
     case sampler_type::falsecolor: return trace_falsecolor;
@@ -2265,6 +2342,7 @@ static sampler_func get_trace_sampler_func(const trace_params& params) {
 bool is_sampler_lit(const trace_params& params) {
   switch (params.sampler) {
     case sampler_type::path: return true;
+    case sampler_type::wavefront: return true;
     case sampler_type::naive: return true;
     case sampler_type::eyelight: return false;
     case sampler_type::falsecolor: return false;
@@ -2321,6 +2399,28 @@ void init_state(trc::state* state, const trc::scene* scene,
 
 // Forward declaration
 trc::light* add_light(trc::scene* scene);
+template <typename Func>
+inline void parallel_for(const vec2i& size, Func&& func);
+
+// World space area of an object light. Rigid frames preserve the area
+// already stored in the element cdf.
+static float eval_light_area(const trc::object* object, const frame3f& frame) {
+  auto shape = object->shape;
+  if (is_rigid(frame)) return shape->elements_cdf.back();
+  auto area = 0.0f;
+  for (auto& t : shape->triangles) {
+    area += triangle_area(transform_point(frame, shape->positions[t.x]),
+        transform_point(frame, shape->positions[t.y]),
+        transform_point(frame, shape->positions[t.z]));
+  }
+  for (auto& q : shape->quads) {
+    area += quad_area(transform_point(frame, shape->positions[q.x]),
+        transform_point(frame, shape->positions[q.y]),
+        transform_point(frame, shape->positions[q.z]),
+        transform_point(frame, shape->positions[q.w]));
+  }
+  return area;
+}
 
 // Init trace lights
 void init_lights(trc::scene* scene, progress_callback progress_cb) {
@@ -2331,6 +2431,10 @@ void init_lights(trc::scene* scene, progress_callback progress_cb) {
   for (auto light : scene->lights) delete light;
   scene->lights.clear();
 
+  // object light bounds and light power
+  auto primitives = std::vector<bvh_primitive>{};
+  auto weights    = std::vector<float>{};
+
   for (auto object : scene->objects) {
     if (object->material->emission == zero3f) continue;
     auto shape = object->shape;
@@ -2355,7 +2459,16 @@ void init_lights(trc::scene* scene, progress_callback progress_cb) {
         if (idx) shape->elements_cdf[idx] += shape->elements_cdf[idx - 1];
       }
     }
+    auto bbox = invalidb3f;
+    for (auto& position : shape->positions) bbox = merge(bbox, position);
     for (auto iidx = 0; iidx < object->instance->frames.size(); iidx++) {
+      auto frame = object->instance->frames[iidx] * object->frame;
+      auto& primitive     = primitives.emplace_back();
+      primitive.bbox      = transform_bbox(frame, bbox);
+      primitive.center    = center(primitive.bbox);
+      primitive.primitive = {(int)scene->lights.size(), 0};
+      weights.push_back(mean(object->material->emission) *
+                        eval_light_area(object, frame));
       auto light         = add_light(scene);
       light->object      = object;
       light->instance    = iidx;
@@ -2366,18 +2479,15 @@ void init_lights(trc::scene* scene, progress_callback progress_cb) {
     if (environment->emission == zero3f) continue;
     if (progress_cb) progress_cb("build light", progress.x++, ++progress.y);
     if (environment->emission_tex) {
-      auto texture            = environment->emission_tex;
-      auto size               = texture_size(texture);
-      environment->texels_cdf = std::vector<float>(size.x * size.y);
-      if (size != zero2i) {
-        for (auto i = 0; i < environment->texels_cdf.size(); i++) {
-          auto ij                    = vec2i{i % size.x, i / size.x};
-          auto th                    = (ij.y + 0.5f) * pif / size.y;
-          auto value                 = lookup_texture(texture, ij);
-          environment->texels_cdf[i] = max(value) * sin(th);
-          if (i) environment->texels_cdf[i] += environment->texels_cdf[i - 1];
-        }
-      }
+      auto texture = environment->emission_tex;
+      auto size    = texture_size(texture);
+      auto texels  = std::vector<float>(size.x * size.y);
+      parallel_for(size, [&](const vec2i& ij) {
+        auto th = (ij.y + 0.5f) * pif / size.y;
+        texels[ij.y * size.x + ij.x] = max(lookup_texture(texture, ij)) *
+                                       sin(th);
+      });
+      environment->texels_alias = make_alias_table(texels);
     }
     auto light         = add_light(scene);
     light->object      = nullptr;
@@ -2385,6 +2495,29 @@ void init_lights(trc::scene* scene, progress_callback progress_cb) {
     light->environment = environment;
   }
 
+  // pick lights by power; the power of environments is not bounded, so they
+  // share half of the probability when object lights are present
+  auto num_objects   = (int)weights.size();
+  auto num_envs      = (int)scene->lights.size() - num_objects;
+  auto objects_power = 0.0f;
+  for (auto weight : weights) objects_power += weight;
+  for (auto idx = 0; idx < num_envs; idx++) {
+    weights.push_back(objects_power > 0 ? objects_power / num_envs : 1);
+  }
+  scene->lights_alias = make_alias_table(weights);
+
+  // bvh over object lights, used to evaluate pdfs; leaves hold one light so
+  // that their bounds cull lights before intersecting their shapes; splits
+  // are balanced so that the depth stays within the traversal stack
+  if (scene->lights_bvh) delete scene->lights_bvh;
+  scene->lights_bvh = new bvh_tree{};
+  build_bvh_serial(
+      scene->lights_bvh->nodes, primitives, bvh_type::balanced, 1);
+  scene->lights_bvh->primitives.reserve(primitives.size());
+  for (auto& primitive : primitives) {
+    scene->lights_bvh->primitives.push_back(primitive.primitive);
+  }
+
   // handle progress
   if (progress_cb) progress_cb("build light", progress.x++, progress.y);
 }
@@ -2413,6 +2546,309 @@ inline void parallel_for(const vec2i& size, Func&& func) {
   for (auto& f : futures) f.get();
 }
 
+// Simple parallel for over a range of indices, run in batches to keep the
+// atomic counter off the critical path. `Func` takes the integer index.
+template <typename Func>
+inline void parallel_for(int size, int batch, Func&& func) {
+  auto             futures  = std::vector<std::future<void>>{};
+  auto             nthreads = std::thread::hardware_concurrency();
+  std::atomic<int> next_idx(0);
+  for (auto thread_id = 0; thread_id < nthreads; thread_id++) {
+    futures.emplace_back(
+        std::async(std::launch::async, [&func, &next_idx, size, batch]() {
+          while (true) {
+            auto start = next_idx.fetch_add(batch);
+            if (start >= size) break;
+            auto end = min(start + batch, size);
+            for (auto idx = start; idx < end; idx++) func(idx);
+          }
+        }));
+  }
+  for (auto& f : futures) f.get();
+}
+
+// Paths in flight for the wavefront integrator, stored as structure of
+// arrays indexed by pixel. Each stage runs over a queue of path indices.
+struct wavefront_paths {
+  std::vector<ray3f>          ray           = {};
+  std::vector<intersection3f> intersection  = {};
+  std::vector<vec3f>          radiance      = {};
+  std::vector<vec3f>          weight        = {};
+  std::vector<float>          max_roughness = {};
+  std::vector<int>            bounce        = {};
+  std::vector<byte>           hit           = {};
+  std::vector<volume_point>   volume        = {};
+  std::vector<byte>           has_volume    = {};
+  std::vector<byte>           in_volume     = {};
+};
+
+// Run a wavefront stage over a queue of paths.
+template <typename Func>
+static void wavefront_stage(
+    const std::vector<int>& queue, const trace_params& params, Func&& func) {
+  if (params.noparallel) {
+    for (auto idx : queue) func(idx);
+  } else {
+    parallel_for((int)queue.size(), 256,
+        [&queue, &func](int qidx) { func(queue[qidx]); });
+  }
+}
+
+// Shade a surface hit and setup the next ray. This follows trace_path and
+// draws random numbers in the same order. Returns whether the path continues.
+static bool shade_wavefront_surface(const trc::scene* scene,
+    wavefront_paths& paths, int idx, rng_state& rng,
+    const trace_params& params) {
+  auto& ray          = paths.ray[idx];
+  auto& intersection = paths.intersection[idx];
+  auto& weight       = paths.weight[idx];
+
+  // prepare shading point
+  auto point = eval_point(scene, intersection, ray);
+
+  // correct roughness
+  if (params.nocaustics) {
+    paths.max_roughness[idx] = max(point.roughness, paths.max_roughness[idx]);
+    point.roughness          = paths.max_roughness[idx];
+  }
+
+  // handle opacity
+  if (point.opacity < 1 && rand1f(rng) >= point.opacity) {
+    ray = {point.position + ray.d * 1e-2f, ray.d};
+    return true;
+  }
+  paths.hit[idx] = true;
+
+  // accumulate emission
+  paths.radiance[idx] += weight * eval_emission(point);
+
+  // next direction
+  if (point.roughness) {
+    if (rand1f(rng) < 0.5f) {
+      point.incoming = sample_brdf(point, rand1f(rng), rand2f(rng));
+    } else {
+      point.incoming = sample_lights(
+          scene, point.position, rand2f(rng), rand2f(rng), rand2f(rng));
+    }
+    weight *= eval_brdfcos(point) /
+              (0.5f * sample_brdf_pdf(point) +
+                  0.5f * sample_lights_pdf(
+                             scene, point.position, point.incoming));
+  } else {
+    point.incoming = sample_delta(point, rand1f(rng));
+    weight *= eval_delta(point) / sample_delta_pdf(point);
+  }
+
+  // update volume stack
+  if (has_volume(scene, intersection) &&
+      dot(point.normal, point.outgoing) * dot(point.normal, point.incoming) <
+          0) {
+    if (!paths.has_volume[idx]) {
+      paths.volume[idx]     = eval_volume(scene, intersection, ray);
+      paths.has_volume[idx] = true;
+    } else {
+      paths.has_volume[idx] = false;
+    }
+  }
+
+  // setup next iteration
+  ray = {point.position, point.incoming};
+  return false;
+}
+
+// Shade a volume scattering event and setup the next ray.
+static void shade_wavefront_volume(const trc::scene* scene,
+    wavefront_paths& paths, int idx, rng_state& rng) {
+  auto& ray    = paths.ray[idx];
+  auto& weight = paths.weight[idx];
+
+  // prepare shading point
+  auto point     = paths.volume[idx];
+  point.outgoing = -ray.d;
+  point.position = ray.o + ray.d * paths.intersection[idx].distance;
+  paths.hit[idx] = true;
+
+  // accumulate emission
+  paths.radiance[idx] += weight * eval_volemission(point);
+
+  // next direction
+  if (rand1f(rng) < 0.5f) {
+    point.incoming = sample_scattering(point, rand1f(rng), rand2f(rng));
+  } else {
+    point.incoming = sample_lights(
+        scene, point.position, rand2f(rng), rand2f(rng), rand2f(rng));
+  }
+  weight *=
+      eval_scattering(point) /
+      (0.5f * sample_scattering_pdf(point) +
+          0.5f * sample_lights_pdf(scene, point.position, point.incoming));
+
+  // setup next iteration
+  ray = {point.position, point.incoming};
+}
+
+// Wavefront path tracing. Computes one sample for all pixels by running
+// the stages generate, intersect, shade and accumulate over queues of paths,
+// instead of running each path to completion. Surface hits are sorted by
+// material before shading so that each material is shaded coherently.
+// A stop request is checked between bounces and drops the current sample.
+// Since light samples continue the path, as in trace_path, there is no
+// separate shadow ray stage. Results match trace_path for the same seed.
+static void trace_wavefront(trc::state* state, const trc::scene* scene,
+    const trc::camera* camera, const trace_params& params) {
+  auto size      = state->pixels.size();
+  auto num_paths = size.x * size.y;
+
+  // paths in flight
+  auto paths = wavefront_paths{};
+  paths.ray.assign(num_paths, ray3f{});
+  paths.intersection.assign(num_paths, intersection3f{});
+  paths.radiance.assign(num_paths, zero3f);
+  paths.weight.assign(num_paths, vec3f{1, 1, 1});
+  paths.max_roughness.assign(num_paths, 0.0f);
+  paths.bounce.assign(num_paths, 0);
+  paths.hit.assign(num_paths, false);
+  paths.volume.assign(num_paths, volume_point{});
+  paths.has_volume.assign(num_paths, false);
+  paths.in_volume.assign(num_paths, false);
+
+  // material of each object, used to bin surface hits
+  auto material_ids = std::unordered_map<const trc::material*, int>{};
+  auto object_ids   = std::vector<int>(scene->objects.size());
+  for (auto idx = 0; idx < scene->objects.size(); idx++) {
+    auto material = scene->objects[idx]->material;
+    auto it       = material_ids.find(material);
+    if (it == material_ids.end())
+      it = material_ids.insert({material, (int)material_ids.size()}).first;
+    object_ids[idx] = it->second;
+  }
+  auto num_materials = (int)material_ids.size();
+
+  // queues
+  auto active  = std::vector<int>(num_paths);
+  auto surface = std::vector<int>{};
+  auto volume  = std::vector<int>{};
+  auto alive   = std::vector<byte>(num_paths, false);
+  auto counts  = std::vector<int>(num_materials + 1);
+  for (auto idx = 0; idx < num_paths; idx++) active[idx] = idx;
+
+  // generate camera rays
+  wavefront_stage(active, params, [&](int idx) {
+    auto& pixel    = state->pixels[idx];
+    auto  ij       = vec2i{idx % size.x, idx / size.x};
+    paths.ray[idx] = sample_camera(camera, ij, size, rand2f(pixel.rng),
+        rand2f(pixel.rng), params.tentfilter);
+  });
+
+  while (!active.empty()) {
+    // intersect rays and sample volume distances
+    wavefront_stage(active, params, [&](int idx) {
+      auto& intersection   = paths.intersection[idx];
+      intersection         = intersect_scene_bvh(scene, paths.ray[idx]);
+      paths.in_volume[idx] = false;
+      if (!intersection.hit) {
+        paths.radiance[idx] += paths.weight[idx] *
+                               eval_environment(scene, paths.ray[idx]);
+        return;
+      }
+      if (paths.has_volume[idx]) {
+        auto& rng                = state->pixels[idx].rng;
+        auto& voldensity         = paths.volume[idx].voldensity;
+        auto [distance, channel] = sample_distance(
+            voldensity, rand1f(rng), rand1f(rng));
+        distance = min(distance, intersection.distance);
+        paths.weight[idx] *= eval_transmission(voldensity, distance) /
+                             sample_distance_pdf(voldensity, distance, channel);
+        paths.in_volume[idx]  = distance < intersection.distance;
+        intersection.distance = distance;
+      }
+    });
+
+    // stop before shading, leaving the previous samples in the render
+    if (state->stop) return;
+
+    // bin surface hits by material with a counting sort
+    volume.clear();
+    std::fill(counts.begin(), counts.end(), 0);
+    for (auto idx : active) {
+      auto& intersection = paths.intersection[idx];
+      if (!intersection.hit) continue;
+      if (paths.in_volume[idx]) {
+        volume.push_back(idx);
+      } else {
+        counts[object_ids[intersection.object] + 1] += 1;
+      }
+    }
+    for (auto material = 0; material < num_materials; material++)
+      counts[material + 1] += counts[material];
+    surface.resize(counts.back());
+    for (auto idx : active) {
+      auto& intersection = paths.intersection[idx];
+      if (!intersection.hit || paths.in_volume[idx]) continue;
+      surface[counts[object_ids[intersection.object]]++] = idx;
+    }
+
+    // shade surfaces and volumes
+    auto next_bounce = [&](int idx, bool skip) {
+      auto& rng    = state->pixels[idx].rng;
+      auto& weight = paths.weight[idx];
+      if (skip) return true;
+      // check weight
+      if (weight == zero3f || !isfinite(weight)) return false;
+      // russian roulette
+      auto bounce = paths.bounce[idx]++;
+      if (max(weight) < 1 && bounce > 6) {
+        auto rr_prob = max((float)0.05, 1 - max(weight));
+        if (rand1f(rng) > rr_prob) return false;
+        weight *= 1 / rr_prob;
+      }
+      return paths.bounce[idx] < params.bounces;
+    };
+    wavefront_stage(surface, params, [&](int idx) {
+      auto skip = shade_wavefront_surface(
+          scene, paths, idx, state->pixels[idx].rng, params);
+      alive[idx] = next_bounce(idx, skip);
+    });
+    wavefront_stage(volume, params, [&](int idx) {
+      shade_wavefront_volume(scene, paths, idx, state->pixels[idx].rng);
+      alive[idx] = next_bounce(idx, false);
+    });
+
+    // compact the active queue
+    auto num_active = 0;
+    for (auto idx : active) {
+      if (paths.intersection[idx].hit && alive[idx])
+        active[num_active++] = idx;
+    }
+    active.resize(num_active);
+  }
+
+  // accumulate samples
+  auto pixels = std::vector<int>(num_paths);
+  for (auto idx = 0; idx < num_paths; idx++) pixels[idx] = idx;
+  wavefront_stage(pixels, params, [&](int idx) {
+    auto& pixel    = state->pixels[idx];
+    auto  radiance = paths.radiance[idx];
+    auto  hit      = (bool)paths.hit[idx];
+    if (!hit) {
+      if (params.envhidden || scene->environments.empty()) {
+        radiance = zero3f;
+        hit      = false;
+      } else {
+        hit = true;
+      }
+    }
+    if (!isfinite(radiance)) radiance = zero3f;
+    if (max(radiance) > params.clamp)
+      radiance = radiance * (params.clamp / max(radiance));
+    pixel.radiance += radiance;
+    pixel.hits += hit ? 1 : 0;
+    pixel.samples += 1;
+    state->render[idx] = {pixel.hits ? pixel.radiance / pixel.hits : zero3f,
+        (float)pixel.hits / (float)pixel.samples};
+  });
+}
+
 // Progressively compute an image by calling trace_samples multiple times.
 img::image<vec4f> trace_image(const trc::scene* scene,
     const trc::camera* camera, const trace_params& params,
@@ -2423,7 +2859,9 @@ img::image<vec4f> trace_image(const trc::scene* scene,
 
   for (auto sample = 0; sample < params.samples; sample++) {
     if (progress_cb) progress_cb("trace image", sample, params.samples);
-    if (params.noparallel) {
+    if (params.sampler == sampler_type::wavefront) {
+      trace_wavefront(state, scene, camera, params);
+    } else if (params.noparallel) {
       for (auto j = 0; j < state->render.size().y; j++) {
         for (auto i = 0; i < state->render.size().x; i++) {
           state->render[{i, j}] = trace_sample(
@@ -2472,6 +2910,12 @@ void trace_start(trc::state* state, const trc::scene* scene,
     for (auto sample = 0; sample < params.samples; sample++) {
       if (state->stop) return;
       if (progress_cb) progress_cb("trace img::image", sample, params.samples);
+      if (params.sampler == sampler_type::wavefront) {
+        trace_wavefront(state, scene, camera, params);
+        if (state->stop) return;
+        if (image_cb) image_cb(state->render, sample + 1, params.samples);
+        continue;
+      }
       parallel_for(state->render.size(), [&](const vec2i& ij) {
         if (state->stop) return;
         state->render[ij] = trace_sample(state, scene, camera, ij, params);
@@ -2508,6 +2952,7 @@ shape::~shape() {
 // cleanup
 scene::~scene() {
   if (bvh) delete bvh;
+  if (lights_bvh) delete lights_bvh;
 #ifdef YOCTO_EMBREE
   if (embree_bvh) rtcReleaseScene(embree_bvh);
 #endif
@@ -2569,24 +3014,28 @@ void set_focus(trc::camera* camera, float aperture, float focus) {
 
 // Add texture
 void set_texture(trc::texture* texture, const img::image<vec3b>& img) {
+  texture->type    = texture_type::colorb;
   texture->colorb  = img;
   texture->colorf  = {};
   texture->scalarb = {};
   texture->scalarf = {};
 }
 void set_texture(trc::texture* texture, const img::image<vec3f>& img) {
+  texture->type    = texture_type::colorf;
   texture->colorb  = {};
   texture->colorf  = img;
   texture->scalarb = {};
   texture->scalarf = {};
 }
 void set_texture(trc::texture* texture, const img::image<byte>& img) {
+  texture->type    = texture_type::scalarb;
   texture->colorb  = {};
   texture->colorf  = {};
   texture->scalarb = img;
   texture->scalarf = {};
 }
 void set_texture(trc::texture* texture, const img::image<float>& img) {
+  texture->type    = texture_type::scalarf;
   texture->colorb  = {};
   texture->colorf  = {};
   texture->scalarb = {};
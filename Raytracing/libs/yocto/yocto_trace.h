@@ -86,6 +86,7 @@ namespace trc = yocto::trace;
 namespace img = yocto::image;
 
 // Math defitions
+using math::alias_table;
 using math::bbox3f;
 using math::byte;
 using math::frame3f;
@@ -191,6 +192,7 @@ enum struct sampler_type {
   naive,       // naive path tracing
   eyelight,    // eyelight rendering
   falsecolor,  // false color rendering
+  wavefront,   // path tracing over queues of paths
 };
 // Type of false color visualization
 enum struct falsecolor_type {
@@ -235,7 +237,7 @@ struct trace_params {
 };
 
 const auto sampler_names = std::vector<std::string>{
-    "path", "naive", "eyelight", "falsecolor"};
+    "path", "naive", "eyelight", "falsecolor", "wavefront"};
 
 const auto falsecolor_names = std::vector<std::string>{"normal", "frontfacing",
     "gnormal", "gfrontfacing", "texcoord", "color", "emission", "diffuse",
@@ -338,9 +340,13 @@ struct camera {
   float   aperture     = 0;
 };
 
+// Texture storage, set once per texture to avoid testing each image.
+enum struct texture_type { none, colorf, colorb, scalarf, scalarb };
+
 // Texture containing either an LDR or HDR image. HdR images are encoded
 // in linear color space, while LDRs are encoded as sRGB.
 struct texture {
+  texture_type      type    = texture_type::none;
   img::image<vec3f> colorf  = {};
   img::image<vec3b> colorb  = {};
   img::image<float> scalarf = {};
@@ -432,7 +438,7 @@ struct environment {
   frame3f            frame        = identity3x4f;
   vec3f              emission     = {0, 0, 0};
   trc::texture*      emission_tex = nullptr;
-  std::vector<float> texels_cdf   = {};
+  alias_table        texels_alias = {};
 };
 
 // Trace lights used during rendering. These are created automatically.
@@ -459,8 +465,11 @@ struct scene {
   std::vector<trc::environment*> environments = {};
 
   // computed properties
-  std::vector<trc::light*> lights = {};
-  bvh_tree*                bvh    = nullptr;
+  std::vector<trc::light*> lights         = {};
+  alias_table              lights_alias   = {};  // light selection by power
+  bvh_tree*                lights_bvh     = nullptr;  // object light bounds
+  bvh_tree*                bvh            = nullptr;
+  std::vector<frame3f>     bvh_inv_frames = {};  // per bvh primitive
 #ifdef YOCTO_EMBREE
   RTCScene           embree_bvh       = nullptr;
   std::vector<vec2i> embree_instances = {};
@@ -508,8 +517,10 @@ struct intersection3f {
 // Intersect ray with a bvh returning either the first or any intersection
 // depending on `find_any`. Returns the ray distance , the instance id,
 // the shape element index and the element barycentric coordinates.
-intersection3f intersect_scene_bvh(const trc::scene* scene, const ray3f& ray,
-    bool find_any = false, bool non_rigid_frames = true);
+// Scene intersections use the inverse frames cached by init_bvh(), while
+// instance intersections invert the frame according to `non_rigid_frames`.
+intersection3f intersect_scene_bvh(
+    const trc::scene* scene, const ray3f& ray, bool find_any = false);
 intersection3f intersect_instance_bvh(const trc::object* object, int instance,
     const ray3f& ray, bool find_any = false, bool non_rigid_frames = true);
 
@@ -28,6 +28,7 @@
 
 #include "yocto_raytrace.h"
 
+#include <array>
 #include <atomic>
 #include <deque>
 #include <future>
@@ -44,27 +45,36 @@ namespace yocto::raytrace {
 using math::abs;
 using math::acos;
 using math::atan2;
+using math::byte_to_float;
 using math::clamp;
 using math::cos;
 using math::exp;
+using math::float_to_half;
 using math::flt_max;
 using math::fmod;
 using math::fresnel_conductor;
 using math::fresnel_dielectric;
+using math::half_to_float;
 using math::identity3x3f;
 using math::invalidb3f;
 using math::log;
+using math::log2;
+using math::make_alias_table;
 using math::make_rng;
 using math::max;
 using math::min;
 using math::pif;
 using math::pow;
+using math::rgb_to_srgb;
+using math::sample_alias;
+using math::sample_alias_pdf;
 using math::sample_discrete;
 using math::sample_discrete_pdf;
 using math::sample_uniform;
 using math::sample_uniform_pdf;
 using math::sin;
 using math::sqrt;
+using math::srgbb_to_rgb;
 using math::zero2f;
 using math::zero2i;
 using math::zero3f;
@@ -81,45 +91,261 @@ namespace yocto::raytrace {
 
 // Check texture size
 static vec2i texture_size(const rtr::texture* texture) {
-  if (!texture->colorf.empty()) {
-    return texture->colorf.size();
-  } else if (!texture->colorb.empty()) {
-    return texture->colorb.size();
-  } else if (!texture->scalarf.empty()) {
-    return texture->scalarf.size();
-  } else if (!texture->scalarb.empty()) {
-    return texture->scalarb.size();
-  } else {
-    return zero2i;
+  switch (texture->type) {
+    case texture_type::colorf: return texture->colorf.size();
+    case texture_type::colorb: return texture->colorb.size();
+    case texture_type::scalarf: return texture->scalarf.size();
+    case texture_type::scalarb: return texture->scalarb.size();
+    case texture_type::colorh: return texture->colorh.size();
+    case texture_type::scalarh: return texture->scalarh.size();
+    default: return zero2i;
   }
 }
 
-// Evaluate a texture
+// Evaluate a texture. Half textures hold LDRs decoded from sRGB by
+// init_textures(), so they are encoded back when LDRs are read as linear.
 static vec3f lookup_texture(
     const rtr::texture* texture, const vec2i& ij, bool ldr_as_linear = false) {
-  if (!texture->colorf.empty()) {
-    return texture->colorf[ij];
-  } else if (!texture->colorb.empty()) {
-    return ldr_as_linear ? byte_to_float(texture->colorb[ij])
-                         : srgb_to_rgb(byte_to_float(texture->colorb[ij]));
-  } else if (!texture->scalarf.empty()) {
-    return vec3f{texture->scalarf[ij]};
-  } else if (!texture->scalarb.empty()) {
-    return ldr_as_linear
-               ? byte_to_float(vec3b{texture->scalarb[ij]})
-               : srgb_to_rgb(byte_to_float(vec3b{texture->scalarb[ij]}));
+  switch (texture->type) {
+    case texture_type::colorf: return texture->colorf[ij];
+    case texture_type::colorb:
+      return ldr_as_linear ? byte_to_float(texture->colorb[ij])
+                           : srgbb_to_rgb(texture->colorb[ij]);
+    case texture_type::scalarf: return vec3f{texture->scalarf[ij]};
+    case texture_type::scalarb:
+      return vec3f{ldr_as_linear ? byte_to_float(texture->scalarb[ij])
+                                 : srgbb_to_rgb(texture->scalarb[ij])};
+    case texture_type::colorh: {
+      auto& texel = texture->colorh[ij];
+      auto  color = vec3f{half_to_float(texel.x), half_to_float(texel.y),
+          half_to_float(texel.z)};
+      return ldr_as_linear ? rgb_to_srgb(color) : color;
+    }
+    case texture_type::scalarh: {
+      auto value = half_to_float(texture->scalarh[ij]);
+      return vec3f{ldr_as_linear ? rgb_to_srgb(value) : value};
+    }
+    default: return {1, 1, 1};
+  }
+}
+
+// Tile cache key from texture, mip level and tile coordinates.
+static uint64_t make_tile_key(const rtr::texture* texture, int level,
+    const vec2i& tile) {
+  return ((uint64_t)texture->id << 42) | ((uint64_t)level << 36) |
+         ((uint64_t)tile.y << 18) | (uint64_t)tile.x;
+}
+
+// Check whether a texture holds a single channel.
+static bool is_scalar_texture(const rtr::texture* texture) {
+  return texture->type == texture_type::scalarf ||
+         texture->type == texture_type::scalarb ||
+         texture->type == texture_type::scalarh;
+}
+
+// Evaluate a mip level past the first.
+static vec3f lookup_mip(const texture_mip& mip, const vec2i& ij) {
+  if (!mip.scalar.empty()) return vec3f{half_to_float(mip.scalar[ij])};
+  auto& texel = mip.color[ij];
+  return {half_to_float(texel.x), half_to_float(texel.y),
+      half_to_float(texel.z)};
+}
+
+// Build the mip levels past the first, box filtering each level from the
+// one below it. Levels are built once, by the first thread that needs them.
+static void init_mips(rtr::texture* texture) {
+  if (texture->mips_ready) return;
+  auto lock = std::lock_guard{texture->mips_mutex};
+  if (texture->mips_ready) return;
+  texture->mips.clear();
+  auto scalar = is_scalar_texture(texture);
+  for (auto level = 1; level < (int)texture->levels.size(); level++) {
+    auto size  = texture->levels[level];
+    auto fsize = texture->levels[level - 1];
+    auto fetch = [&](int i, int j) {
+      i = min(i, fsize.x - 1);
+      j = min(j, fsize.y - 1);
+      return level == 1 ? lookup_texture(texture, {i, j})
+                        : lookup_mip(texture->mips[level - 2], {i, j});
+    };
+    auto mip = texture_mip{};
+    if (scalar) {
+      mip.scalar.resize(size);
+    } else {
+      mip.color.resize(size);
+    }
+    for (auto j = 0; j < size.y; j++) {
+      for (auto i = 0; i < size.x; i++) {
+        auto color = (fetch(i * 2 + 0, j * 2 + 0) +
+                         fetch(i * 2 + 1, j * 2 + 0) +
+                         fetch(i * 2 + 0, j * 2 + 1) +
+                         fetch(i * 2 + 1, j * 2 + 1)) /
+                     4;
+        if (scalar) {
+          mip.scalar[{i, j}] = float_to_half(color.x);
+        } else {
+          mip.color[{i, j}] = {float_to_half(color.x), float_to_half(color.y),
+              float_to_half(color.z)};
+        }
+      }
+    }
+    texture->mips.push_back(std::move(mip));
+  }
+  texture->mips_ready = true;
+}
+
+// Build a tile of a mip level. Level 0 decodes the source texels, while
+// coarser levels decode the mip levels built by init_mips().
+static texture_tile make_tile(
+    const rtr::texture* texture, int level, const vec2i& tile) {
+  auto tsize  = texture_tile_size;
+  auto size   = texture->levels[level];
+  auto texels = texture_tile(tsize * tsize, zero3f);
+  if (level > 0) init_mips(const_cast<rtr::texture*>(texture));
+  for (auto j = 0; j < tsize; j++) {
+    for (auto i = 0; i < tsize; i++) {
+      auto ij = vec2i{tile.x * tsize + i, tile.y * tsize + j};
+      if (ij.x >= size.x || ij.y >= size.y) continue;
+      texels[j * tsize + i] = level == 0
+                                  ? lookup_texture(texture, ij)
+                                  : lookup_mip(texture->mips[level - 1], ij);
+    }
+  }
+  return texels;
+}
+
+// Get a tile from the shared cache, building it if not present. Tiles are
+// built outside the shard lock.
+static texture_cache::tile_ptr get_cached_tile(
+    const rtr::texture* texture, int level, const vec2i& tile) {
+  auto  cache = texture->cache;
+  auto  key   = make_tile_key(texture, level, tile);
+  auto& shard =
+      cache->shards[((key * 0x9e3779b97f4a7c15ull) >> 32) %
+                    texture_cache_shards];
+  {
+    auto lock = std::lock_guard{shard.mutex};
+    if (auto it = shard.tiles.find(key); it != shard.tiles.end()) {
+      shard.lru.splice(shard.lru.begin(), shard.lru, it->second.second);
+      cache->hits++;
+      return it->second.first;
+    }
+  }
+  cache->misses++;
+  auto built = std::make_shared<const texture_tile>(
+      make_tile(texture, level, tile));
+  auto max_tiles = std::max(
+      cache->max_tiles / texture_cache_shards, (size_t)1);
+  auto lock = std::lock_guard{shard.mutex};
+  if (auto it = shard.tiles.find(key); it != shard.tiles.end())
+    return it->second.first;
+  while (!shard.lru.empty() && shard.tiles.size() >= max_tiles) {
+    shard.tiles.erase(shard.lru.back());
+    shard.lru.pop_back();
+  }
+  shard.lru.push_front(key);
+  shard.tiles[key] = {built, shard.lru.begin()};
+  return built;
+}
+
+// Per-thread direct-mapped cache of recently used tiles, read without
+// locking and without touching the shared LRU. Slots are chosen so that
+// the four tiles around a texel never collide, so a tile returned by
+// get_tile() stays valid while its neighbors are fetched.
+struct texture_front_cache {
+  static const int        size          = 32;
+  uint64_t                serials[size] = {};
+  uint64_t                keys[size]    = {};
+  texture_cache::tile_ptr tiles[size]   = {};
+};
+static thread_local texture_front_cache front_cache = {};
+
+// Get a tile through the front cache of the calling thread.
+static const texture_tile* get_tile(
+    const rtr::texture* texture, int level, const vec2i& tile) {
+  auto cache = texture->cache;
+  auto key   = make_tile_key(texture, level, tile);
+  auto slot  = (tile.x & 1) | ((tile.y & 1) << 1) |
+              ((int)((key ^ (key >> 18) ^ (key >> 36)) & 7) << 2);
+  if (front_cache.serials[slot] != cache->serial ||
+      front_cache.keys[slot] != key || !front_cache.tiles[slot]) {
+    front_cache.tiles[slot]   = get_cached_tile(texture, level, tile);
+    front_cache.serials[slot] = cache->serial;
+    front_cache.keys[slot]    = key;
+  }
+  return front_cache.tiles[slot].get();
+}
+
+// Evaluate a mip level of a texture with bilinear interpolation.
+static vec3f eval_texture_level(const rtr::texture* texture, int level,
+    const vec2f& uv, bool no_interpolation, bool clamp_to_edge) {
+  // get level width/height
+  auto size  = texture->levels[level];
+  auto tsize = texture_tile_size;
+
+  // get coordinates normalized for tiling
+  auto s = 0.0f, t = 0.0f;
+  if (clamp_to_edge) {
+    s = clamp(uv.x, 0.0f, 1.0f) * size.x;
+    t = clamp(uv.y, 0.0f, 1.0f) * size.y;
   } else {
-    return {1, 1, 1};
+    s = fmod(uv.x, 1.0f) * size.x;
+    if (s < 0) s += size.x;
+    t = fmod(uv.y, 1.0f) * size.y;
+    if (t < 0) t += size.y;
   }
+
+  // get image coordinates and residuals
+  auto i = clamp((int)s, 0, size.x - 1), j = clamp((int)t, 0, size.y - 1);
+  auto ii = (i + 1) % size.x, jj = (j + 1) % size.y;
+  auto u = s - i, v = t - j;
+
+  // fetch texels, reusing the tile of the first one when possible; tiles
+  // across the wrap-around may share its front cache slot, so they are
+  // fetched from the shared cache
+  auto tile   = vec2i{i / tsize, j / tsize};
+  auto texels = get_tile(texture, level, tile);
+  auto lookup = [&](int i, int j) {
+    auto other = vec2i{i / tsize, j / tsize};
+    auto idx   = (j % tsize) * tsize + (i % tsize);
+    if (other == tile) return (*texels)[idx];
+    if (other.x < tile.x || other.y < tile.y)
+      return (*get_cached_tile(texture, level, other))[idx];
+    return (*get_tile(texture, level, other))[idx];
+  };
+
+  if (no_interpolation) return lookup(i, j);
+
+  // handle interpolation
+  return lookup(i, j) * (1 - u) * (1 - v) + lookup(i, jj) * (1 - u) * v +
+         lookup(ii, j) * u * (1 - v) + lookup(ii, jj) * u * v;
 }
 
-// Evaluate a texture
+// Evaluate a texture. The filter `width` is the size of the lookup footprint
+// in texture coordinates and selects the mip levels to blend.
 static vec3f eval_texture(const rtr::texture* texture, const vec2f& uv,
     bool ldr_as_linear = false, bool no_interpolation = false,
-    bool clamp_to_edge = false) {
+    bool clamp_to_edge = false, float width = 0) {
   // get texture
   if (!texture) return {1, 1, 1};
 
+  // go through the mip pyramid when available
+  if (texture->cache && !ldr_as_linear) {
+    auto size   = texture->levels[0];
+    auto nlevels = (int)texture->levels.size();
+    auto lod    = width > 0 ? log2(width * max(size.x, size.y)) : 0.0f;
+    lod         = clamp(lod, 0.0f, (float)(nlevels - 1));
+    auto level  = (int)lod;
+    auto alpha  = lod - level;
+    if (alpha == 0 || no_interpolation || level + 1 >= nlevels)
+      return eval_texture_level(
+          texture, level, uv, no_interpolation, clamp_to_edge);
+    return eval_texture_level(texture, level, uv, false, clamp_to_edge) *
+               (1 - alpha) +
+           eval_texture_level(texture, level + 1, uv, false, clamp_to_edge) *
+               alpha;
+  }
+
   // get yimg::image width/height
   auto size = texture_size(texture);
 
@@ -149,8 +375,8 @@ static vec3f eval_texture(const rtr::texture* texture, const vec2f& uv,
          lookup_texture(texture, {ii, jj}, ldr_as_linear) * u * v;
 }
 static float eval_texturef(const rtr::texture* texture, const vec2f& uv,
-    bool ldr_as_linear = false) {
-  return eval_texture(texture, uv, ldr_as_linear).x;
+    bool ldr_as_linear = false, float width = 0) {
+  return eval_texture(texture, uv, ldr_as_linear, false, false, width).x;
 }
 
 // Generates a ray from a camera for yimg::image plane coordinate uv and
@@ -236,6 +462,43 @@ static vec2f eval_texcoord(
   }
 }
 
+// World frame of an object instance.
+static frame3f eval_frame(const rtr::object* object, int instance) {
+  return object->instance->frames[instance] * object->frame;
+}
+
+// Size of a ray footprint in texture space, given the position derivatives
+// of the ray along the image axes. Returns zero when not defined.
+static float eval_texcoord_width(const rtr::object* object,
+    const frame3f& frame, int element, const vec3f& dpdx, const vec3f& dpdy) {
+  auto shape = object->shape;
+  if (shape->triangles.empty() || shape->texcoords.empty()) return 0;
+
+  // position derivatives with respect to texture coordinates
+  auto t     = shape->triangles[element];
+  auto p0    = transform_point(frame, shape->positions[t.x]);
+  auto p1    = transform_point(frame, shape->positions[t.y]);
+  auto p2    = transform_point(frame, shape->positions[t.z]);
+  auto duv02 = shape->texcoords[t.x] - shape->texcoords[t.z];
+  auto duv12 = shape->texcoords[t.y] - shape->texcoords[t.z];
+  auto det   = duv02.x * duv12.y - duv02.y * duv12.x;
+  if (det == 0) return 0;
+  auto dpdu = (duv12.y * (p0 - p2) - duv02.y * (p1 - p2)) / det;
+  auto dpdv = (duv02.x * (p1 - p2) - duv12.x * (p0 - p2)) / det;
+
+  // project the footprint on the texture tangents by least squares
+  auto a = dot(dpdu, dpdu), b = dot(dpdu, dpdv), c = dot(dpdv, dpdv);
+  auto ldet = a * c - b * b;
+  if (ldet == 0) return 0;
+  auto duvdx = vec2f{c * dot(dpdu, dpdx) - b * dot(dpdv, dpdx),
+                   a * dot(dpdv, dpdx) - b * dot(dpdu, dpdx)} /
+               ldet;
+  auto duvdy = vec2f{c * dot(dpdu, dpdy) - b * dot(dpdv, dpdy),
+                   a * dot(dpdv, dpdy) - b * dot(dpdu, dpdy)} /
+               ldet;
+  return max(length(duvdx), length(duvdy));
+}
+
 // Evaluate all environment color.
 static vec3f eval_environment(const rtr::scene* scene, const ray3f& ray) {
   auto emission = zero3f;
@@ -394,6 +657,27 @@ static void init_bvh(rtr::shape* shape, const trace_params& params) {
   for (auto& primitive : primitives) {
     shape->bvh->primitives.push_back(primitive.primitive);
   }
+
+  // copy leaf triangles
+  if (params.bvhleaves && !shape->triangles.empty()) {
+    for (auto& node : shape->bvh->nodes) {
+      if (node.internal) continue;
+      auto& leaf = shape->bvh->leaves.emplace_back();
+      leaf.num   = node.num;
+      for (auto lane = 0; lane < node.num; lane++) {
+        auto  element = shape->bvh->primitives[node.start + lane];
+        auto& t       = shape->triangles[element];
+        auto  p0      = shape->positions[t.x];
+        auto  e1      = shape->positions[t.y] - p0;
+        auto  e2      = shape->positions[t.z] - p0;
+        leaf.p0x[lane] = p0.x, leaf.p0y[lane] = p0.y, leaf.p0z[lane] = p0.z;
+        leaf.e1x[lane] = e1.x, leaf.e1y[lane] = e1.y, leaf.e1z[lane] = e1.z;
+        leaf.e2x[lane] = e2.x, leaf.e2y[lane] = e2.y, leaf.e2z[lane] = e2.z;
+        leaf.elements[lane] = element;
+      }
+      node.start = (int)shape->bvh->leaves.size() - 1;
+    }
+  }
 }
 
 void init_bvh(rtr::scene* scene, const trace_params& params,
@@ -410,17 +694,24 @@ void init_bvh(rtr::scene* scene, const trace_params& params,
   // handle progress
   if (progress_cb) progress_cb("build scene bvh", progress.x++, progress.y);
 
-  // instance bboxes
+  // instance bboxes, with cached inverse frames
   auto primitives = std::vector<bvh_primitive>{};
-  auto object_id  = 0;
-  for (auto object : scene->objects) {
-    auto& primitive = primitives.emplace_back();
-    primitive.bbox =
-        object->shape->bvh->nodes.empty()
-            ? invalidb3f
-            : transform_bbox(object->frame, object->shape->bvh->nodes[0].bbox);
-    primitive.center    = center(primitive.bbox);
-    primitive.primitive = object_id++;
+  scene->bvh_instances.clear();
+  for (auto object_id = 0; object_id < scene->objects.size(); object_id++) {
+    auto object = scene->objects[object_id];
+    for (auto instance_id = 0; instance_id < object->instance->frames.size();
+         instance_id++) {
+      auto  frame     = eval_frame(object, instance_id);
+      auto& primitive = primitives.emplace_back();
+      primitive.bbox  = object->shape->bvh->nodes.empty()
+                           ? invalidb3f
+                           : transform_bbox(
+                                 frame, object->shape->bvh->nodes[0].bbox);
+      primitive.center    = center(primitive.bbox);
+      primitive.primitive = (int)scene->bvh_instances.size();
+      scene->bvh_instances.push_back(
+          {object_id, instance_id, inverse(frame, !is_rigid(frame))});
+    }
   }
 
   // build nodes
@@ -438,6 +729,157 @@ void init_bvh(rtr::scene* scene, const trace_params& params,
   if (progress_cb) progress_cb("build bvh", progress.x++, progress.y);
 }
 
+void init_textures(rtr::scene* scene, const trace_params& params,
+    progress_callback progress_cb) {
+  // handle progress
+  auto progress = vec2i{0, 1 + (int)scene->textures.size()};
+
+  // cache
+  if (scene->tcache) delete scene->tcache;
+  scene->tcache = nullptr;
+  if (params.mipmap && params.tcache > 0) {
+    static auto serials   = std::atomic<uint64_t>{0};
+    scene->tcache         = new texture_cache{};
+    scene->tcache->serial = ++serials;
+  }
+
+  // convert LDR textures to linear halfs
+  if (params.halfldr) {
+    for (auto texture : scene->textures) {
+      if (texture->type == texture_type::colorb) {
+        texture->colorh.resize(texture->colorb.size());
+        for (auto idx = 0; idx < texture->colorb.count(); idx++) {
+          auto color           = srgbb_to_rgb(texture->colorb[idx]);
+          texture->colorh[idx] = {float_to_half(color.x),
+              float_to_half(color.y), float_to_half(color.z)};
+        }
+        texture->colorb = {};
+        texture->type   = texture_type::colorh;
+      } else if (texture->type == texture_type::scalarb) {
+        texture->scalarh.resize(texture->scalarb.size());
+        for (auto idx = 0; idx < texture->scalarb.count(); idx++) {
+          texture->scalarh[idx] = float_to_half(
+              srgbb_to_rgb(texture->scalarb[idx]));
+        }
+        texture->scalarb = {};
+        texture->type    = texture_type::scalarh;
+      }
+    }
+  }
+
+  // mip pyramids
+  auto texture_id = 0;
+  for (auto texture : scene->textures) {
+    if (progress_cb) progress_cb("build texture", progress.x++, progress.y);
+    texture->id    = texture_id++;
+    texture->cache = nullptr;
+    texture->levels.clear();
+    texture->mips.clear();
+    texture->mips_ready = false;
+    auto size = texture_size(texture);
+    if (!scene->tcache || size == zero2i) continue;
+    texture->levels.push_back(size);
+    auto texel_bytes = is_scalar_texture(texture) ? sizeof(ushort)
+                                                  : sizeof(vec3h);
+    while (size != vec2i{1, 1}) {
+      size = {max(size.x / 2, 1), max(size.y / 2, 1)};
+      texture->levels.push_back(size);
+      scene->tcache->mip_bytes += (size_t)size.x * size.y * texel_bytes;
+    }
+    texture->cache = scene->tcache;
+  }
+
+  // tiles get the cache budget left by the mip levels
+  if (scene->tcache) {
+    auto budget     = (size_t)params.tcache * (1 << 20);
+    auto mip_bytes  = scene->tcache->mip_bytes;
+    auto tile_bytes = sizeof(vec3f) * texture_tile_size * texture_tile_size;
+    scene->tcache->max_tiles = std::max(
+        (budget > mip_bytes ? budget - mip_bytes : 0) / tile_bytes,
+        (size_t)256);
+  }
+
+  // handle progress
+  if (progress_cb) progress_cb("build textures", progress.x++, progress.y);
+}
+
+// Forward declaration
+template <typename Func>
+inline void parallel_for(const vec2i& size, Func&& func);
+
+void init_lights(rtr::scene* scene, progress_callback progress_cb) {
+  // handle progress
+  auto progress = vec2i{0, 1};
+  if (progress_cb) progress_cb("build light", progress.x++, progress.y);
+
+  scene->lights.clear();
+  for (auto environment : scene->environments) {
+    environment->texels_alias = {};
+    if (environment->emission == zero3f || !environment->emission_tex) continue;
+    if (progress_cb) progress_cb("build light", progress.x++, ++progress.y);
+    auto texture = environment->emission_tex;
+    auto size    = texture_size(texture);
+    auto weights = std::vector<float>(size.x * size.y);
+    parallel_for(size, [&](const vec2i& ij) {
+      auto th = (ij.y + 0.5f) * pif / size.y;
+      weights[ij.y * size.x + ij.x] = max(lookup_texture(texture, ij)) *
+                                      sin(th);
+    });
+    environment->texels_alias = make_alias_table(weights);
+    if (!environment->texels_alias.prob.empty())
+      scene->lights.push_back(environment);
+  }
+
+  // handle progress
+  if (progress_cb) progress_cb("build light", progress.x++, progress.y);
+}
+
+// Intersect a ray with the triangles of a leaf. Lanes are computed together,
+// following intersect_triangle(), and the leaf is skipped as soon as no lane
+// passes the first barycentric test.
+static bool intersect_leaf(const bvh_leaf& leaf, const ray3f& ray,
+    int& element, vec2f& uv, float& distance) {
+  // compute determinant to solve a linear system
+  auto pvx     = ray.d.y * leaf.e2z - ray.d.z * leaf.e2y;
+  auto pvy     = ray.d.z * leaf.e2x - ray.d.x * leaf.e2z;
+  auto pvz     = ray.d.x * leaf.e2y - ray.d.y * leaf.e2x;
+  auto det     = leaf.e1x * pvx + leaf.e1y * pvy + leaf.e1z * pvz;
+  auto inv_det = 1.0f / det;
+
+  // compute and check first bricentric coordinated
+  auto tvx  = ray.o.x - leaf.p0x;
+  auto tvy  = ray.o.y - leaf.p0y;
+  auto tvz  = ray.o.z - leaf.p0z;
+  auto u    = (tvx * pvx + tvy * pvy + tvz * pvz) * inv_det;
+  auto mask = 0;
+  for (auto lane = 0; lane < leaf.num; lane++) {
+    if (det[lane] != 0 && u[lane] >= 0 && u[lane] <= 1) mask |= 1 << lane;
+  }
+  if (!mask) return false;
+
+  // compute second bricentric coordinated and ray parameter
+  auto qvx = tvy * leaf.e1z - tvz * leaf.e1y;
+  auto qvy = tvz * leaf.e1x - tvx * leaf.e1z;
+  auto qvz = tvx * leaf.e1y - tvy * leaf.e1x;
+  auto v   = (ray.d.x * qvx + ray.d.y * qvy + ray.d.z * qvz) * inv_det;
+  auto t   = (leaf.e2x * qvx + leaf.e2y * qvy + leaf.e2z * qvz) * inv_det;
+
+  // check lanes, keeping the closest hit
+  auto hit  = false;
+  auto tmax = ray.tmax;
+  for (auto lane = 0; lane < leaf.num; lane++) {
+    if (!(mask & (1 << lane))) continue;
+    if (v[lane] < 0 || u[lane] + v[lane] > 1) continue;
+    if (t[lane] < ray.tmin || t[lane] > tmax) continue;
+    hit      = true;
+    element  = leaf.elements[lane];
+    uv       = {u[lane], v[lane]};
+    distance = t[lane];
+    tmax     = t[lane];
+  }
+  return hit;
+}
+
 // Intersect ray with a bvh->
 static bool intersect_shape_bvh(rtr::shape* shape, const ray3f& ray_,
     int& element, vec2f& uv, float& distance, bool find_any) {
@@ -504,6 +946,11 @@ static bool intersect_shape_bvh(rtr::shape* shape, const ray3f& ray_,
           ray.tmax = distance;
         }
       }
+    } else if (!bvh->leaves.empty()) {
+      if (intersect_leaf(bvh->leaves[node.start], ray, element, uv, distance)) {
+        hit      = true;
+        ray.tmax = distance;
+      }
     } else if (!shape->triangles.empty()) {
       for (auto idx = node.start; idx < node.start + node.num; idx++) {
         auto& t = shape->triangles[shape->bvh->primitives[idx]];
@@ -525,8 +972,8 @@ static bool intersect_shape_bvh(rtr::shape* shape, const ray3f& ray_,
 
 // Intersect ray with a bvh->
 static bool intersect_scene_bvh(const rtr::scene* scene, const ray3f& ray_,
-    int& object, int& element, vec2f& uv, float& distance, bool find_any,
-    bool non_rigid_frames) {
+    int& object, int& instance, int& element, vec2f& uv, float& distance,
+    bool find_any) {
   // get bvh and scene pointers for fast access
   auto bvh = scene->bvh;
 
@@ -572,13 +1019,14 @@ static bool intersect_scene_bvh(const rtr::scene* scene, const ray3f& ray_,
       }
     } else {
       for (auto idx = node.start; idx < node.start + node.num; idx++) {
-        auto object_ = scene->objects[scene->bvh->primitives[idx]];
-        auto inv_ray = transform_ray(
-            inverse(object_->frame, non_rigid_frames), ray);
+        auto& instance_ = scene->bvh_instances[scene->bvh->primitives[idx]];
+        auto  object_   = scene->objects[instance_.object];
+        auto  inv_ray   = transform_ray(instance_.inv_frame, ray);
         if (intersect_shape_bvh(
                 object_->shape, inv_ray, element, uv, distance, find_any)) {
           hit      = true;
-          object   = scene->bvh->primitives[idx];
+          object   = instance_.object;
+          instance = instance_.instance;
           ray.tmax = distance;
         }
       }
@@ -592,27 +1040,30 @@ static bool intersect_scene_bvh(const rtr::scene* scene, const ray3f& ray_,
 }
 
 // Intersect ray with a bvh->
-static bool intersect_instance_bvh(const rtr::object* object, const ray3f& ray,
-    int& element, vec2f& uv, float& distance, bool find_any,
+static bool intersect_instance_bvh(const rtr::object* object, int instance,
+    const ray3f& ray, int& element, vec2f& uv, float& distance, bool find_any,
     bool non_rigid_frames) {
-  auto inv_ray = transform_ray(inverse(object->frame, non_rigid_frames), ray);
+  auto frame   = eval_frame(object, instance);
+  auto inv_ray = transform_ray(inverse(frame, non_rigid_frames), ray);
   return intersect_shape_bvh(
       object->shape, inv_ray, element, uv, distance, find_any);
 }
 
-intersection3f intersect_scene_bvh(const rtr::scene* scene, const ray3f& ray,
-    bool find_any, bool non_rigid_frames) {
+intersection3f intersect_scene_bvh(
+    const rtr::scene* scene, const ray3f& ray, bool find_any) {
   auto intersection = intersection3f{};
   intersection.hit  = intersect_scene_bvh(scene, ray, intersection.object,
-      intersection.element, intersection.uv, intersection.distance, find_any,
-      non_rigid_frames);
+      intersection.instance, intersection.element, intersection.uv,
+      intersection.distance, find_any);
   return intersection;
 }
-intersection3f intersect_instance_bvh(const rtr::object* object,
+intersection3f intersect_instance_bvh(const rtr::object* object, int instance,
     const ray3f& ray, bool find_any, bool non_rigid_frames) {
-  auto intersection = intersection3f{};
-  intersection.hit  = intersect_instance_bvh(object, ray, intersection.element,
-      intersection.uv, intersection.distance, find_any, non_rigid_frames);
+  auto intersection     = intersection3f{};
+  intersection.hit      = intersect_instance_bvh(object, instance, ray,
+      intersection.element, intersection.uv, intersection.distance, find_any,
+      non_rigid_frames);
+  intersection.instance = instance;
   return intersection;
 }
 
@@ -624,8 +1075,90 @@ intersection3f intersect_instance_bvh(const rtr::object* object,
 #include <iostream>
 namespace yocto::raytrace {
 
+// Ray differentials, tracking how ray origins and directions change across
+// neighboring pixels, used to select texture mip levels. Differentials are
+// transferred to hits and reflected on specular bounces, while other
+// bounces keep their spread as a conservative footprint.
+struct ray_differentials {
+  vec3f dodx = zero3f;
+  vec3f dody = zero3f;
+  vec3f dddx = zero3f;
+  vec3f dddy = zero3f;
+};
 
-inline vec3f trace_custom(const rtr::scene* scene, const ray3f& ray, int bounce, rng_state& rng, const trace_params& params) {
+// Transfer differentials to a surface hit at `distance` along `ray`.
+static ray_differentials transfer_differentials(const ray_differentials& rd,
+    const ray3f& ray, float distance, const vec3f& normal) {
+  auto cos_theta = dot(ray.d, normal);
+  if (cos_theta == 0) return rd;
+  auto dpdx = rd.dodx + distance * rd.dddx;
+  auto dpdy = rd.dody + distance * rd.dddy;
+  dpdx -= ray.d * (dot(dpdx, normal) / cos_theta);
+  dpdy -= ray.d * (dot(dpdy, normal) / cos_theta);
+  return {dpdx, dpdy, rd.dddx, rd.dddy};
+}
+
+// Differentials of a ray mirrored about `normal`, ignoring curvature.
+static ray_differentials reflect_differentials(
+    const ray_differentials& rd, const vec3f& normal) {
+  return {rd.dodx, rd.dody, rd.dddx - 2 * dot(rd.dddx, normal) * normal,
+      rd.dddy - 2 * dot(rd.dddy, normal) * normal};
+}
+
+// Sample an environment direction proportionally to its emission. Texels are
+// picked with the alias table and sampled uniformly in texture coordinates.
+static vec3f sample_environment(const rtr::environment* environment,
+    float rel, float ralias, const vec2f& ruv) {
+  auto size = texture_size(environment->emission_tex);
+  auto idx  = sample_alias(environment->texels_alias, rel, ralias);
+  auto uv   = vec2f{
+      (idx % size.x + ruv.x) / size.x, (idx / size.x + ruv.y) / size.y};
+  return transform_direction(environment->frame,
+      {cos(uv.x * 2 * pif) * sin(uv.y * pif), cos(uv.y * pif),
+          sin(uv.x * 2 * pif) * sin(uv.y * pif)});
+}
+
+// Pdf for environment sampling wrt solid angle.
+static float sample_environment_pdf(
+    const rtr::environment* environment, const vec3f& direction) {
+  auto size     = texture_size(environment->emission_tex);
+  auto wl       = transform_direction(inverse(environment->frame), direction);
+  auto texcoord = vec2f{
+      atan2(wl.z, wl.x) / (2 * pif), acos(clamp(wl.y, -1.0f, 1.0f)) / pif};
+  if (texcoord.x < 0) texcoord.x += 1;
+  auto i         = clamp((int)(texcoord.x * size.x), 0, size.x - 1);
+  auto j         = clamp((int)(texcoord.y * size.y), 0, size.y - 1);
+  auto prob      = sample_alias_pdf(environment->texels_alias, j * size.x + i);
+  auto sin_theta = sqrt(max(1 - wl.y * wl.y, 0.0f));
+  if (sin_theta == 0) return 0;
+  return prob / ((2 * pif / size.x) * (pif / size.y) * sin_theta);
+}
+
+// Sample an incoming direction for rough and diffuse bounces. When the scene
+// has sampled environments, half of the directions are drawn from them.
+static vec3f sample_incoming(
+    const rtr::scene* scene, const vec3f& normal, rng_state& rng) {
+  if (scene->lights.empty() || rand1f(rng) < 0.5f)
+    return math::sample_hemisphere(normal, rand2f(rng));
+  auto environment =
+      scene->lights[sample_uniform((int)scene->lights.size(), rand1f(rng))];
+  auto rel    = rand1f(rng);
+  auto ralias = rand1f(rng);
+  return sample_environment(environment, rel, ralias, rand2f(rng));
+}
+
+// Pdf for incoming direction sampling, mixing both strategies.
+static float sample_incoming_pdf(
+    const rtr::scene* scene, const vec3f& normal, const vec3f& incoming) {
+  auto pdf = math::sample_hemisphere_pdf(normal, incoming);
+  if (scene->lights.empty()) return pdf;
+  auto lpdf = 0.0f;
+  for (auto environment : scene->lights)
+    lpdf += sample_environment_pdf(environment, incoming);
+  return 0.5f * pdf + 0.5f * lpdf / scene->lights.size();
+}
+
+inline vec3f trace_custom(const rtr::scene* scene, const ray3f& ray, const ray_differentials& rd, int bounce, rng_state& rng, const trace_params& params) {
     // intersects the ray within scene
     intersection3f i = intersect_scene_bvh(scene, ray, false);
 
@@ -638,10 +1171,11 @@ inline vec3f trace_custom(const rtr::scene* scene, const ray3f& ray, int bounce,
     // get object and material hit
     rtr::object * object = scene->objects[i.object];
     rtr::material * material = object->material;
+    frame3f frame = eval_frame(object, i.instance);
 
     // world normal and position
-    vec3f position = math::transform_point(object->frame, eval_position(object->shape, i.element, i.uv));
-    vec3f normal = math::transform_direction(object->frame, eval_normal(object->shape, i.element, i.uv));
+    vec3f position = math::transform_point(frame, eval_position(object->shape, i.element, i.uv));
+    vec3f normal = math::transform_direction(frame, eval_normal(object->shape, i.element, i.uv));
 
     // if dot is less than 0 (opacity call) then flip normal
     if(math::dot(normal, -ray.d) < 0) {
@@ -656,94 +1190,103 @@ inline vec3f trace_custom(const rtr::scene* scene, const ray3f& ray, int bounce,
     text_coord.x = fmod(text_coord.x, 1.f);
     text_coord.y = fmod(text_coord.y, 1.f);
 
+    // transfer differentials to the hit and project them in texture space
+    ray_differentials hit_rd = transfer_differentials(rd, ray, i.distance, normal);
+    ray_differentials reflect_rd = reflect_differentials(hit_rd, normal);
+    float text_width = eval_texcoord_width(object, frame, i.element, hit_rd.dodx, hit_rd.dody);
+
     // calculate light, color and opacity
-    vec3f light = material->emission * eval_texture(material->emission_tex, text_coord);
-    vec3f color = material->color * eval_texture(material->color_tex, text_coord);
-    float opacity = material->opacity * eval_texturef(material->opacity_tex, text_coord);
+    vec3f light = material->emission * eval_texture(material->emission_tex, text_coord, false, false, false, text_width);
+    vec3f color = material->color * eval_texture(material->color_tex, text_coord, false, false, false, text_width);
+    float opacity = material->opacity * eval_texturef(material->opacity_tex, text_coord, false, text_width);
     
     // exit if enough bounces are done
     if(bounce >= params.bounces) return light;
 
     // opacity
-    if(math::rand1f(rng) >= opacity) return trace_custom(scene, ray3f{position, ray.d}, bounce, rng, params);
+    if(math::rand1f(rng) >= opacity) return trace_custom(scene, ray3f{position, ray.d}, hit_rd, bounce, rng, params);
 
     // transmission -> polished dielectric
     if(material->transmission) {
         if(math::rand1f(rng) < math::fresnel_schlick(vec3f(0.04f,0.04f,0.04f), normal, -ray.d).x) {
-            light += trace_custom(scene, ray3f{position, math::reflect(-ray.d, normal)}, bounce+1, rng, params);
+            light += trace_custom(scene, ray3f{position, math::reflect(-ray.d, normal)}, reflect_rd, bounce+1, rng, params);
         }
         else {
-            light += color * trace_custom(scene, ray3f{position, ray.d}, bounce+1, rng, params);
+            light += color * trace_custom(scene, ray3f{position, ray.d}, hit_rd, bounce+1, rng, params);
         }
     }
     // metallic && !roughness -> polished metal
     else if(material->metallic && !material->roughness) {
         light += math::fresnel_schlick(color, normal, -ray.d)
-                * trace_custom(scene, ray3f{position, math::reflect(-ray.d, normal)}, bounce+1, rng, params);
+                * trace_custom(scene, ray3f{position, math::reflect(-ray.d, normal)}, reflect_rd, bounce+1, rng, params);
     }
     // metallic &&  roughness -> rough metal
     else if(material->metallic && material->roughness){
-        float roughness = material->roughness * material->roughness * eval_texturef(material->roughness_tex, text_coord);
+        float roughness = material->roughness * material->roughness * eval_texturef(material->roughness_tex, text_coord, false, text_width);
         vec3f outgoing = -ray.d;
-        vec3f incoming = math::sample_hemisphere(normal, math::rand2f(rng));
+        vec3f incoming = sample_incoming(scene, normal, rng);
+        if(math::dot(normal, incoming) <= 0) return light;
         vec3f halfway = math::normalize(outgoing + incoming);
 
-        light += (2 * pif) * math::fresnel_schlick(color, halfway, outgoing)
+        light += math::fresnel_schlick(color, halfway, outgoing)
         * math::microfacet_distribution(roughness, normal, halfway)
         * math::microfacet_shadowing(roughness, normal, halfway, outgoing, incoming)
         / (4 * dot(normal, outgoing) * dot(normal, incoming))
-        * trace_custom(scene, ray3f{position, incoming}, bounce+1, rng, params)
-        * dot(normal, incoming);
+        * trace_custom(scene, ray3f{position, incoming}, hit_rd, bounce+1, rng, params)
+        * dot(normal, incoming) / sample_incoming_pdf(scene, normal, incoming);
     }
     // specular -> rough plastic
     else if(material->specular){
-        float roughness = material->roughness * material->roughness * eval_texturef(material->roughness_tex, text_coord);
+        float roughness = material->roughness * material->roughness * eval_texturef(material->roughness_tex, text_coord, false, text_width);
         vec3f outgoing = -ray.d;
-        vec3f incoming = math::sample_hemisphere(normal, math::rand2f(rng));
+        vec3f incoming = sample_incoming(scene, normal, rng);
+        if(math::dot(normal, incoming) <= 0) return light;
         vec3f halfway = math::normalize(outgoing + incoming);
 
         vec3f F = math::fresnel_schlick(vec3f(0.04f,0.04f,0.04f), halfway, outgoing);
         float D = math::microfacet_distribution(roughness, normal, halfway);
         float G = math::microfacet_shadowing(roughness, normal, halfway, outgoing, incoming);
 
-        light += (2.f * pif) * ((color / pif) * (1 - F)
+        light += ((color / pif) * (1 - F)
         + (F * D * G) / (4 * dot(normal, outgoing) * dot(normal, incoming)))
-        * trace_custom(scene, ray3f{position, incoming}, bounce+1, rng, params)
-        * dot(normal, incoming);
+        * trace_custom(scene, ray3f{position, incoming}, hit_rd, bounce+1, rng, params)
+        * dot(normal, incoming) / sample_incoming_pdf(scene, normal, incoming);
     }
     // else -> diffuse
     else {
-        vec3f random = math::sample_hemisphere(normal, rand2f(rng));
-        light += (2*pif) * (color / pif)
-                * trace_custom(scene, ray3f{position, random}, bounce + 1, rng, params)
-                * math::dot(normal, random);
+        vec3f random = sample_incoming(scene, normal, rng);
+        if(math::dot(normal, random) <= 0) return light;
+        light += (color / pif)
+                * trace_custom(scene, ray3f{position, random}, hit_rd, bounce + 1, rng, params)
+                * math::dot(normal, random) / sample_incoming_pdf(scene, normal, random);
     }
     return light;
 }
 
 // Raytrace renderer.
 static vec4f trace_raytrace(const rtr::scene* scene, const ray3f& ray,
-    int bounce, rng_state& rng, const trace_params& params) {
-    return vec4f(trace_custom(scene, ray, bounce, rng, params), 1.f);
+    const ray_differentials& rd, int bounce, rng_state& rng, const trace_params& params) {
+    return vec4f(trace_custom(scene, ray, rd, bounce, rng, params), 1.f);
 }
 
 // Eyelight for quick previewing.
 static vec4f trace_eyelight(const rtr::scene* scene, const ray3f& ray,
-    int bounce, rng_state& rng, const trace_params& params) {
+    const ray_differentials& rd, int bounce, rng_state& rng, const trace_params& params) {
     static vec4f black = {0,0,0,1};
     // intersects the ray within scene
     intersection3f i = intersect_scene_bvh(scene, ray, false);
     // if there is an intersection then calculate diffuse lighting and return it
     if(i.hit) {
         rtr::object * object = scene->objects[i.object];
-        vec3f normal = math::transform_direction(object->frame, eval_normal(object->shape, i.element, i.uv));
+        vec3f normal = math::transform_direction(eval_frame(object, i.instance), eval_normal(object->shape, i.element, i.uv));
         return vec4f(math::dot(normal, -ray.d) * object->material->color, 1);
     }
     // otherwise return black
     return black;
 }
 
-static vec4f trace_normal(const rtr::scene* scene, const ray3f& ray, int bounce,
+static vec4f trace_normal(const rtr::scene* scene, const ray3f& ray,
+    const ray_differentials& rd, int bounce,
     rng_state& rng, const trace_params& params) {
     static vec4f black = {0,0,0,1};
     // intersects the ray within scene
@@ -751,7 +1294,7 @@ static vec4f trace_normal(const rtr::scene* scene, const ray3f& ray, int bounce,
     // if there is an intersection then calculate object normals and return them
     if(i.hit) {
         rtr::object * object = scene->objects[i.object];
-        vec3f normal = math::transform_direction(object->frame, eval_normal(object->shape, i.element, i.uv));
+        vec3f normal = math::transform_direction(eval_frame(object, i.instance), eval_normal(object->shape, i.element, i.uv));
         return vec4f(normal * 0.5f + 0.5f, 1);
     }
     // otherwise return black
@@ -759,7 +1302,7 @@ static vec4f trace_normal(const rtr::scene* scene, const ray3f& ray, int bounce,
 }
 
 static vec4f trace_texcoord(const rtr::scene* scene, const ray3f& ray,
-    int bounce, rng_state& rng, const trace_params& params) {
+    const ray_differentials& rd, int bounce, rng_state& rng, const trace_params& params) {
     static vec4f black = {0,0,0,1};
     // intersects the ray within scene
     intersection3f i = intersect_scene_bvh(scene, ray, false);
@@ -773,7 +1316,8 @@ static vec4f trace_texcoord(const rtr::scene* scene, const ray3f& ray,
     return black;
 }
 
-static vec4f trace_color(const rtr::scene* scene, const ray3f& ray, int bounce,
+static vec4f trace_color(const rtr::scene* scene, const ray3f& ray,
+    const ray_differentials& rd, int bounce,
     rng_state& rng, const trace_params& params) {
     static vec4f black = {0,0,0,1};
     // intersects the ray within scene
@@ -786,7 +1330,7 @@ static vec4f trace_color(const rtr::scene* scene, const ray3f& ray, int bounce,
 
 // Trace a single ray from the camera using the given algorithm.
 using shader_func = vec4f (*)(const rtr::scene* scene, const ray3f& ray,
-    int bounce, rng_state& rng, const trace_params& params);
+    const ray_differentials& rd, int bounce, rng_state& rng, const trace_params& params);
 static shader_func get_trace_shader_func(const trace_params& params) {
   switch (params.shader) {
     case shader_type::raytrace: return trace_raytrace;
@@ -806,9 +1350,14 @@ vec4f trace_sample(rtr::state* state, const rtr::scene* scene,
     const rtr::camera* camera, const vec2i& ij, const trace_params& params) {
   auto  shader = get_trace_shader_func(params);
   auto& pixel  = state->pixels[ij];
-  auto  ray    = eval_camera(
-      camera, ((vec2f)ij + rand2f(pixel.rng)) / (vec2f)state->pixels.size());
-  auto shaded = shader(scene, ray, 0, pixel.rng, params);
+  auto  size   = (vec2f)state->pixels.size();
+  auto  uv     = ((vec2f)ij + rand2f(pixel.rng)) / size;
+  auto  ray    = eval_camera(camera, uv);
+  auto  rayx   = eval_camera(camera, uv + vec2f{1 / size.x, 0});
+  auto  rayy   = eval_camera(camera, uv + vec2f{0, 1 / size.y});
+  auto  rd     = ray_differentials{
+      rayx.o - ray.o, rayy.o - ray.o, rayx.d - ray.d, rayy.d - ray.d};
+  auto shaded = shader(scene, ray, rd, 0, pixel.rng, params);
   if (!isfinite(xyz(shaded))) xyz(shaded) = zero3f;
   if (max(xyz(shaded)) > params.clamp)
     xyz(shaded) = xyz(shaded) * (params.clamp / max(xyz(shaded)));
@@ -930,14 +1479,19 @@ shape::~shape() {
 // cleanup
 scene::~scene() {
   if (bvh) delete bvh;
+  if (tcache) delete tcache;
   for (auto camera : cameras) delete camera;
   for (auto object : objects) delete object;
   for (auto shape : shapes) delete shape;
   for (auto material : materials) delete material;
+  for (auto instance : instances) delete instance;
   for (auto texture : textures) delete texture;
   for (auto environment : environments) delete environment;
 }
 
+// Default instance
+static auto default_instance = instance{{identity3x4f}};
+
 // Add element
 rtr::camera* add_camera(rtr::scene* scene) {
   return scene->cameras.emplace_back(new camera{});
@@ -951,8 +1505,13 @@ rtr::shape* add_shape(rtr::scene* scene) {
 rtr::material* add_material(rtr::scene* scene) {
   return scene->materials.emplace_back(new material{});
 }
+rtr::instance* add_instance(rtr::scene* scene) {
+  return scene->instances.emplace_back(new instance{});
+}
 rtr::object* add_object(rtr::scene* scene) {
-  return scene->objects.emplace_back(new object{});
+  auto object_      = scene->objects.emplace_back(new object{});
+  object_->instance = &default_instance;
+  return object_;
 }
 rtr::environment* add_environment(rtr::scene* scene) {
   return scene->environments.emplace_back(new environment{});
@@ -974,52 +1533,97 @@ void set_focus(rtr::camera* camera, float aperture, float focus) {
 
 // Add texture
 void set_texture(rtr::texture* texture, const img::image<vec3b>& img) {
-  texture->colorb  = img;
+  set_texture(texture, img::image<vec3b>{img});
+}
+void set_texture(rtr::texture* texture, img::image<vec3b>&& img) {
+  texture->type    = texture_type::colorb;
+  texture->colorb  = std::move(img);
   texture->colorf  = {};
   texture->scalarb = {};
   texture->scalarf = {};
+  texture->colorh  = {};
+  texture->scalarh = {};
 }
 void set_texture(rtr::texture* texture, const img::image<vec3f>& img) {
+  set_texture(texture, img::image<vec3f>{img});
+}
+void set_texture(rtr::texture* texture, img::image<vec3f>&& img) {
+  texture->type    = texture_type::colorf;
   texture->colorb  = {};
-  texture->colorf  = img;
+  texture->colorf  = std::move(img);
   texture->scalarb = {};
   texture->scalarf = {};
+  texture->colorh  = {};
+  texture->scalarh = {};
 }
 void set_texture(rtr::texture* texture, const img::image<byte>& img) {
+  set_texture(texture, img::image<byte>{img});
+}
+void set_texture(rtr::texture* texture, img::image<byte>&& img) {
+  texture->type    = texture_type::scalarb;
   texture->colorb  = {};
   texture->colorf  = {};
-  texture->scalarb = img;
+  texture->scalarb = std::move(img);
   texture->scalarf = {};
+  texture->colorh  = {};
+  texture->scalarh = {};
 }
 void set_texture(rtr::texture* texture, const img::image<float>& img) {
+  set_texture(texture, img::image<float>{img});
+}
+void set_texture(rtr::texture* texture, img::image<float>&& img) {
+  texture->type    = texture_type::scalarf;
   texture->colorb  = {};
   texture->colorf  = {};
   texture->scalarb = {};
-  texture->scalarf = img;
+  texture->scalarf = std::move(img);
+  texture->colorh  = {};
+  texture->scalarh = {};
 }
 
 // Add shape
 void set_points(rtr::shape* shape, const std::vector<int>& points) {
   shape->points = points;
 }
+void set_points(rtr::shape* shape, std::vector<int>&& points) {
+  shape->points = std::move(points);
+}
 void set_lines(rtr::shape* shape, const std::vector<vec2i>& lines) {
   shape->lines = lines;
 }
+void set_lines(rtr::shape* shape, std::vector<vec2i>&& lines) {
+  shape->lines = std::move(lines);
+}
 void set_triangles(rtr::shape* shape, const std::vector<vec3i>& triangles) {
   shape->triangles = triangles;
 }
+void set_triangles(rtr::shape* shape, std::vector<vec3i>&& triangles) {
+  shape->triangles = std::move(triangles);
+}
 void set_positions(rtr::shape* shape, const std::vector<vec3f>& positions) {
   shape->positions = positions;
 }
+void set_positions(rtr::shape* shape, std::vector<vec3f>&& positions) {
+  shape->positions = std::move(positions);
+}
 void set_normals(rtr::shape* shape, const std::vector<vec3f>& normals) {
   shape->normals = normals;
 }
+void set_normals(rtr::shape* shape, std::vector<vec3f>&& normals) {
+  shape->normals = std::move(normals);
+}
 void set_texcoords(rtr::shape* shape, const std::vector<vec2f>& texcoords) {
   shape->texcoords = texcoords;
 }
+void set_texcoords(rtr::shape* shape, std::vector<vec2f>&& texcoords) {
+  shape->texcoords = std::move(texcoords);
+}
 void set_radius(rtr::shape* shape, const std::vector<float>& radius) {
   shape->radius = radius;
 }
+void set_radius(rtr::shape* shape, std::vector<float>&& radius) {
+  shape->radius = std::move(radius);
+}
 
 // Add object
 void set_frame(rtr::object* object, const frame3f& frame) {
@@ -1031,6 +1635,15 @@ void set_shape(rtr::object* object, rtr::shape* shape) {
 void set_material(rtr::object* object, rtr::material* material) {
   object->material = material;
 }
+void set_instance(rtr::object* object, rtr::instance* instance) {
+  object->instance = instance;
+  if (!object->instance) object->instance = &default_instance;
+}
+
+// Add instance
+void set_frames(rtr::instance* instance, const std::vector<frame3f>& frames) {
+  instance->frames = frames;
+}
 
 // Add material
 void set_emission(rtr::material* material, const vec3f& emission,
@@ -71,9 +71,13 @@
 #include <yocto/yocto_image.h>
 #include <yocto/yocto_math.h>
 
+#include <array>
 #include <atomic>
 #include <future>
+#include <list>
 #include <memory>
+#include <mutex>
+#include <unordered_map>
 
 // -----------------------------------------------------------------------------
 // ALIASES
@@ -85,12 +89,14 @@ namespace rtr = yocto::raytrace;
 namespace img = yocto::image;
 
 // Math defitions
+using math::alias_table;
 using math::bbox3f;
 using math::byte;
 using math::frame3f;
 using math::identity3x4f;
 using math::ray3f;
 using math::rng_state;
+using math::ushort;
 using math::vec2f;
 using math::vec2i;
 using math::vec3b;
@@ -115,6 +121,7 @@ struct environment;
 struct shape;
 struct texture;
 struct material;
+struct instance;
 struct object;
 
 // Add scene elements
@@ -123,6 +130,7 @@ rtr::object*      add_object(rtr::scene* scene);
 rtr::texture*     add_texture(rtr::scene* scene);
 rtr::material*    add_material(rtr::scene* scene);
 rtr::shape*       add_shape(rtr::scene* scene);
+rtr::instance*    add_instance(rtr::scene* scene);
 rtr::environment* add_environment(rtr::scene* scene);
 
 // camera properties
@@ -134,6 +142,10 @@ void set_focus(rtr::camera* camera, float aperture, float focus);
 void set_frame(rtr::object* object, const frame3f& frame);
 void set_material(rtr::object* object, rtr::material* material);
 void set_shape(rtr::object* object, rtr::shape* shape);
+void set_instance(rtr::object* object, rtr::instance* instance);
+
+// instance properties
+void set_frames(rtr::instance* instance, const std::vector<frame3f>& frames);
 
 // texture properties
 void set_texture(rtr::texture* texture, const img::image<vec3b>& img);
@@ -141,6 +153,12 @@ void set_texture(rtr::texture* texture, const img::image<vec3f>& img);
 void set_texture(rtr::texture* texture, const img::image<byte>& img);
 void set_texture(rtr::texture* texture, const img::image<float>& img);
 
+// texture properties, taking ownership of the image without copies
+void set_texture(rtr::texture* texture, img::image<vec3b>&& img);
+void set_texture(rtr::texture* texture, img::image<vec3f>&& img);
+void set_texture(rtr::texture* texture, img::image<byte>&& img);
+void set_texture(rtr::texture* texture, img::image<float>&& img);
+
 // material properties
 void set_emission(rtr::material* material, const vec3f& emission,
     rtr::texture* emission_tex = nullptr);
@@ -170,6 +188,15 @@ void set_normals(rtr::shape* shape, const std::vector<vec3f>& normals);
 void set_texcoords(rtr::shape* shape, const std::vector<vec2f>& texcoords);
 void set_radius(rtr::shape* shape, const std::vector<float>& radius);
 
+// shape properties, taking ownership of the arrays without copies
+void set_points(rtr::shape* shape, std::vector<int>&& points);
+void set_lines(rtr::shape* shape, std::vector<vec2i>&& lines);
+void set_triangles(rtr::shape* shape, std::vector<vec3i>&& triangles);
+void set_positions(rtr::shape* shape, std::vector<vec3f>&& positions);
+void set_normals(rtr::shape* shape, std::vector<vec3f>&& normals);
+void set_texcoords(rtr::shape* shape, std::vector<vec2f>&& texcoords);
+void set_radius(rtr::shape* shape, std::vector<float>&& radius);
+
 // environment properties
 void set_frame(rtr::environment* environment, const frame3f& frame);
 void set_emission(rtr::environment* environment, const vec3f& emission,
@@ -199,6 +226,10 @@ struct trace_params {
   uint64_t        seed       = default_seed;
   bool            noparallel = false;
   int             pratio     = 8;
+  bool            mipmap     = true;
+  int             tcache     = 256;  // texture cache size in MB
+  bool            halfldr    = false;  // store LDR textures as linear halfs
+  bool            bvhleaves  = true;   // copy triangles into BVH leaves
 };
 
 const auto shader_names = std::vector<std::string>{
@@ -212,6 +243,13 @@ using progress_callback =
 void init_bvh(rtr::scene* scene, const trace_params& params,
     progress_callback progress_cb = {});
 
+// Build the texture mip pyramids and the tile cache shared by all textures.
+void init_textures(rtr::scene* scene, const trace_params& params,
+    progress_callback progress_cb = {});
+
+// Build the sampling tables of textured environments.
+void init_lights(rtr::scene* scene, progress_callback progress_cb = {});
+
 // Initialize the rendering state
 struct state;
 void init_state(rtr::state* state, const rtr::scene* scene,
@@ -246,13 +284,36 @@ struct bvh_node {
   byte   axis;
 };
 
+// Object instance referenced by the scene BVH leaves, with the inverse of
+// its world frame cached to transform rays. Rigid frames are inverted by
+// transposition.
+struct bvh_instance {
+  int     object    = -1;
+  int     instance  = -1;
+  frame3f inv_frame = identity3x4f;
+};
+
+// Triangles of a BVH leaf stored as structure of arrays, with the first
+// vertex and the two edges of each triangle precomputed, so that all of
+// them are tested at once. Unused lanes hold degenerate triangles.
+struct bvh_leaf {
+  vec4f p0x = {}, p0y = {}, p0z = {};
+  vec4f e1x = {}, e1y = {}, e1z = {};
+  vec4f e2x = {}, e2y = {}, e2z = {};
+  vec4i elements = {-1, -1, -1, -1};
+  int   num      = 0;
+};
+
 // BVH tree stored as a node array with the tree structure is encoded using
 // array indices. BVH nodes indices refer to either the node array,
 // for internal nodes, or the primitive arrays, for leaf nodes.
+// If leaf triangles are stored, leaf nodes refer to the leaves array
+// instead, trading memory for fewer dependent loads when intersecting.
 // Application data is not stored explicitly.
 struct bvh_tree {
   std::vector<bvh_node> nodes      = {};
   std::vector<int>      primitives = {};
+  std::vector<bvh_leaf> leaves     = {};
 };
 
 // Camera based on a simple lens model. The camera is placed using a frame.
@@ -275,13 +336,81 @@ struct camera {
   float   aperture     = 0;
 };
 
+// Size of the square tiles in which textures are cached.
+const int texture_tile_size = 64;
+
+// Texture tile holding decoded linear texels, stored by rows.
+using texture_tile = std::vector<vec3f>;
+
+// Number of independently locked shards of the texture cache.
+const int texture_cache_shards = 16;
+
+// Bounded cache of texture tiles shared by all textures of a scene. Tiles
+// are decoded lazily on first access and evicted in least-recently-used
+// order once `max_tiles` is reached. Tiles are split in shards by key, each
+// guarded by its own mutex, and render threads keep a small front cache of
+// recent tiles that is read without locking. Tiles are shared so that
+// evicted ones remain valid for current readers. The serial number tells
+// apart caches in the front caches.
+// Counters record tile hits and misses in the shared cache. Mip levels
+// past the first are reserved out of the cache budget, in `mip_bytes`.
+struct texture_cache {
+  using tile_ptr   = std::shared_ptr<const texture_tile>;
+  using tile_entry = std::pair<tile_ptr, std::list<uint64_t>::iterator>;
+  struct shard {
+    std::list<uint64_t>                      lru   = {};
+    std::unordered_map<uint64_t, tile_entry> tiles = {};
+    std::mutex                               mutex = {};
+  };
+  size_t                                  max_tiles = 4096;
+  size_t                                  mip_bytes = 0;
+  uint64_t                                serial    = 0;
+  std::array<shard, texture_cache_shards> shards    = {};
+  std::atomic<uint64_t>                   hits      = 0;
+  std::atomic<uint64_t>                   misses    = 0;
+};
+
+// Texel of linear textures stored as half-precision floats.
+struct vec3h {
+  ushort x = 0;
+  ushort y = 0;
+  ushort z = 0;
+};
+
+// Mip level of a texture, stored as linear halfs with a single channel
+// for scalar textures.
+struct texture_mip {
+  img::image<vec3h>  color  = {};
+  img::image<ushort> scalar = {};
+};
+
+// Texture storage, set once per texture to avoid testing each image.
+enum struct texture_type {
+  none, colorf, colorb, scalarf, scalarb, colorh, scalarh
+};
+
 // Texture containing either an LDR or HDR image. HdR images are encoded
-// in linear color space, while LDRs are encoded as sRGB.
+// in linear color space, while LDRs are encoded as sRGB. LDRs may be
+// converted to linear halfs by `init_textures()`.
+// After `init_textures()`, lookups go through a mip pyramid whose tiles are
+// built on demand in the scene texture cache.
 struct texture {
-  img::image<vec3f> colorf  = {};
-  img::image<vec3b> colorb  = {};
-  img::image<float> scalarf = {};
-  img::image<byte>  scalarb = {};
+  texture_type        type    = texture_type::none;
+  img::image<vec3f>   colorf  = {};
+  img::image<vec3b>   colorb  = {};
+  img::image<float>   scalarf = {};
+  img::image<byte>    scalarb = {};
+  img::image<vec3h>   colorh  = {};
+  img::image<ushort>  scalarh = {};
+
+  // computed properties, with mip levels past the first built bottom-up
+  // once on first use
+  int                            id         = 0;
+  std::vector<vec2i>             levels     = {};
+  rtr::texture_cache*            cache      = nullptr;
+  std::vector<texture_mip>       mips       = {};
+  std::atomic<bool>              mips_ready = false;
+  std::mutex                     mips_mutex = {};
 };
 
 // Material for surfaces, lines and triangles.
@@ -339,11 +468,17 @@ struct shape {
   ~shape();
 };
 
+// Instances, shared by objects drawn multiple times.
+struct instance {
+  std::vector<frame3f> frames = {};
+};
+
 // Object.
 struct object {
-  frame3f         frame    = identity3x4f;
+  frame3f        frame    = identity3x4f;
   rtr::shape*    shape    = nullptr;
   rtr::material* material = nullptr;
+  rtr::instance* instance = nullptr;
 };
 
 // Environment map.
@@ -351,6 +486,7 @@ struct environment {
   frame3f            frame        = identity3x4f;
   vec3f              emission     = {0, 0, 0};
   rtr::texture*     emission_tex = nullptr;
+  alias_table        texels_alias = {};
 };
 
 // Scene comprised an array of objects whose memory is owened by the scene.
@@ -365,11 +501,15 @@ struct scene {
   std::vector<rtr::object*>      objects      = {};
   std::vector<rtr::shape*>       shapes       = {};
   std::vector<rtr::material*>    materials    = {};
+  std::vector<rtr::instance*>    instances    = {};
   std::vector<rtr::texture*>     textures     = {};
   std::vector<rtr::environment*> environments = {};
 
   // computed properties
-  bvh_tree*                  bvh    = nullptr;
+  bvh_tree*                 bvh           = nullptr;
+  std::vector<bvh_instance> bvh_instances = {};
+  rtr::texture_cache*       tcache        = nullptr;
+  std::vector<rtr::environment*> lights   = {};  // sampled environments
 
   // cleanup
   ~scene();
@@ -400,6 +540,7 @@ namespace yocto::raytrace {
 // Results values are set only if hit is true.
 struct intersection3f {
   int   object   = -1;
+  int   instance = -1;
   int   element  = -1;
   vec2f uv       = {0, 0};
   float distance = 0;
@@ -409,9 +550,12 @@ struct intersection3f {
 // Intersect ray with a bvh returning either the first or any intersection
 // depending on `find_any`. Returns the ray distance , the instance id,
 // the shape element index and the element barycentric coordinates.
-intersection3f intersect_scene_bvh(const rtr::scene* scene, const ray3f& ray,
-    bool find_any = false, bool non_rigid_frames = true);
-intersection3f intersect_instance_bvh(const rtr::object* object,
+// Scene intersections use the instance inverses cached by init_bvh(), which
+// handle non-rigid frames, while instance intersections invert the frame
+// according to `non_rigid_frames`.
+intersection3f intersect_scene_bvh(
+    const rtr::scene* scene, const ray3f& ray, bool find_any = false);
+intersection3f intersect_instance_bvh(const rtr::object* object, int instance,
     const ray3f& ray, bool find_any = false, bool non_rigid_frames = true);
 
 }  // namespace yocto::raytrace